@@ -1,36 +1,25 @@
+// converts rows of dimension floats without headers to fvecs, blocks of rows
+// are converted by parallel threads
 #include <iostream>
-#include <fstream>
 #include <cstdlib>
+#include <thread>
+#include "gqr/util/vecsio.h"
 using namespace std;
 int main(int argc, char** argv) {
-    if (argc <= 1) {
-        cout << "Usage: bin_to_fvecs binary_file_path output_fvecs_file_path dimension" << endl;
+    if (argc < 4) {
+        cout << "Usage: bin_to_fvecs binary_file_path output_fvecs_file_path dimension [num_threads]" << endl;
         return -1;
     }
     const char* binaryPath = argv[1];
     const char* outputPath = argv[2];
     int dimension = atoi(argv[3]);
-
-    ifstream fin(binaryPath, ios::binary);
-    if (!fin) {
-        cout << "cannot open file " << binaryPath << endl;
-        return -1;
-    }
-
-    ofstream fout(outputPath, ios::binary);
-    if (!fout) {
-        cout << "cannot create file " << outputPath << endl;
+    unsigned numThreads = argc > 4 ? atoi(argv[4]) : thread::hardware_concurrency();
+    if (dimension <= 0) {
+        cout << "invalid dimension " << argv[3] << endl;
         return -1;
     }
 
-    char* buffer = new char[sizeof(float) * dimension];
-    while(fin.read(buffer, sizeof(float) * dimension)) {
-        fout.write((char*)&dimension, sizeof(int));
-        fout.write(buffer, sizeof(float) * dimension);
-    }
-
-    fin.close();
-    fout.close();
-    delete buffer;
+    unsigned long long rows = lshbox::rawToFvecs<float>(binaryPath, outputPath, dimension, numThreads);
+    cout << rows << " vectors are written into " << outputPath << endl;
     return 0;
 }
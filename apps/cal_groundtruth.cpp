@@ -3,25 +3,13 @@
 #include <fstream>
 #include <climits>
 #include "gqr/util/cal_groundtruth.h"
+#include "gqr/util/bruteforce.h"
 using namespace std;
 using namespace lshbox;
 
-unsigned readFvecs(vector<vector<float>>& fvecs, ifstream& fin, unsigned maxNumRecords = UINT_MAX) {
-    int readNumRecords = 0;
-    int dimension;
-    while(readNumRecords < maxNumRecords && fin.read((char*)&dimension, sizeof(int))) {
-        readNumRecords++;
-        vector<float> vec;
-        vec.resize(dimension);
-        fin.read((char*)&vec[0], sizeof(float) * dimension);
-        fvecs.emplace_back(vec);
-    }
-    return readNumRecords;
-}
-
 int main(int argc, char** argv) {
     if (argc != 7 && argc != 8) {
-        cout << "usage: program base_file.fvecs query_file.fvecs K groundtruth_file.lshbox groundtruth_file.ivecs num_threads=4" << endl;
+        cout << "usage: program base_file.fvecs query_file.fvecs K groundtruth_file.lshbox groundtruth_file.ivecs metric num_threads=4" << endl;
         return 0;
     }
 
@@ -42,50 +30,43 @@ int main(int argc, char** argv) {
         cout << "query File "  << queryFileName << " does not exist "<< endl;
         return 0;
     }
-    vector<vector<float>> queryVecs;
-    readFvecs(queryVecs, queryFin);
     queryFin.close();
-
     ifstream baseFin(baseFileName, ios::binary);
     if (!baseFin) {
         cout << "base File " << baseFileName << " does not exist" << endl;
         return 0;
     }
+    baseFin.close();
 
-    typedef GTQuery<float> GTQuery;
-    vector<GTQuery> queryObjs;
-    for (int i = 0; i < queryVecs.size(); ++i) {
-        if (metric == "euclidean") {
-            queryObjs.push_back(GTQuery(queryVecs[i], K, calEuclideanDist));
-        } else if (metric == "angular") {
-            queryObjs.push_back(GTQuery(queryVecs[i], K, calAngularDist));
-        } else if (metric == "product") {
-            queryObjs.push_back(GTQuery(queryVecs[i], K, calInnerProductDist));
-        } else {
-            assert(false);
-        }
-    }
+    // all queries in one block, the base is streamed through them
+    vector<float> queries;
+    FvecsStream queryStream(queryFileName);
+    unsigned numQueries = queryStream.read(queries, UINT_MAX / queryStream.getDim());
+    BruteForce engine(&queries[0], numQueries, queryStream.getDim(), K, BruteForce::parseMetric(metric), numThreads);
 
-    int itemStartIdx = 0;
-    vector<vector<float>> items;
-    items.reserve(itemBatchSize);
+    FvecsStream baseStream(baseFileName);
+    assert(baseStream.getDim() == queryStream.getDim());
+    vector<float> items;
     while (true) {
-        readFvecs(items, baseFin, itemBatchSize);
-        if (items.size() == 0) {
+        int itemStartIdx = baseStream.numRead();
+        unsigned numItems = baseStream.read(items, itemBatchSize);
+        if (numItems == 0) {
             break;
         }
-
-        updateAll(queryObjs, items, itemStartIdx, numThreads);
-        itemStartIdx += items.size();
-        cout << itemStartIdx << " items have been evaluated" << endl;
-        items.clear();
+        engine.add(&items[0], numItems, itemStartIdx);
+        cout << baseStream.numRead() << " items have been evaluated" << endl;
     }
 
-    baseFin.close();
+    vector<vector<IdAndDstPair>> topks(numQueries);
+    for (unsigned i = 0; i < numQueries; ++i) {
+        for (const auto& item : engine.getTopK(i)) {
+            topks[i].push_back(IdAndDstPair(item.first, item.second));
+        }
+    }
 
     GroundWriter writer;
-    writer.writeLSHBOX(lshboxBenchFileName, queryObjs);
+    writer.writeLSHBOX(lshboxBenchFileName, topks, K);
 
-    writer.writeIVECS(ivecsBenchFileName, queryObjs);
+    writer.writeIVECS(ivecsBenchFileName, topks, K);
     return 0;
 }
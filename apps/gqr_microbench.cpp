@@ -0,0 +1,406 @@
+// micro benchmarks of the components on the query path, on synthetic data
+// and random models, so that they run offline without trained models
+#include <cstdlib>
+#include <cstdio>
+#include <new>
+#include <random>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <chrono>
+
+#include <lshbox.h>
+#include <lshbox/arena.h>
+#include <lshbox/counters.h>
+#include <lshbox/query/fv.h>
+#include <lshbox/query/tree.h>
+#include <lshbox/query/tstable.h>
+#include <lshbox/query/hammingranking.h>
+#include <lshbox/query/lossranking.h>
+#include <lshbox/lsh/pcah.h>
+#include <lshbox/lsh/pcarr.h>
+#include <lshbox/lsh/sph.h>
+#include <lshbox/lsh/kmh.h>
+#include <lshbox/lsh/spectral.h>
+#include <lshbox/lsh/randommodel.h>
+
+using std::string;
+using std::vector;
+using std::unordered_map;
+typedef std::chrono::steady_clock Clock;
+
+// bytes requested through operator new, the benchmarks run on one thread
+static unsigned long long allocatedBytes = 0;
+
+/*
+ * The scalar and array forms of the global operator new and delete are
+ * replaced as one set, so every block the counting allocator hands out goes
+ * back through countedFree, the release that matches its malloc. The sized
+ * deletes of C++14 forward to these by default.
+ * */
+static void* countedAlloc(std::size_t bytes) {
+    allocatedBytes += bytes;
+    void* p = std::malloc(bytes ? bytes : 1);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+static void countedFree(void* p) noexcept {
+    std::free(p);
+}
+
+void* operator new(std::size_t bytes) {
+    return countedAlloc(bytes);
+}
+
+void* operator new[](std::size_t bytes) {
+    return countedAlloc(bytes);
+}
+
+void operator delete(void* p) noexcept {
+    countedFree(p);
+}
+
+void operator delete[](void* p) noexcept {
+    countedFree(p);
+}
+
+/*
+ * Runs a benchmark body until it took at least minTime seconds and reports
+ * the time and the heap bytes per op, an op being the unit the benchmark
+ * names, e.g. one bucket or one distance. Bytes exclude the arena and the
+ * page-backed buffers, which are not allocated by operator new.
+ * */
+class MicroBench {
+public:
+    MicroBench(double minTime, const string& filter, std::ostream& os) : minTime_(minTime), filter_(filter), os_(os), sink_(0) {
+        os_ << "benchmark,param,unit,ns_per_op,bytes_per_op,ops" << std::endl;
+    }
+
+    // body() runs opsPerCall ops and returns a value that keeps them alive
+    template<typename BODY>
+    void run(const string& name, const string& param, const string& unit, unsigned long long opsPerCall, BODY body) {
+        if (!filter_.empty() && name.find(filter_) == string::npos) {
+            return;
+        }
+        sink_ += body();
+        unsigned long long calls = 1;
+        double elapsed = 0;
+        unsigned long long bytes = 0;
+        while (true) {
+            unsigned long long before = allocatedBytes;
+            Clock::time_point start = Clock::now();
+            for (unsigned long long c = 0; c < calls; ++c) {
+                sink_ += body();
+            }
+            elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+            bytes = allocatedBytes - before;
+            if (elapsed >= minTime_) {
+                break;
+            }
+            // aim a bit past minTime, growing by at most 100x per try
+            double scale = elapsed > 0 ? 1.2 * minTime_ / elapsed : 100;
+            calls = std::max(calls + 1, (unsigned long long)(calls * std::min(scale, 100.0)));
+        }
+        unsigned long long ops = calls * opsPerCall;
+        os_ << name << "," << param << "," << unit << ","
+            << elapsed * 1e9 / ops << "," << (double)bytes / ops << "," << ops << std::endl;
+    }
+
+    unsigned long long sink() const {
+        return sink_;
+    }
+
+private:
+    double minTime_;
+    string filter_;
+    std::ostream& os_;
+    unsigned long long sink_;
+};
+
+// stands in for a prober in BaseHasher::probe, only counts the items
+struct ItemCounter {
+    lshbox::Counters counters_;
+    unsigned long long items = 0;
+
+    lshbox::Counters& counters() {
+        return counters_;
+    }
+
+    void probeItems(const unsigned* keys, unsigned n) {
+        items += n + keys[0];
+    }
+};
+
+typedef unordered_map<unsigned long long, vector<unsigned>, lshbox::gqrhash<unsigned long long>> TableT;
+
+// numBuckets distinct random buckets of codelen bits with one item each
+static TableT randomTable(unsigned codelen, unsigned numBuckets, std::mt19937& rng) {
+    std::uniform_int_distribution<unsigned long long> bucket(0, (1ULL << codelen) - 1);
+    TableT table;
+    while (table.size() < numBuckets) {
+        table[bucket(rng)].push_back(table.size());
+    }
+    return table;
+}
+
+static string param(const string& key, unsigned long long value) {
+    return key + "=" + std::to_string(value);
+}
+
+static void benchProbeTables(MicroBench& mb, std::mt19937& rng) {
+    std::uniform_real_distribution<float> uniform(-1, 1);
+    const unsigned codelens[] = {8, 12, 16, 20};
+    for (unsigned R : codelens) {
+        mb.run("tree_build", param("R", R), "tree", 1, [R]() {
+            Tree tree(R);
+            return (unsigned long long)tree.getSize();
+        });
+
+        Tree tree(R);
+        vector<bool> queryBits(R);
+        vector<float> queryLoss(R);
+        for (unsigned i = 0; i < R; ++i) {
+            queryBits[i] = uniform(rng) > 0;
+            queryLoss[i] = std::fabs(uniform(rng));
+        }
+        const unsigned numBuckets = std::min((1u << R) - 1, 4096u);
+        lshbox::Arena arena;
+        mb.run("tstable_buckets", param("R", R), "bucket", numBuckets, [&]() {
+            arena.reset();
+            TSTable table(queryBits, queryLoss, &tree, arena);
+            unsigned long long sum = 0;
+            for (unsigned i = 0; i < numBuckets; ++i) {
+                sum ^= table.getCurBucket();
+                if (!table.moveForward()) {
+                    break;
+                }
+            }
+            return sum;
+        });
+    }
+
+    const unsigned R = 20;
+    const unsigned bucketCounts[] = {1024, 16384, 131072};
+    vector<float> queryFloats(R);
+    for (unsigned i = 0; i < R; ++i) {
+        queryFloats[i] = uniform(rng);
+    }
+    const unsigned long long query = 0x5a5a5 & ((1ULL << R) - 1);
+    for (unsigned numBuckets : bucketCounts) {
+        TableT table = randomTable(R, numBuckets, rng);
+        lshbox::Arena arena;
+        mb.run("hrtable_build", param("buckets", numBuckets), "bucket", numBuckets, [&]() {
+            arena.reset();
+            HRTable ranked(query, R, table, arena);
+            return (unsigned long long)ranked.getNumBuckets(1);
+        });
+        mb.run("lrtable_build", param("buckets", numBuckets), "bucket", numBuckets, [&]() {
+            arena.reset();
+            LRTable ranked(query, queryFloats, table, arena);
+            return ranked.getCurBucket();
+        });
+    }
+}
+
+static void benchFV(MicroBench& mb) {
+    const unsigned codelens[] = {8, 12, 16, 20};
+    for (unsigned R : codelens) {
+        mb.run("fv_build", param("R", R), "fv", 1ULL << R, [R]() {
+            FV fvs(R);
+            return (unsigned long long)fvs.getNumLayers();
+        });
+        FV fvs(R);
+        mb.run("fv_enumerate", param("R", R), "fv", 1ULL << R, [&fvs, R]() {
+            unsigned long long sum = 0;
+            for (unsigned layer = 0; layer < fvs.getNumLayers(); ++layer) {
+                for (unsigned idx = 0; fvs.existed(layer, idx); ++idx) {
+                    sum += fvs.getFlippingVector(layer, idx)[R - 1];
+                }
+            }
+            return sum;
+        });
+    }
+}
+
+static void benchMetric(MicroBench& mb, std::mt19937& rng) {
+    std::normal_distribution<float> normal(0, 1);
+    const unsigned dims[] = {32, 128, 960};
+    const unsigned types[] = {L1_DIST, L2_DIST, AG_DIST, IP_DIST};
+    const char* names[] = {"L1", "L2", "angular", "product"};
+    const unsigned numVectors = 1024;
+    for (unsigned dim : dims) {
+        vector<float> base(numVectors * dim);
+        vector<float> query(dim);
+        for (float& x : base) {
+            x = normal(rng);
+        }
+        for (float& x : query) {
+            x = normal(rng);
+        }
+        for (unsigned m = 0; m < 4; ++m) {
+            lshbox::Metric<float> metric(dim, types[m]);
+            mb.run(string("metric_dist_") + names[m], param("dim", dim), "distance", numVectors, [&]() {
+                float sum = 0;
+                for (unsigned i = 0; i < numVectors; ++i) {
+                    sum += metric.dist(&query[0], &base[i * dim]);
+                }
+                return (unsigned long long)(sum != 0);
+            });
+        }
+    }
+}
+
+static void benchTopk(MicroBench& mb, std::mt19937& rng) {
+    std::uniform_real_distribution<float> uniform(0, 1);
+    const unsigned numItems = 4096;
+    vector<float> dists(numItems);
+    for (float& d : dists) {
+        d = uniform(rng);
+    }
+    const unsigned Ks[] = {1, 10, 100, 1000};
+    for (unsigned K : Ks) {
+        lshbox::Topk topk;
+        mb.run("topk_push", param("K", K), "push", numItems, [&]() {
+            topk.reset(K);
+            unsigned long long entered = 0;
+            for (unsigned i = 0; i < numItems; ++i) {
+                entered += topk.push(i, dists[i]);
+            }
+            return entered;
+        });
+    }
+}
+
+static void benchProbe(MicroBench& mb, lshbox::PCAH<float>& mylsh, std::mt19937& rng) {
+    const TableT& table = mylsh.getTable(0);
+    vector<unsigned long long> hits;
+    for (TableT::const_iterator it = table.begin(); it != table.end(); ++it) {
+        hits.push_back(it->first);
+    }
+    std::shuffle(hits.begin(), hits.end(), rng);
+    // buckets above the code length are never in the table
+    vector<unsigned long long> misses(hits.size());
+    for (unsigned i = 0; i < misses.size(); ++i) {
+        misses[i] = hits[i] | (1ULL << mylsh.getCodeLength());
+    }
+    ItemCounter prober;
+    const unsigned numBuckets = hits.size();
+    mb.run("hasher_probe_hit", param("buckets", numBuckets), "probe", numBuckets, [&]() {
+        for (unsigned i = 0; i < numBuckets; ++i) {
+            mylsh.probe(0, hits[i], prober);
+        }
+        return prober.items;
+    });
+    mb.run("hasher_probe_miss", param("buckets", numBuckets), "probe", numBuckets, [&]() {
+        unsigned long long found = 0;
+        for (unsigned i = 0; i < numBuckets; ++i) {
+            found += mylsh.probe(0, misses[i], prober);
+        }
+        return found;
+    });
+}
+
+template<typename LSHTYPE>
+static void benchHashFloats(MicroBench& mb, const string& name, LSHTYPE& mylsh, const lshbox::Matrix<float>& queries) {
+    const unsigned numQueries = queries.getSize();
+    mb.run("get_hash_floats_" + name, param("R", mylsh.getCodeLength()), "query", numQueries, [&]() {
+        float sum = 0;
+        for (unsigned i = 0; i < numQueries; ++i) {
+            sum += mylsh.getHashFloats(0, queries[i])[0];
+        }
+        return (unsigned long long)(sum != 0);
+    });
+}
+
+int main(int argc, const char **argv)
+{
+    unordered_map<string, string> params = lshbox::parseParams(argc, argv);
+    if (params.find("help") != params.end()) {
+        std::cerr << "Usage: "
+            << "./gqr_microbench "
+            << "[--filter=name] [--min_time=0.2] [--num_items=20000] [--dim=128] [--codelen=16] "
+            << "[--seed=1] [--work_dir=/tmp] [--output=file]"
+            << std::endl;
+        return -1;
+    }
+    double minTime = params.find("min_time") != params.end() ? std::stod(params["min_time"]) : 0.2;
+    string filter = params.find("filter") != params.end() ? params["filter"] : "";
+    unsigned numItems = params.find("num_items") != params.end() ? std::stoi(params["num_items"]) : 20000;
+    unsigned dim = params.find("dim") != params.end() ? std::stoi(params["dim"]) : 128;
+    unsigned codelen = params.find("codelen") != params.end() ? std::stoi(params["codelen"]) : 16;
+    unsigned seed = params.find("seed") != params.end() ? std::stoi(params["seed"]) : 1;
+    string workDir = params.find("work_dir") != params.end() ? params["work_dir"] : "/tmp";
+
+    std::ofstream file;
+    if (params.find("output") != params.end()) {
+        file.open(params["output"].c_str());
+        if (!file) {
+            std::cerr << "cannot open output file " << params["output"] << std::endl;
+            return -1;
+        }
+    }
+    std::ostream& os = file.is_open() ? file : std::cout;
+
+    std::mt19937 rng(seed);
+    MicroBench mb(minTime, filter, os);
+    benchProbeTables(mb, rng);
+    benchFV(mb);
+    benchMetric(mb, rng);
+    benchTopk(mb, rng);
+
+    // synthetic base and queries, Gaussian
+    std::normal_distribution<float> normal(0, 1);
+    lshbox::Matrix<float> data(dim, numItems);
+    lshbox::Matrix<float> queries(dim, 256);
+    for (unsigned i = 0; i < numItems; ++i) {
+        for (unsigned j = 0; j < dim; ++j) {
+            data[i][j] = normal(rng);
+        }
+    }
+    for (unsigned i = 0; i < 256; ++i) {
+        for (unsigned j = 0; j < dim; ++j) {
+            queries[i][j] = normal(rng);
+        }
+    }
+    const string model = workDir + "/gqr_microbench.model";
+    const string bits = workDir + "/gqr_microbench.bits";
+    {
+        lshbox::PCAH<float> mylsh;
+        lshbox::writeRandomPCAH(model, data, 1, codelen, seed);
+        lshbox::buildIndex(mylsh, 1, data, model, bits);
+        benchProbe(mb, mylsh, rng);
+        benchHashFloats(mb, "PCAH", mylsh, queries);
+    }
+    {
+        lshbox::PCARR<float> mylsh;
+        lshbox::writeRandomPCARR(model, data, 1, codelen, seed);
+        lshbox::buildIndex(mylsh, 1, data, model, bits);
+        benchHashFloats(mb, "PCARR", mylsh, queries);
+    }
+    {
+        lshbox::SpH<float> mylsh;
+        lshbox::writeRandomSpH(model, data, 1, codelen, seed);
+        lshbox::buildIndex(mylsh, 1, data, model, bits);
+        benchHashFloats(mb, "SpH", mylsh, queries);
+    }
+    {
+        lshbox::spectral<float> mylsh;
+        lshbox::writeRandomSH(model, data, 1, codelen, seed);
+        lshbox::buildIndex(mylsh, 1, data, model, bits);
+        benchHashFloats(mb, "SH", mylsh, queries);
+    }
+    if (codelen % 4 == 0 && dim % (codelen / 4) == 0) {
+        lshbox::KMH<float> mylsh;
+        lshbox::writeRandomKMH(model, data, codelen, 4, seed);
+        lshbox::buildIndex(mylsh, 1, data, model, bits);
+        benchHashFloats(mb, "KMH", mylsh, queries);
+    }
+    std::remove(model.c_str());
+    std::remove(bits.c_str());
+
+    // keeps the compiler from dropping the bodies
+    return mb.sink() == 42 ? 1 : 0;
+}
@@ -0,0 +1,259 @@
+// index analyzer: loads a model and its tables and reports the bucket-size
+// distribution of every table, how much of the code space is occupied, and
+// the items that GQR and HR probe in their first buckets for sampled queries,
+// e.g. to spot a code length or model that puts most items in a few buckets
+#include <cstdlib>
+#include <cmath>
+#include <fstream>
+#include <unordered_map>
+#include <algorithm>
+
+#include <lshbox.h>
+#include <lshbox/query/tree.h>
+#include <lshbox/query/treelookup.h>
+#include <lshbox/query/hammingranking.h>
+#include <lshbox/lsh/pcah.h>
+#include <lshbox/lsh/itq.h>
+#include <lshbox/lsh/pcarr.h>
+#include <lshbox/lsh/sph.h>
+#include <lshbox/lsh/isoh.h>
+#include <lshbox/lsh/kmh.h>
+#include <lshbox/lsh/spectral.h>
+#include <lshbox/lsh/sim.h>
+
+using std::string;
+using std::vector;
+using std::unordered_map;
+
+typedef float DATATYPE;
+typedef lshbox::Matrix<DATATYPE>::Accessor ACCESSOR;
+
+/*
+ * Gini coefficient of the sizes, 0 if all are equal, close to 1 if one
+ * bucket holds nearly everything. sizes is sorted in place.
+ * */
+static double gini(vector<unsigned>& sizes) {
+    std::sort(sizes.begin(), sizes.end());
+    double weighted = 0, total = 0;
+    const double n = sizes.size();
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        weighted += (2.0 * (i + 1) - n - 1) * sizes[i];
+        total += sizes[i];
+    }
+    return total > 0 ? weighted / (n * total) : 0;
+}
+
+static double binomial(unsigned n, unsigned k) {
+    double c = 1;
+    for (unsigned i = 1; i <= k; ++i) {
+        c = c * (n - k + i) / i;
+    }
+    return c;
+}
+
+template<typename LSHTYPE>
+void tableStats(const LSHTYPE& mylsh) {
+    const unsigned R = mylsh.getCodeLength();
+    const double codes = std::ldexp(1.0, R);
+    std::cout << "TABLE    , table, buckets, occupied fraction of 2^" << R << " codes, "
+        << "mean bucket size, max bucket size, gini, items in top 1% buckets" << std::endl;
+    vector<vector<unsigned long long>> histBuckets(mylsh.getNumTables()), histItems(mylsh.getNumTables());
+    vector<vector<unsigned long long>> layerBuckets(mylsh.getNumTables(), vector<unsigned long long>(R + 1, 0));
+    vector<vector<unsigned long long>> layerItems(mylsh.getNumTables(), vector<unsigned long long>(R + 1, 0));
+    for (unsigned t = 0; t < mylsh.getNumTables(); ++t) {
+        vector<unsigned> sizes;
+        unsigned long long items = 0;
+        sizes.reserve(mylsh.getTable(t).size());
+        for (const auto& bucket : mylsh.getTable(t)) {
+            unsigned size = bucket.second.size();
+            if (size == 0) {
+                continue;
+            }
+            sizes.push_back(size);
+            items += size;
+            // bin b holds sizes in [2^b, 2^(b+1))
+            unsigned bin = 0;
+            while ((2u << bin) <= size) {
+                ++bin;
+            }
+            if (bin >= histBuckets[t].size()) {
+                histBuckets[t].resize(bin + 1, 0);
+                histItems[t].resize(bin + 1, 0);
+            }
+            ++histBuckets[t][bin];
+            histItems[t][bin] += size;
+            unsigned weight = lshbox::countOnes(bucket.first);
+            ++layerBuckets[t][weight];
+            layerItems[t][weight] += size;
+        }
+        if (sizes.empty()) {
+            std::cout << "TABLE    , " << t << ", 0" << std::endl;
+            continue;
+        }
+        double skew = gini(sizes);
+        size_t top = (sizes.size() + 99) / 100;
+        unsigned long long topItems = 0;
+        for (size_t i = sizes.size() - top; i < sizes.size(); ++i) {
+            topItems += sizes[i];
+        }
+        std::cout << "TABLE    , " << t << ", " << sizes.size() << ", " << sizes.size() / codes << ", "
+            << (double)items / sizes.size() << ", " << sizes.back() << ", " << skew << ", "
+            << (double)topItems / items << std::endl;
+    }
+
+    std::cout << "HISTOGRAM    , table, bucket size, buckets, items" << std::endl;
+    for (unsigned t = 0; t < mylsh.getNumTables(); ++t) {
+        for (unsigned bin = 0; bin < histBuckets[t].size(); ++bin) {
+            std::cout << "HISTOGRAM    , " << t << ", " << (1u << bin);
+            if (bin > 0) {
+                std::cout << "-" << (2u << bin) - 1;
+            }
+            std::cout << ", " << histBuckets[t][bin] << ", " << histItems[t][bin] << std::endl;
+        }
+    }
+
+    // the codes of weight w, i.e. at Hamming distance w from code 0
+    std::cout << "LAYER    , table, hamming weight, codes, occupied, occupied fraction, items" << std::endl;
+    for (unsigned t = 0; t < mylsh.getNumTables(); ++t) {
+        for (unsigned w = 0; w <= R; ++w) {
+            double layer = binomial(R, w);
+            std::cout << "LAYER    , " << t << ", " << w << ", " << layer << ", " << layerBuckets[t][w] << ", "
+                << layerBuckets[t][w] / layer << ", " << layerItems[t][w] << std::endl;
+        }
+    }
+}
+
+/*
+ * items in the buckets getNextBID() returns first, summed over the tables,
+ * cost[b] accumulates those of the first b + 1 buckets
+ * */
+template<typename PROBER, typename LSHTYPE>
+void probeCost(PROBER& prober, const LSHTYPE& mylsh, unsigned numBuckets, vector<double>& cost) {
+    unsigned long long items = 0;
+    for (unsigned b = 0; b < numBuckets; ++b) {
+        const auto bucket = prober.getNextBID();
+        const auto& table = mylsh.getTable(bucket.first);
+        auto it = table.find(bucket.second);
+        if (it != table.end()) {
+            items += it->second.size();
+        }
+        cost[b] += items;
+    }
+}
+
+template<typename LSHTYPE>
+void expectedCost(LSHTYPE& mylsh, const lshbox::Matrix<DATATYPE>& query, const unordered_map<string, string>& params) {
+    unsigned numQueries = params.find("num_queries") != params.end() ? std::stoi(params.find("num_queries")->second) : 100;
+    numQueries = std::max(1u, std::min<unsigned>(numQueries, query.getSize()));
+    unsigned maxBuckets = params.find("max_buckets") != params.end() ? std::stoi(params.find("max_buckets")->second) : 4096;
+
+    const unsigned R = mylsh.getCodeLength();
+    unsigned long long occupied = 0;
+    for (unsigned size : mylsh.getAllTableSize()) {
+        occupied += size;
+    }
+    // GQR generates every code of every table, HR the occupied buckets only
+    unsigned gqrBuckets = R < 32 ? std::min<unsigned long long>(maxBuckets, (unsigned long long)mylsh.getNumTables() << R) : maxBuckets;
+    unsigned hrBuckets = std::min<unsigned long long>(maxBuckets, occupied);
+
+    // the probers only generate buckets, the scanner never verifies an item
+    ACCESSOR accessor(query);
+    lshbox::Metric<DATATYPE> metric(query.getDim(), L2_DIST);
+    lshbox::Scanner<ACCESSOR> scanner(accessor, metric, 1);
+    Tree fvs(R);
+    vector<double> gqrCost(gqrBuckets, 0), hrCost(hrBuckets, 0);
+    for (unsigned i = 0; i < numQueries; ++i) {
+        const DATATYPE* q = query[(unsigned long long)i * query.getSize() / numQueries];
+        TreeLookup<ACCESSOR> gqr(q, scanner, mylsh, &fvs);
+        probeCost(gqr, mylsh, gqrBuckets, gqrCost);
+        HammingRanking<ACCESSOR> hr(q, scanner, mylsh);
+        probeCost(hr, mylsh, hrBuckets, hrCost);
+    }
+
+    // duplicates across tables are counted once per table
+    std::cout << "PROBE COST    , " << numQueries << " queries, items of the first buckets summed over the tables" << std::endl;
+    std::cout << "PROBE COST    , buckets, GQR items, GQR fraction of base, HR items, HR fraction of base" << std::endl;
+    const double base = mylsh.getBaseSize();
+    for (unsigned b = 1; b <= std::max(gqrBuckets, hrBuckets); b *= 2) {
+        std::cout << "PROBE COST    , " << b;
+        if (b <= gqrBuckets) {
+            std::cout << ", " << gqrCost[b - 1] / numQueries << ", " << gqrCost[b - 1] / numQueries / base;
+        } else {
+            std::cout << ", -, -";
+        }
+        if (b <= hrBuckets) {
+            std::cout << ", " << hrCost[b - 1] / numQueries << ", " << hrCost[b - 1] / numQueries / base;
+        } else {
+            std::cout << ", -, -";
+        }
+        std::cout << std::endl;
+    }
+}
+
+template<typename LSHTYPE>
+void indexStats(LSHTYPE& mylsh, const unordered_map<string, string>& params) {
+    std::cout << "INDEX    , " << mylsh.getNumTables() << " tables, code length " << mylsh.getCodeLength()
+        << ", " << mylsh.getBaseSize() << " items" << std::endl;
+    tableStats(mylsh);
+    if (params.find("query_file") != params.end()) {
+        lshbox::Matrix<DATATYPE> query(params.find("query_file")->second);
+        expectedCost(mylsh, query, params);
+    }
+}
+
+int main(int argc, const char **argv)
+{
+    unordered_map<string, string> params = lshbox::parseParams(argc, argv);
+    if (params.find("hash_method") == params.end() || params.find("model_file") == params.end()
+        || params.find("base_bits_file") == params.end()) {
+        std::cerr << "Usage: "
+            << "./index_stats "
+            << "--hash_method=xxx "
+            << "--model_file=xxx "
+            << "--base_bits_file=xxx "
+            << "[--query_file=fvecs] [--num_queries=100] [--max_buckets=4096]"
+            << std::endl;
+        return -1;
+    }
+    string hashMethod = params["hash_method"];
+    string modelFile = params["model_file"];
+    string baseBitsFile = params["base_bits_file"];
+
+    if (hashMethod == "PCAH") {
+        lshbox::PCAH<DATATYPE> mylsh;
+        mylsh.loadModel(modelFile, baseBitsFile);
+        indexStats(mylsh, params);
+    } else if (hashMethod == "ITQH") {
+        lshbox::ITQ<DATATYPE> mylsh;
+        mylsh.loadModel(modelFile, baseBitsFile);
+        indexStats(mylsh, params);
+    } else if (hashMethod == "PCARR") {
+        lshbox::PCARR<DATATYPE> mylsh;
+        mylsh.loadModel(modelFile, baseBitsFile);
+        indexStats(mylsh, params);
+    } else if (hashMethod == "SpH") {
+        lshbox::SpH<DATATYPE> mylsh;
+        mylsh.loadModel(modelFile, baseBitsFile);
+        indexStats(mylsh, params);
+    } else if (hashMethod == "IsoH") {
+        lshbox::IsoH<DATATYPE> mylsh;
+        mylsh.loadModel(modelFile, baseBitsFile);
+        indexStats(mylsh, params);
+    } else if (hashMethod == "KMH") {
+        lshbox::KMH<DATATYPE> mylsh;
+        mylsh.loadModel(modelFile, baseBitsFile);
+        indexStats(mylsh, params);
+    } else if (hashMethod == "SH") {
+        lshbox::spectral<DATATYPE> mylsh;
+        mylsh.loadModel(modelFile, baseBitsFile);
+        indexStats(mylsh, params);
+    } else if (hashMethod == "SIM") {
+        lshbox::SIMH<DATATYPE> mylsh;
+        mylsh.loadModel(modelFile, baseBitsFile);
+        indexStats(mylsh, params);
+    } else {
+        std::cerr << "index_stats does not support hash_method " << hashMethod << std::endl;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,435 @@
+// latency benchmark: every query is answered on its own and timed by wall
+// clock, phase by phase, at a number of operating points (probed items)
+#include <cstdlib>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <unordered_map>
+#include <chrono>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include <lshbox.h>
+#include <lshbox/query/fv.h>
+#include <lshbox/query/treelookup.h>
+#include <lshbox/query/hammingranking.h>
+#include <lshbox/query/hashlookupPP.h>
+#include <lshbox/query/lossranking.h>
+#include <lshbox/query/tableshard.h>
+#include <lshbox/lsh/pcah.h>
+#include <lshbox/lsh/itq.h>
+#include <lshbox/lsh/pcarr.h>
+#include <lshbox/lsh/sph.h>
+#include <lshbox/lsh/isoh.h>
+#include <lshbox/lsh/kmh.h>
+#include <lshbox/lsh/spectral.h>
+#include "lshbox/bench/bencher.h"
+
+using std::string;
+using std::unordered_map;
+typedef std::chrono::steady_clock Clock;
+
+static double seconds(Clock::time_point from, Clock::time_point to) {
+    return std::chrono::duration<double>(to - from).count();
+}
+
+/*
+ * All tables of a hasher, timing the calls of a prober that hash the query.
+ * */
+template<typename LSHTYPE, typename DATATYPE>
+class EncodeTimedHasher : public lshbox::HasherShard<LSHTYPE, DATATYPE> {
+public:
+    typedef lshbox::HasherShard<LSHTYPE, DATATYPE> Base;
+    typedef typename Base::BIDTYPE BIDTYPE;
+
+    EncodeTimedHasher(LSHTYPE& mylsh, const vector<unsigned>& tables) : Base(mylsh, tables), mylsh_(mylsh), encode(0) {}
+
+    vector<BIDTYPE> getAllBuckets(const DATATYPE* domin) {
+        Clock::time_point start = Clock::now();
+        vector<BIDTYPE> buckets = mylsh_.getAllBuckets(domin);
+        encode += seconds(start, Clock::now());
+        return buckets;
+    }
+
+    vector<bool> getHashBits(unsigned t, const DATATYPE* domin) {
+        Clock::time_point start = Clock::now();
+        vector<bool> bits = Base::getHashBits(t, domin);
+        encode += seconds(start, Clock::now());
+        return bits;
+    }
+
+    BIDTYPE getHashVal(unsigned t, const DATATYPE* domin) {
+        Clock::time_point start = Clock::now();
+        BIDTYPE val = Base::getHashVal(t, domin);
+        encode += seconds(start, Clock::now());
+        return val;
+    }
+
+    vector<float> getHashFloats(unsigned t, const DATATYPE* domin) {
+        Clock::time_point start = Clock::now();
+        vector<float> floats = Base::getHashFloats(t, domin);
+        encode += seconds(start, Clock::now());
+        return floats;
+    }
+
+private:
+    LSHTYPE& mylsh_;
+
+public:
+    double encode; // seconds spent hashing queries
+};
+
+// wall-clock seconds of one query
+struct QueryTime {
+    double total;
+    double encode;  // hashing the query
+    double buckets; // ranking the buckets and generating the next ones
+    double verify;  // scanning the items of the buckets, and the final top-k
+};
+
+// one operating point
+struct Point {
+    unsigned probeItems;
+    double candidates; // avg items verified
+    double recall;
+    double qps;
+    double mean, p50, p90, p99, p999; // latency, ms
+    double encode, buckets, verify; // mean phase time, ms
+};
+
+// nearest-rank percentile of sorted values
+static double percentile(const vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t rank = (size_t)std::ceil(p / 100 * sorted.size());
+    return sorted[std::min(sorted.size() - 1, rank == 0 ? 0 : rank - 1)];
+}
+
+/*
+ * One prober is reset to every query, so the time of a query includes
+ * hashing and ranking the buckets. Timing the phases reads the clock twice
+ * per probed bucket.
+ * */
+template<typename PROBERTYPE, typename DATATYPE, typename LSHTYPE, typename SCANNER, typename FACTORY>
+vector<Point> benchProber(
+    const lshbox::Matrix<DATATYPE>& query,
+    LSHTYPE& mylsh,
+    const lshbox::Benchmark& bench,
+    Bencher& truth,
+    SCANNER& initScanner,
+    FACTORY factory,
+    const vector<unsigned>& budgets,
+    unsigned warmup,
+    unsigned repeat) {
+
+    vector<unsigned> allTables(mylsh.getNumTables());
+    for (unsigned t = 0; t != allTables.size(); ++t) {
+        allTables[t] = t;
+    }
+    EncodeTimedHasher<LSHTYPE, DATATYPE> hasher(mylsh, allTables);
+    typedef typename std::aligned_storage<sizeof(PROBERTYPE), alignof(PROBERTYPE)>::type Storage;
+    Storage storage;
+    PROBERTYPE* prober = reinterpret_cast<PROBERTYPE*>(&storage);
+    bool built = false;
+    unsigned numQueries = bench.getQ();
+
+    auto run = [&](unsigned i, unsigned numItems, vector<pair<unsigned, float>>* result) -> QueryTime {
+        const DATATYPE* q = query[bench.getQuery(i)];
+        QueryTime time = {0, 0, 0, 0};
+        hasher.encode = 0;
+        Clock::time_point start = Clock::now();
+        if (built) {
+            prober->reset(q, hasher);
+        } else {
+            factory(prober, q, hasher, initScanner);
+            built = true;
+        }
+        Clock::time_point last = Clock::now();
+        time.buckets = seconds(start, last);
+        while (prober->getNumItemsProbed() < numItems && prober->nextBucketExisted()) {
+            const std::pair<unsigned, unsigned long long> probePair = prober->getNextBID();
+            Clock::time_point generated = Clock::now();
+            hasher.probe(probePair.first, probePair.second, *prober);
+            Clock::time_point verified = Clock::now();
+            time.buckets += seconds(last, generated);
+            time.verify += seconds(generated, verified);
+            last = verified;
+        }
+        const vector<pair<float, unsigned>>& topk = prober->getScanner().genTopk();
+        Clock::time_point end = Clock::now();
+        time.verify += seconds(last, end);
+        time.total = seconds(start, end);
+        time.encode = hasher.encode;
+        time.buckets -= hasher.encode;
+        if (result != NULL) {
+            result->resize(topk.size());
+            for (unsigned j = 0; j < topk.size(); ++j) {
+                (*result)[j] = std::make_pair(topk[j].second, topk[j].first);
+            }
+        }
+        return time;
+    };
+
+    vector<Point> points;
+    for (unsigned numItems : budgets) {
+        for (unsigned w = 0; w != warmup; ++w) {
+            for (unsigned i = 0; i != numQueries; ++i) {
+                run(i, numItems, NULL);
+            }
+        }
+        Point point = {numItems, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+        vector<double> latencies;
+        latencies.reserve(numQueries * repeat);
+        vector<vector<pair<unsigned, float>>> results(numQueries);
+        unsigned long long candidates = 0;
+        Clock::time_point start = Clock::now();
+        for (unsigned r = 0; r != repeat; ++r) {
+            for (unsigned i = 0; i != numQueries; ++i) {
+                QueryTime time = run(i, numItems, &results[i]);
+                latencies.push_back(time.total * 1000);
+                point.encode += time.encode * 1000;
+                point.buckets += time.buckets * 1000;
+                point.verify += time.verify * 1000;
+                candidates += prober->getNumItemsProbed();
+            }
+        }
+        double wall = seconds(start, Clock::now());
+        unsigned n = latencies.size();
+        for (double latency : latencies) {
+            point.mean += latency;
+        }
+        std::sort(latencies.begin(), latencies.end());
+        point.mean /= n;
+        point.p50 = percentile(latencies, 50);
+        point.p90 = percentile(latencies, 90);
+        point.p99 = percentile(latencies, 99);
+        point.p999 = percentile(latencies, 99.9);
+        point.encode /= n;
+        point.buckets /= n;
+        point.verify /= n;
+        point.candidates = (double)candidates / n;
+        point.qps = n / wall;
+        point.recall = truth.avg_recall(Bencher(results, true));
+        points.push_back(point);
+    }
+    if (built) {
+        prober->~PROBERTYPE();
+    }
+    return points;
+}
+
+template<typename DATATYPE, typename LSHTYPE, typename SCANNER>
+vector<Point> benchMethod(
+    const string& method,
+    const lshbox::Matrix<DATATYPE>& query,
+    LSHTYPE& mylsh,
+    const lshbox::Benchmark& bench,
+    Bencher& truth,
+    SCANNER& initScanner,
+    const vector<unsigned>& budgets,
+    unsigned warmup,
+    unsigned repeat) {
+
+    typedef typename lshbox::Matrix<DATATYPE>::Accessor ACCESSOR;
+    typedef EncodeTimedHasher<LSHTYPE, DATATYPE> HASHER;
+    if (method == "GQR") {
+        typedef TreeLookup<ACCESSOR> GQRT;
+        Tree fvs(mylsh.getCodeLength());
+        auto factory = [&fvs](GQRT* place, const DATATYPE* q, HASHER& hasher, SCANNER& scanner) {
+            new(place) GQRT(q, scanner, hasher, &fvs);
+        };
+        return benchProber<GQRT>(query, mylsh, bench, truth, initScanner, factory, budgets, warmup, repeat);
+    } else if (method == "HR") {
+        typedef HammingRanking<ACCESSOR> HRT;
+        auto factory = [](HRT* place, const DATATYPE* q, HASHER& hasher, SCANNER& scanner) {
+            new(place) HRT(q, scanner, hasher);
+        };
+        return benchProber<HRT>(query, mylsh, bench, truth, initScanner, factory, budgets, warmup, repeat);
+    } else if (method == "GHR" || method == "HL") {
+        typedef HashLookupPP<ACCESSOR> GHRT;
+        FV fvs(mylsh.getCodeLength());
+        auto factory = [&fvs](GHRT* place, const DATATYPE* q, HASHER& hasher, SCANNER& scanner) {
+            new(place) GHRT(q, scanner, hasher, &fvs);
+        };
+        return benchProber<GHRT>(query, mylsh, bench, truth, initScanner, factory, budgets, warmup, repeat);
+    } else if (method == "QR") {
+        typedef LossRanking<ACCESSOR> QR;
+        auto factory = [](QR* place, const DATATYPE* q, HASHER& hasher, SCANNER& scanner) {
+            new(place) QR(q, scanner, hasher);
+        };
+        return benchProber<QR>(query, mylsh, bench, truth, initScanner, factory, budgets, warmup, repeat);
+    }
+    std::cerr << "latency_bench supports GQR, HR, HL and QR, not " << method << std::endl;
+    assert(false);
+    return vector<Point>();
+}
+
+template<typename DATATYPE, typename LSHTYPE>
+vector<Point> benchHasher(
+    LSHTYPE& mylsh,
+    const lshbox::Matrix<DATATYPE>& data,
+    const lshbox::Matrix<DATATYPE>& query,
+    const lshbox::Benchmark& bench,
+    Bencher& truth,
+    const unordered_map<string, string>& params,
+    unsigned metric,
+    const vector<unsigned>& budgets,
+    unsigned warmup,
+    unsigned repeat) {
+
+    mylsh.loadModel(params.find("model_file")->second, params.find("base_bits_file")->second);
+    typename lshbox::Matrix<DATATYPE>::Accessor accessor(data);
+    lshbox::Metric<DATATYPE> distance(data.getDim(), metric);
+    lshbox::Scanner<typename lshbox::Matrix<DATATYPE>::Accessor> initScanner(accessor, distance, bench.getK());
+    if (params.find("early_abandon") != params.end() && params.find("early_abandon")->second == "false") {
+        initScanner.setEarlyAbandon(false);
+    }
+    return benchMethod(params.find("query_method")->second, query, mylsh, bench, truth, initScanner, budgets, warmup, repeat);
+}
+
+static void writeJson(std::ostream& os, const unordered_map<string, string>& params, unsigned numQueries, unsigned K, const vector<Point>& points) {
+    os << std::setprecision(6);
+    os << "{\n";
+    os << "  \"hash_method\": \"" << params.find("hash_method")->second << "\",\n";
+    os << "  \"query_method\": \"" << params.find("query_method")->second << "\",\n";
+    os << "  \"base_file\": \"" << params.find("base_file")->second << "\",\n";
+    os << "  \"queries\": " << numQueries << ",\n";
+    os << "  \"k\": " << K << ",\n";
+    os << "  \"points\": [\n";
+    for (unsigned i = 0; i != points.size(); ++i) {
+        const Point& p = points[i];
+        os << "    {\"probe_items\": " << p.probeItems
+            << ", \"candidates\": " << p.candidates
+            << ", \"recall\": " << p.recall
+            << ", \"qps\": " << p.qps
+            << ", \"latency_ms\": {\"mean\": " << p.mean << ", \"p50\": " << p.p50 << ", \"p90\": " << p.p90
+            << ", \"p99\": " << p.p99 << ", \"p99.9\": " << p.p999 << "}"
+            << ", \"phase_ms\": {\"encode\": " << p.encode << ", \"buckets\": " << p.buckets << ", \"verify\": " << p.verify << "}}"
+            << (i + 1 != points.size() ? "," : "") << "\n";
+    }
+    os << "  ]\n";
+    os << "}\n";
+}
+
+static void writeCsv(std::ostream& os, const vector<Point>& points) {
+    os << std::setprecision(6);
+    os << "probe_items,candidates,recall,qps,mean_ms,p50_ms,p90_ms,p99_ms,p999_ms,encode_ms,buckets_ms,verify_ms\n";
+    for (const Point& p : points) {
+        os << p.probeItems << "," << p.candidates << "," << p.recall << "," << p.qps << ","
+            << p.mean << "," << p.p50 << "," << p.p90 << "," << p.p99 << "," << p.p999 << ","
+            << p.encode << "," << p.buckets << "," << p.verify << "\n";
+    }
+}
+
+int main(int argc, const char **argv)
+{
+    typedef float DATATYPE;
+
+    unordered_map<string, string> params = lshbox::parseParams(argc, argv);
+    const char* required[] = {"hash_method", "query_method", "model_file", "base_file", "base_bits_file", "query_file", "benchmark_file"};
+    for (const char* key : required) {
+        if (params.find(key) == params.end()) {
+            std::cerr << "Usage: "
+                << "./latency_bench   "
+                << "--hash_method=xxx "
+                << "--query_method=xxx "
+                << "--model_file=xxx "
+                << "--base_file=xxx "
+                << "--base_bits_file=xxx "
+                << "--query_file=xxx "
+                << "--benchmark_file=xxx "
+                << "[--probe_items=n1,n2,...] [--warmup=1] [--repeat=1] [--pin_cpu=c] "
+                << "[--metric=euclidean] [--format=json|csv] [--output=file]"
+                << std::endl;
+            return -1;
+        }
+    }
+
+    unsigned metric = L2_DIST;
+    if (params.find("metric") != params.end()) {
+        string type = params["metric"];
+        metric = type == "angular" ? AG_DIST : type == "L1" ? L1_DIST : type == "product" ? IP_DIST : L2_DIST;
+    }
+    unsigned warmup = params.find("warmup") != params.end() ? std::stoi(params["warmup"]) : 1;
+    unsigned repeat = params.find("repeat") != params.end() ? std::max(1, std::stoi(params["repeat"])) : 1;
+
+#ifdef __linux__
+    // run on one core, away from migrations and their cold caches
+    if (params.find("pin_cpu") != params.end()) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(std::stoi(params["pin_cpu"]), &cpus);
+        if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+            std::cerr << "cannot pin to cpu " << params["pin_cpu"] << std::endl;
+        }
+    }
+#endif
+
+    lshbox::Benchmark bench;
+    bench.load(params["benchmark_file"].c_str());
+    Bencher truth(params["benchmark_file"].c_str());
+    lshbox::Matrix<DATATYPE> data(params["base_file"]);
+    lshbox::Matrix<DATATYPE> query(params["query_file"]);
+    if (metric == AG_DIST) {
+        data.calNorms();
+    }
+
+    // operating points, by default doubling from 64 probed items to the whole base
+    vector<unsigned> budgets;
+    if (params.find("probe_items") != params.end()) {
+        std::istringstream iss(params["probe_items"]);
+        string item;
+        while (std::getline(iss, item, ',')) {
+            budgets.push_back(std::stoi(item));
+        }
+    } else {
+        for (unsigned numItems = 64; numItems < (unsigned)data.getSize(); numItems *= 2) {
+            budgets.push_back(numItems);
+        }
+        budgets.push_back(data.getSize());
+    }
+
+    string hashMethod = params["hash_method"];
+    vector<Point> points;
+    if (hashMethod == "PCAH") {
+        lshbox::PCAH<DATATYPE> mylsh;
+        points = benchHasher(mylsh, data, query, bench, truth, params, metric, budgets, warmup, repeat);
+    } else if (hashMethod == "ITQH") {
+        lshbox::ITQ<DATATYPE> mylsh;
+        points = benchHasher(mylsh, data, query, bench, truth, params, metric, budgets, warmup, repeat);
+    } else if (hashMethod == "PCARR") {
+        lshbox::PCARR<DATATYPE> mylsh;
+        points = benchHasher(mylsh, data, query, bench, truth, params, metric, budgets, warmup, repeat);
+    } else if (hashMethod == "SpH") {
+        lshbox::SpH<DATATYPE> mylsh;
+        points = benchHasher(mylsh, data, query, bench, truth, params, metric, budgets, warmup, repeat);
+    } else if (hashMethod == "IsoH") {
+        lshbox::IsoH<DATATYPE> mylsh;
+        points = benchHasher(mylsh, data, query, bench, truth, params, metric, budgets, warmup, repeat);
+    } else if (hashMethod == "KMH") {
+        lshbox::KMH<DATATYPE> mylsh;
+        points = benchHasher(mylsh, data, query, bench, truth, params, metric, budgets, warmup, repeat);
+    } else if (hashMethod == "SH") {
+        lshbox::spectral<DATATYPE> mylsh;
+        points = benchHasher(mylsh, data, query, bench, truth, params, metric, budgets, warmup, repeat);
+    } else {
+        std::cerr << "latency_bench does not support hashMethod: " << hashMethod << std::endl;
+        return -1;
+    }
+
+    std::ofstream file;
+    if (params.find("output") != params.end()) {
+        file.open(params["output"].c_str());
+        if (!file) {
+            std::cerr << "cannot open output file " << params["output"] << std::endl;
+            return -1;
+        }
+    }
+    std::ostream& os = file.is_open() ? file : std::cout;
+    if (params.find("format") != params.end() && params["format"] == "csv") {
+        writeCsv(os, points);
+    } else {
+        writeJson(os, params, bench.getQ(), bench.getK(), points);
+    }
+    return 0;
+}
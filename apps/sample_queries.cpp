@@ -1,10 +1,15 @@
+// samples num_queries vectors of an fvecs file in one streaming pass by
+// reservoir sampling, only the sampled vectors are kept in memory
 #include <iostream>
 #include <cstring>
+#include <cstdlib>
+#include <ctime>
 #include <fstream>
 #include <vector>
 #include <string>
+#include <algorithm>
 
-#include "lshbox/utils.h"
+#include "gqr/util/vecsio.h"
 using namespace std;
 
 void alertOutputFormatError() {
@@ -16,59 +21,61 @@ void alertOutputFormatError() {
 int main(int argc, char ** argv) {
     if (argc != 4) {
         cout << "Usage: ./sample_queries input_base_fvecs num_queries output_query_fvecs" << endl;
+        return -1;
     }
 
     string outputFile = argv[3];
     if (outputFile.size() < 7 
         || (outputFile.substr(outputFile.size() - 5, 5) != "fvecs" && outputFile.substr(outputFile.size() - 7, 7) != "idfvecs")) {
         alertOutputFormatError();
+        return -1;
     }
+    bool withIds = outputFile.substr(outputFile.size() - 7, 7) == "idfvecs";
+    unsigned num_samples = atoi(argv[2]);
 
-    ifstream fin(argv[1], ios::binary);
-    if (!fin) {
-        cout << "cannot open file " << argv[1] << endl;
+    lshbox::FvecsStream stream(argv[1]);
+    const unsigned dimension = stream.getDim();
+    lshbox::Reservoir reservoir(num_samples, (unsigned)time(0));
+    vector<float> samples((size_t)num_samples * dimension);
+    vector<unsigned> sampleIds(num_samples);
+    vector<float> block;
+    unsigned n;
+    while ((n = stream.read(block, 1 << 16)) > 0) {
+        unsigned firstId = stream.numRead() - n;
+        for (unsigned i = 0; i < n; ++i) {
+            int slot = reservoir.offer();
+            if (slot >= 0) {
+                sampleIds[slot] = firstId + i;
+                copy(&block[(size_t)i * dimension], &block[(size_t)(i + 1) * dimension], &samples[(size_t)slot * dimension]);
+            }
+        }
     }
-    int dimension;
-    vector<float*> data;
-    while (fin.read((char*)(&dimension), sizeof(int))) {
-        float* buffer = new float[dimension];
-        fin.read((char*)buffer, dimension * sizeof(float));
-        data.push_back(buffer);
+    if (reservoir.size() < num_samples) {
+        cout << "only " << reservoir.size() << " vectors in " << argv[1] << endl;
     }
-    int num_samples = atoi(argv[2]);
 
-    vector<bool> selected = selection(data.size(), num_samples);
-    ofstream fout(outputFile.c_str(), ios::binary);
-    if (!fout) {
-        cout << "cannot open file " << argv[3] << endl;
+    // queries in the order of the base
+    vector<unsigned> order(reservoir.size());
+    for (unsigned slot = 0; slot < order.size(); ++slot) {
+        order[slot] = slot;
     }
+    sort(order.begin(), order.end(), [&](unsigned a, unsigned b) { return sampleIds[a] < sampleIds[b]; });
 
+    lshbox::FvecsWriter fout(outputFile, withIds);
     string logFileName(outputFile.c_str());
     logFileName += ".idx.txt";
     ofstream indexFout(logFileName.c_str());
     cout << "selected items: " << endl;
     indexFout << "selected items: " << endl;
-    int queryIdx = 0;
-    for (int i = 0; i < data.size(); ++i) {
-        if (selected[i]) {
-            cout << queryIdx << " -> " << i << endl;
-            indexFout << queryIdx << " -> " << i << endl;
-            queryIdx++;
-
-            if (outputFile.substr(outputFile.size() - 7, 7) == "idfvecs") {
-                fout.write((char*)&i, sizeof(int));
-            }
-            fout.write((char*)&dimension, sizeof(int));
-            fout.write((char*)data[i], dimension * sizeof(float));
-        }
+    for (unsigned queryIdx = 0; queryIdx < order.size(); ++queryIdx) {
+        unsigned slot = order[queryIdx];
+        cout << queryIdx << " -> " << sampleIds[slot] << endl;
+        indexFout << queryIdx << " -> " << sampleIds[slot] << endl;
+        fout.write(&samples[(size_t)slot * dimension], dimension, sampleIds[slot]);
     }
+    fout.flush();
     cout << "sampled queries are written into " << outputFile << endl;
     cout << "mappings are written into " << logFileName << endl;
-    for (auto& v : data) {
-        delete v;
-    }
-    fout.close();
-    fin.close();
     indexFout.close();
     return 0;
 }
@@ -1,70 +1,75 @@
+// samples num_queries vectors of an fvecs file as queries and writes the
+// others as the base, both in one streaming pass: the sample is drawn over
+// the number of vectors, which follows from the file size
 #include <iostream>
 #include <cstring>
+#include <cstdlib>
+#include <ctime>
 #include <fstream>
 #include <vector>
 #include <string>
+#include <algorithm>
 
-#include "lshbox/utils.h"
+#include "gqr/util/vecsio.h"
 using namespace std;
 int main(int argc, char ** argv) {
     if (argc != 5) {
-        cout << "Usage: ./sample_queries input_fvecs num_queries output_query_fvecs output_base_fvecs" << endl;
+        cout << "Usage: ./sample_remove_queries input_fvecs num_queries output_query_fvecs output_base_fvecs" << endl;
         return 0;
     }
 
     const char* outputFile = argv[3];
     const char* outputBaseFile = argv[4];
-    ifstream fin(argv[1], ios::binary);
+    unsigned num_samples = atoi(argv[2]);
+
+    ifstream fin(argv[1], ios::binary | ios::ate);
     if (!fin) {
         cout << "cannot open file " << argv[1] << endl;
-    }
-
-    int dimension;
-    vector<float*> data;
-    while (fin.read((char*)(&dimension), sizeof(int))) {
-        float* buffer = new float[dimension];
-        fin.read((char*)buffer, dimension * sizeof(float));
-        data.push_back(buffer);
-    }
-    int num_samples = atoi(argv[2]);
-
-    vector<bool> selected = selection(data.size(), num_samples);
-    ofstream fout(outputFile, ios::binary);
-    if (!fout) {
-        cout << "cannot open file " << argv[3] << endl;
         return 0;
     }
+    lshbox::FvecsStream stream(argv[1]);
+    const unsigned dimension = stream.getDim();
+    const unsigned long long numVectors = (unsigned long long)fin.tellg() / (sizeof(int) + sizeof(float) * dimension);
+    fin.close();
 
-    ofstream baseFout(outputBaseFile, ios::binary);
-    if (!baseFout) {
-        cout << "cannot open file " << argv[3] << endl;
-        return 0;
+    // reservoir over the ids, then the sampled ids in increasing order
+    lshbox::Reservoir reservoir(num_samples, (unsigned)time(0));
+    vector<unsigned> sampleIds(num_samples);
+    for (unsigned long long id = 0; id < numVectors; ++id) {
+        int slot = reservoir.offer();
+        if (slot >= 0) {
+            sampleIds[slot] = id;
+        }
     }
+    sampleIds.resize(reservoir.size());
+    sort(sampleIds.begin(), sampleIds.end());
+
+    lshbox::FvecsWriter fout(outputFile);
+    lshbox::FvecsWriter baseFout(outputBaseFile);
     string logFileName(outputFile);
     logFileName += ".idx.txt";
     ofstream indexFout(logFileName.c_str());
     cout << "selected items: " << endl;
     indexFout << "selected items: " << endl;
-    int queryIdx = 0;
-    for (int i = 0; i < data.size(); ++i) {
-        if (selected[i]) {
-            cout << queryIdx << " -> " << i << endl;
-            indexFout << queryIdx << " -> " << i << endl;
-            queryIdx++;
-
-            fout.write((char*)&dimension, sizeof(int));
-            fout.write((char*)data[i], dimension * sizeof(float));
-        } else {
-            baseFout.write((char*)&dimension, sizeof(int));
-            baseFout.write((char*)data[i], dimension * sizeof(float));
+    unsigned queryIdx = 0;
+    vector<float> block;
+    unsigned n;
+    while ((n = stream.read(block, 1 << 16)) > 0) {
+        unsigned firstId = stream.numRead() - n;
+        for (unsigned i = 0; i < n; ++i) {
+            const float* row = &block[(size_t)i * dimension];
+            if (queryIdx < sampleIds.size() && sampleIds[queryIdx] == firstId + i) {
+                cout << queryIdx << " -> " << firstId + i << endl;
+                indexFout << queryIdx << " -> " << firstId + i << endl;
+                queryIdx++;
+                fout.write(row, dimension);
+            } else {
+                baseFout.write(row, dimension);
+            }
         }
     }
-    for (auto& v : data) {
-        delete v;
-    }
-    fout.close();
-    baseFout.close();
-    fin.close();
+    fout.flush();
+    baseFout.flush();
     indexFout.close();
     return 0;
 }
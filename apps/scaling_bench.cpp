@@ -0,0 +1,564 @@
+// scaling benchmark: sweeps the size of the base, the dimension, the code
+// length, the number of tables and the number of query threads, and reports
+// for every configuration and query method the QPS at a fixed recall, the
+// build and load time of the index and the peak RSS
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <unordered_map>
+#include <type_traits>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include <lshbox.h>
+#include <lshbox/query/fv.h>
+#include <lshbox/query/treelookup.h>
+#include <lshbox/query/hammingranking.h>
+#include <lshbox/query/hashlookupPP.h>
+#include <lshbox/query/lossranking.h>
+#include <lshbox/query/mih.h>
+#include <lshbox/lsh/pcah.h>
+#include <lshbox/lsh/randommodel.h>
+
+using std::string;
+using std::vector;
+using std::unordered_map;
+
+typedef float DATATYPE;
+typedef lshbox::Matrix<DATATYPE>::Accessor ACCESSOR;
+typedef lshbox::Scanner<ACCESSOR> SCANNER;
+typedef lshbox::PCAH<DATATYPE> LSHTYPE;
+
+struct Config {
+    string axis; // the swept parameter, "base" for the base configuration
+    unsigned numItems;
+    unsigned dim;
+    unsigned codelen;
+    unsigned numTables;
+    unsigned threads;
+};
+
+// shared by all configurations
+struct Options {
+    vector<string> methods;
+    unsigned numQueries;
+    unsigned K;
+    float recall;
+    unsigned clusters;
+    string model;
+    string workDir;
+    unsigned seed;
+    string baseFile;
+    string queryFile;
+};
+
+/*
+ * numItems items of dim dimensions: Gaussian clusters around clusters
+ * random centers, or the first rows and dimensions of baseFile.
+ * */
+static void makeData(lshbox::Matrix<DATATYPE>& data, unsigned numItems, unsigned dim, const Options& opt, const string& file, unsigned seed) {
+    if (!file.empty()) {
+        lshbox::Matrix<DATATYPE> all(file);
+        numItems = std::min<unsigned>(numItems, all.getSize());
+        dim = std::min<unsigned>(dim, all.getDim());
+        data.reset(dim, numItems);
+        for (unsigned i = 0; i < numItems; ++i) {
+            std::copy(all[i], all[i] + dim, data[i]);
+        }
+        return;
+    }
+    // the centers depend on the base seed only, so that queries share them
+    std::mt19937 centerRng(opt.seed);
+    std::normal_distribution<float> normal(0, 1);
+    vector<float> centers(opt.clusters * dim);
+    for (float& x : centers) {
+        x = 4 * normal(centerRng);
+    }
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<unsigned> pick(0, opt.clusters - 1);
+    data.reset(dim, numItems);
+    for (unsigned i = 0; i < numItems; ++i) {
+        const float* center = &centers[pick(rng) * dim];
+        for (unsigned j = 0; j < dim; ++j) {
+            data[i][j] = center[j] + normal(rng);
+        }
+    }
+}
+
+// exact K nearest neighbours of every query, on all cores
+static vector<vector<unsigned>> groundTruth(const lshbox::Matrix<DATATYPE>& data, const lshbox::Matrix<DATATYPE>& queries, unsigned K) {
+    vector<vector<unsigned>> truth(queries.getSize());
+    lshbox::Metric<DATATYPE> metric(data.getDim(), L2_DIST);
+    std::atomic<unsigned> next(0);
+    vector<std::thread> workers;
+    for (unsigned t = 0; t < std::max(1u, std::thread::hardware_concurrency()); ++t) {
+        workers.emplace_back([&]() {
+            lshbox::Topk topk;
+            for (unsigned q = next++; q < (unsigned)queries.getSize(); q = next++) {
+                topk.reset(K);
+                for (int i = 0; i < data.getSize(); ++i) {
+                    topk.push(i, metric.dist(queries[q], data[i]));
+                }
+                for (const auto& p : topk.genTopk()) {
+                    truth[q].push_back(p.second);
+                }
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    return truth;
+}
+
+/*
+ * Answer all queries with numItems probed items each on threads threads,
+ * one prober per query, constructed by factory(place, query, scanner).
+ * Returns the wall time and the ids found.
+ * */
+template<typename PROBER, typename FACTORY>
+double runQueries(LSHTYPE& mylsh, const lshbox::Matrix<DATATYPE>& queries, const SCANNER& initScanner, FACTORY factory,
+    unsigned numItems, unsigned threads, vector<vector<unsigned>>& found) {
+    found.assign(queries.getSize(), vector<unsigned>());
+    std::atomic<unsigned> next(0);
+    lshbox::wall_timer timer;
+    vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&]() {
+            SCANNER scanner = initScanner;
+            typename std::aligned_storage<sizeof(PROBER), alignof(PROBER)>::type storage;
+            PROBER* prober = reinterpret_cast<PROBER*>(&storage);
+            for (unsigned q = next++; q < (unsigned)queries.getSize(); q = next++) {
+                factory(prober, queries[q], scanner);
+                mylsh.KItemByProber(queries[q], *prober, numItems);
+                for (const auto& p : prober->getScanner().genTopk()) {
+                    found[q].push_back(p.second);
+                }
+                prober->~PROBER();
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    return timer.elapsed();
+}
+
+static float recallOf(const vector<vector<unsigned>>& truth, const vector<vector<unsigned>>& found) {
+    double sum = 0;
+    for (unsigned q = 0; q < truth.size(); ++q) {
+        unsigned matched = 0;
+        for (unsigned id : truth[q]) {
+            matched += std::find(found[q].begin(), found[q].end(), id) != found[q].end();
+        }
+        sum += truth[q].empty() ? 1 : (double)matched / truth[q].size();
+    }
+    return truth.empty() ? 0 : sum / truth.size();
+}
+
+/*
+ * Double the probed items from 2K until the recall reaches the target, or
+ * the whole base is probed, and report the QPS of that budget.
+ * */
+template<typename PROBER, typename FACTORY>
+void sweepBudget(std::ostream& os, const string& method, LSHTYPE& mylsh, const lshbox::Matrix<DATATYPE>& queries, const SCANNER& initScanner,
+    FACTORY factory, const vector<vector<unsigned>>& truth, const Config& config, const Options& opt) {
+    vector<vector<unsigned>> found;
+    for (unsigned numItems = 2 * opt.K; ; numItems = std::min(2 * numItems, config.numItems)) {
+        double elapsed = runQueries<PROBER>(mylsh, queries, initScanner, factory, numItems, config.threads, found);
+        float recall = recallOf(truth, found);
+        bool reached = recall >= opt.recall;
+        if (reached || numItems >= config.numItems) {
+            os << "RESULT " << method << " " << numItems << " " << recall << " "
+                << (elapsed > 0 ? queries.getSize() / elapsed : 0) << " " << reached << std::endl;
+            return;
+        }
+    }
+}
+
+// MIH splits the code of its single table into two substrings
+typedef std::vector<std::unordered_map<unsigned long long, std::vector<unsigned long long>>> SubtablesT;
+
+static SubtablesT buildSubtables(const LSHTYPE& mylsh, unsigned substringNum) {
+    typedef unsigned long long BIDTYPE;
+    SubtablesT subtables(substringNum);
+    unsigned substringLen = mylsh.codelength / substringNum;
+    BIDTYPE mask = (1ULL << substringLen) - 1;
+    for (const auto& item : mylsh.tables[0]) {
+        BIDTYPE bid = item.first;
+        for (int i = substringNum - 1; i >= 0; --i) {
+            subtables[i][bid & mask].push_back(item.first);
+            bid >>= substringLen;
+        }
+    }
+    return subtables;
+}
+
+/*
+ * One configuration, run in a child process so that its peak RSS is its
+ * own. Writes "BUILD build load" and one "RESULT ..." line per method to os.
+ * */
+static void runConfig(std::ostream& os, const Config& config, const Options& opt) {
+    lshbox::Matrix<DATATYPE> data;
+    lshbox::Matrix<DATATYPE> queries;
+    makeData(data, config.numItems, config.dim, opt, opt.baseFile, opt.seed);
+    makeData(queries, opt.numQueries, config.dim, opt, opt.queryFile, opt.seed + 1);
+    Config actual = config;
+    actual.numItems = data.getSize();
+    vector<vector<unsigned>> truth = groundTruth(data, queries, opt.K);
+
+    std::ostringstream prefix;
+    prefix << opt.workDir << "/scaling_bench_" << getpid();
+    const string modelFile = prefix.str() + ".model";
+    const string bitsFile = prefix.str() + ".bits";
+    double buildTime = 0;
+    {
+        lshbox::wall_timer timer;
+        if (opt.model == "pca") {
+            lshbox::writePCAH(modelFile, data, config.numTables, config.codelen, 20000, opt.seed);
+        } else {
+            lshbox::writeRandomPCAH(modelFile, data, config.numTables, config.codelen, opt.seed);
+        }
+        LSHTYPE built;
+        lshbox::buildIndex(built, config.numTables, data, modelFile, bitsFile);
+        buildTime = timer.elapsed();
+    }
+    LSHTYPE mylsh;
+    lshbox::wall_timer loadTimer;
+    mylsh.loadModel(modelFile, bitsFile);
+    double loadTime = loadTimer.elapsed();
+    std::remove(modelFile.c_str());
+    std::remove(bitsFile.c_str());
+    os << "BUILD " << buildTime << " " << loadTime << std::endl;
+
+    ACCESSOR accessor(data);
+    lshbox::Metric<DATATYPE> metric(data.getDim(), L2_DIST);
+    SCANNER initScanner(accessor, metric, opt.K);
+
+    Tree tree(config.codelen);
+    FV fvs(config.codelen);
+    for (const string& method : opt.methods) {
+        if (method == "GQR") {
+            typedef TreeLookup<ACCESSOR> PROBER;
+            sweepBudget<PROBER>(os, method, mylsh, queries, initScanner, [&](PROBER* place, const DATATYPE* q, SCANNER& scanner) {
+                new(place) PROBER(q, scanner, mylsh, &tree);
+            }, truth, actual, opt);
+        } else if (method == "HR") {
+            typedef HammingRanking<ACCESSOR> PROBER;
+            sweepBudget<PROBER>(os, method, mylsh, queries, initScanner, [&](PROBER* place, const DATATYPE* q, SCANNER& scanner) {
+                new(place) PROBER(q, scanner, mylsh);
+            }, truth, actual, opt);
+        } else if (method == "QR") {
+            typedef LossRanking<ACCESSOR> PROBER;
+            sweepBudget<PROBER>(os, method, mylsh, queries, initScanner, [&](PROBER* place, const DATATYPE* q, SCANNER& scanner) {
+                new(place) PROBER(q, scanner, mylsh);
+            }, truth, actual, opt);
+        } else if (method == "HL") {
+            typedef HashLookupPP<ACCESSOR> PROBER;
+            sweepBudget<PROBER>(os, method, mylsh, queries, initScanner, [&](PROBER* place, const DATATYPE* q, SCANNER& scanner) {
+                new(place) PROBER(q, scanner, mylsh, &fvs);
+            }, truth, actual, opt);
+        } else if (method == "MIH") {
+            // single table only, as in search
+            if (config.numTables != 1) {
+                continue;
+            }
+            typedef MIH<ACCESSOR> PROBER;
+            SubtablesT subtables = buildSubtables(mylsh, 2);
+            sweepBudget<PROBER>(os, method, mylsh, queries, initScanner, [&](PROBER* place, const DATATYPE* q, SCANNER& scanner) {
+                new(place) PROBER(q, scanner, mylsh, subtables, 2);
+            }, truth, actual, opt);
+        } else {
+            std::cerr << "scaling_bench does not support query method " << method << std::endl;
+        }
+    }
+}
+
+struct Row {
+    Config config;
+    string method;
+    unsigned numItemsProbed;
+    float recall;
+    double qps;
+    bool reached;
+    double buildTime;
+    double loadTime;
+    double peakRssMB;
+};
+
+/*
+ * Fork, run the configuration in the child and collect its lines through a
+ * pipe and its peak RSS through wait4(). A child that dies yields no rows.
+ * */
+static vector<Row> forkConfig(const Config& config, const Options& opt) {
+    vector<Row> rows;
+    int fds[2];
+    if (pipe(fds) != 0) {
+        std::cerr << "pipe failed" << std::endl;
+        return rows;
+    }
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid < 0) {
+        std::cerr << "fork failed" << std::endl;
+        return rows;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        std::ostringstream os;
+        runConfig(os, config, opt);
+        const string out = os.str();
+        size_t written = 0;
+        while (written < out.size()) {
+            ssize_t n = write(fds[1], out.data() + written, out.size() - written);
+            if (n <= 0) {
+                break;
+            }
+            written += n;
+        }
+        close(fds[1]);
+        _exit(0);
+    }
+    close(fds[1]);
+    string out;
+    char buffer[4096];
+    ssize_t n;
+    while ((n = read(fds[0], buffer, sizeof(buffer))) > 0) {
+        out.append(buffer, n);
+    }
+    close(fds[0]);
+    int status = 0;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::cerr << "configuration " << config.numItems << "x" << config.dim << " R" << config.codelen
+            << " L" << config.numTables << " T" << config.threads << " failed" << std::endl;
+        return rows;
+    }
+
+    std::istringstream iss(out);
+    string tag;
+    double buildTime = 0, loadTime = 0;
+    while (iss >> tag) {
+        if (tag == "BUILD") {
+            iss >> buildTime >> loadTime;
+        } else if (tag == "RESULT") {
+            Row row;
+            row.config = config;
+            iss >> row.method >> row.numItemsProbed >> row.recall >> row.qps >> row.reached;
+            row.buildTime = buildTime;
+            row.loadTime = loadTime;
+            // ru_maxrss is in KB on Linux
+            row.peakRssMB = usage.ru_maxrss / 1024.0;
+            rows.push_back(row);
+        }
+    }
+    return rows;
+}
+
+static vector<unsigned> parseList(const unordered_map<string, string>& params, const string& key, const string& value) {
+    std::istringstream iss(params.find(key) != params.end() ? params.find(key)->second : value);
+    vector<unsigned> list;
+    string item;
+    while (std::getline(iss, item, ',')) {
+        list.push_back(std::stoi(item));
+    }
+    return list;
+}
+
+/*
+ * The first value of every list makes the base configuration, each axis
+ * then varies its own parameter with the others at their base value, or
+ * with --grid=true all combinations are run.
+ * */
+static vector<Config> makeConfigs(const vector<vector<unsigned>>& lists, const char* const* axes, bool grid) {
+    vector<Config> configs;
+    auto make = [](const string& axis, const vector<unsigned>& v) {
+        Config config = {axis, v[0], v[1], v[2], v[3], v[4]};
+        return config;
+    };
+    vector<unsigned> base(5);
+    for (unsigned a = 0; a < 5; ++a) {
+        base[a] = lists[a][0];
+    }
+    if (grid) {
+        vector<unsigned> idx(5, 0);
+        while (true) {
+            vector<unsigned> v(5);
+            for (unsigned a = 0; a < 5; ++a) {
+                v[a] = lists[a][idx[a]];
+            }
+            configs.push_back(make("grid", v));
+            unsigned a = 0;
+            while (a < 5 && ++idx[a] == lists[a].size()) {
+                idx[a++] = 0;
+            }
+            if (a == 5) {
+                break;
+            }
+        }
+        return configs;
+    }
+    configs.push_back(make("base", base));
+    for (unsigned a = 0; a < 5; ++a) {
+        for (unsigned i = 1; i < lists[a].size(); ++i) {
+            vector<unsigned> v = base;
+            v[a] = lists[a][i];
+            configs.push_back(make(axes[a], v));
+        }
+    }
+    return configs;
+}
+
+static unsigned axisValue(const Config& config, const string& axis) {
+    if (axis == "num_items") return config.numItems;
+    if (axis == "dim") return config.dim;
+    if (axis == "codelen") return config.codelen;
+    if (axis == "tables") return config.numTables;
+    return config.threads;
+}
+
+int main(int argc, const char **argv)
+{
+    unordered_map<string, string> params = lshbox::parseParams(argc, argv);
+    if (params.find("help") != params.end()) {
+        std::cerr << "Usage: "
+            << "./scaling_bench "
+            << "[--num_items=10000,40000,160000] [--dims=64,128,256] [--codelens=16,12,20] "
+            << "[--tables=1,2,4] [--threads=1,2,4,8] [--grid=false] "
+            << "[--methods=GQR,HR,QR,HL,MIH] [--recall=0.9] [--k=20] [--num_queries=200] "
+            << "[--model=random|pca] [--clusters=64] [--seed=1] [--base_file=fvecs --query_file=fvecs] "
+            << "[--min_efficiency=0.7] [--work_dir=/tmp] [--output=file]"
+            << std::endl;
+        return -1;
+    }
+    Options opt;
+    {
+        std::istringstream iss(params.find("methods") != params.end() ? params["methods"] : "GQR,HR,QR,HL,MIH");
+        string method;
+        while (std::getline(iss, method, ',')) {
+            opt.methods.push_back(method);
+        }
+    }
+    opt.numQueries = params.find("num_queries") != params.end() ? std::stoi(params["num_queries"]) : 200;
+    opt.K = params.find("k") != params.end() ? std::stoi(params["k"]) : 20;
+    opt.recall = params.find("recall") != params.end() ? std::stof(params["recall"]) : 0.9;
+    opt.clusters = params.find("clusters") != params.end() ? std::max(1, std::stoi(params["clusters"])) : 64;
+    opt.model = params.find("model") != params.end() ? params["model"] : "random";
+    opt.workDir = params.find("work_dir") != params.end() ? params["work_dir"] : "/tmp";
+    opt.seed = params.find("seed") != params.end() ? std::stoi(params["seed"]) : 1;
+    opt.baseFile = params.find("base_file") != params.end() ? params["base_file"] : "";
+    opt.queryFile = params.find("query_file") != params.end() ? params["query_file"] : "";
+    if (opt.baseFile.empty() != opt.queryFile.empty()) {
+        std::cerr << "base_file and query_file go together" << std::endl;
+        return -1;
+    }
+    double minEfficiency = params.find("min_efficiency") != params.end() ? std::stod(params["min_efficiency"]) : 0.7;
+    bool grid = params.find("grid") != params.end() && params["grid"] == "true";
+
+    const char* const axes[] = {"num_items", "dim", "codelen", "tables", "threads"};
+    vector<vector<unsigned>> lists;
+    lists.push_back(parseList(params, "num_items", "10000,40000,160000"));
+    lists.push_back(parseList(params, "dims", "64,128,256"));
+    lists.push_back(parseList(params, "codelens", "16,12,20"));
+    lists.push_back(parseList(params, "tables", "1,2,4"));
+    lists.push_back(parseList(params, "threads", "1,2,4,8"));
+    for (unsigned a = 0; a < 5; ++a) {
+        if (lists[a].empty()) {
+            std::cerr << "empty list for " << axes[a] << std::endl;
+            return -1;
+        }
+    }
+    for (unsigned threads : lists[4]) {
+        if (threads > std::thread::hardware_concurrency()) {
+            std::cerr << "warning: " << threads << " threads on " << std::thread::hardware_concurrency()
+                << " cores, the thread axis is capped by the machine" << std::endl;
+            break;
+        }
+    }
+
+    std::ofstream file;
+    if (params.find("output") != params.end()) {
+        file.open(params["output"].c_str());
+        if (!file) {
+            std::cerr << "cannot open output file " << params["output"] << std::endl;
+            return -1;
+        }
+    }
+    std::ostream& os = file.is_open() ? file : std::cout;
+
+    // rel_qps is relative to the base configuration, efficiency divides it
+    // by the ideal speedup along the thread axis
+    os << "axis,num_items,dim,codelen,tables,threads,method,probed_items,recall,reached,qps,rel_qps,efficiency,build_s,load_s,peak_rss_mb" << std::endl;
+    vector<Config> configs = makeConfigs(lists, axes, grid);
+    unordered_map<string, Row> baseRows;
+    vector<Row> all;
+    for (const Config& config : configs) {
+        vector<Row> rows = forkConfig(config, opt);
+        for (const Row& row : rows) {
+            if (config.axis == "base") {
+                baseRows[row.method] = row;
+            }
+            double rel = 0, efficiency = 0;
+            auto it = baseRows.find(row.method);
+            if (it != baseRows.end() && it->second.qps > 0) {
+                rel = row.qps / it->second.qps;
+                efficiency = config.axis == "threads" ? rel * it->second.config.threads / config.threads : rel;
+            }
+            const Config& c = row.config;
+            os << c.axis << "," << c.numItems << "," << c.dim << "," << c.codelen << "," << c.numTables << "," << c.threads << ","
+                << row.method << "," << row.numItemsProbed << "," << row.recall << "," << row.reached << ","
+                << row.qps << "," << rel << "," << efficiency << ","
+                << row.buildTime << "," << row.loadTime << "," << row.peakRssMB << std::endl;
+            all.push_back(row);
+        }
+    }
+
+    if (grid) {
+        return 0;
+    }
+    // where every method stops scaling: the first thread count whose
+    // efficiency is below min_efficiency, and for the other axes the first
+    // value at which the QPS fell to half of the base configuration
+    std::cout << "SCALING SUMMARY" << std::endl;
+    for (const string& method : opt.methods) {
+        auto base = baseRows.find(method);
+        if (base == baseRows.end() || base->second.qps <= 0) {
+            continue;
+        }
+        for (unsigned a = 0; a < 5; ++a) {
+            const string axis = axes[a];
+            bool found = false;
+            for (const Row& row : all) {
+                if (row.method != method || row.config.axis != axis) {
+                    continue;
+                }
+                double rel = row.qps / base->second.qps;
+                if (axis == "threads") {
+                    double efficiency = rel * base->second.config.threads / row.config.threads;
+                    if (row.config.threads > base->second.config.threads && efficiency < minEfficiency) {
+                        std::cout << method << ", " << axis << ", stops scaling at " << row.config.threads
+                            << " threads, efficiency " << efficiency << std::endl;
+                        found = true;
+                        break;
+                    }
+                } else if (rel < 0.5) {
+                    std::cout << method << ", " << axis << ", QPS halved at " << axisValue(row.config, axis)
+                        << ", " << row.qps << " vs " << base->second.qps << std::endl;
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) {
+                std::cout << method << ", " << axis << ", scales over the sweep" << std::endl;
+            }
+        }
+    }
+    return 0;
+}
@@ -39,6 +39,11 @@ int main(int argc, const char **argv)
     typedef float DATATYPE;
 
     unordered_map<string, string> params = lshbox::parseParams(argc, argv);
+    // --config=file adds the settings of file, e.g. those written by --tune_recall,
+    // options given on the command line take precedence
+    if (params.find("config") != params.end()) {
+        lshbox::loadParams(params["config"], params);
+    }
     if (params.size() < 8)
     {
         std::cerr << "Usage: "
@@ -113,9 +118,32 @@ int main(int argc, const char **argv)
         assert(false);
         return 0;
     }
+    // --huge_pages=true backs the base vectors and the shared probing tables by huge pages
+    if (params.find("huge_pages") != params.end() && params["huge_pages"] == "true") {
+        lshbox::hugePages() = true;
+    }
     lshbox::Matrix<DATATYPE> data(dataFile);
     lshbox::Matrix<DATATYPE> query(queryFile);
     std::cout << " finished." << std::endl;
+
+    // L1 / L2 candidates are abandoned once their partial distance exceeds the
+    // k-th best, reading high-variance dimensions first makes that happen sooner.
+    // Only verification sees the permutation: the base bits come from
+    // base_bits_file, queries are hashed as loaded and the scanner permutes its
+    // own copy, and base rows that are hashed go through Matrix::originalRow()
+    if (params.find("reorder_dims") != params.end() && params["reorder_dims"] == "variance") {
+        data.permuteDims(data.dimsByVariance());
+    }
+
+    // angular distance only needs the direction of base vectors: cache their
+    // norms, or with --normalize=true scale them to unit length in place
+    if (metric == AG_DIST) {
+        if (params.find("normalize") != params.end() && params["normalize"] == "true") {
+            data.normalize();
+        } else {
+            data.calNorms();
+        }
+    }
     
     // load model
     if (hashMethod == "PCAH") {
@@ -11,9 +11,147 @@
 #include "apps/opq_evaluate.cpp"
 #include "lshbox/bench/bencher.h"
 #include <lshbox/query/mih.h>
+#include <lshbox/scalarquantizer.h>
+#include <lshbox/productquantizer.h>
+#include <base/parallelprobe.h>
+#include <lshbox/query/tableshard.h>
+#include <algorithm>
+#include "apps/search_tune.h"
+#include "gqr/util/bruteforce.h"
 
 using std::string;
 using std::unordered_map;
+
+/*
+ * With GQR_ENABLE_COUNTERS, print the hot-path counters of all queries per
+ * query. Call it once all probers are destroyed and their threads joined.
+ * */
+inline void reportCounters(unsigned numQueries) {
+    if (!lshbox::COUNTERS_ENABLED) {
+        return;
+    }
+    lshbox::flushThreadCounters();
+    std::cout << "COUNTERS    , per query, " << numQueries << " queries" << std::endl;
+    lshbox::globalCounters().print(std::cout, numQueries);
+}
+/*
+ * --perf_counters=true reads cycles, instructions, LLC, dTLB and branch
+ * misses of the encode, generate and verify phases with perf_event_open and
+ * prints them per query, see lshbox/perfcounters.h.
+ * */
+inline bool perfCounters(const unordered_map<string, string>& params) {
+    return params.find("perf_counters") != params.end() && params.find("perf_counters")->second == "true";
+}
+
+inline void reportPerf(unsigned numQueries) {
+    lshbox::stopPerf();
+    std::cout << "PERF    , per query, " << numQueries << " queries" << std::endl;
+    lshbox::perfTotals().print(std::cout, numQueries);
+}
+
+/*
+ * --trace_file=path writes the spans of every --trace_every-th prober (100 by
+ * default) as Chrome trace JSON, see lshbox/trace.h, one track per sampled
+ * query. Tracks are numbered by the order probers are built or reset in.
+ * --trace_capacity bounds the events kept per thread, older ones are dropped.
+ * */
+inline void startTrace(const unordered_map<string, string>& params) {
+    if (params.find("trace_file") == params.end()) {
+        return;
+    }
+    unsigned every = params.find("trace_every") != params.end() ? std::stoi(params.find("trace_every")->second) : 100;
+    size_t capacity = params.find("trace_capacity") != params.end() ? std::stoul(params.find("trace_capacity")->second) : 1 << 16;
+    lshbox::startTrace(every, capacity);
+}
+
+inline void writeTrace(const unordered_map<string, string>& params) {
+    if (params.find("trace_file") == params.end()) {
+        return;
+    }
+    lshbox::stopTrace();
+    const string& path = params.find("trace_file")->second;
+    std::ofstream fout(path.c_str());
+    if (!fout) {
+        std::cerr << "cannot create trace file " << path << std::endl;
+        assert(false);
+    }
+    size_t events = lshbox::writeChromeTrace(fout);
+    std::cout << "TRACE    , " << events << " events, " << lshbox::traceDropped() << " dropped, written to " << path << std::endl;
+}
+
+/*
+ * --memory_report=true prints the bytes of the base and query matrices, of
+ * every table (keys, postings, map overhead) and of the model before the
+ * search, the shared flipping vectors and the per-query prober state once the
+ * probers are built, and the resident set size.
+ * */
+inline bool memoryReport(const unordered_map<string, string>& params) {
+    return params.find("memory_report") != params.end() && params.find("memory_report")->second == "true";
+}
+
+/*
+ * the latency at percentile p of the sorted latencies, 0 if there are none
+ * */
+inline double latencyPercentile(const vector<double>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    return sorted[std::min(sorted.size() - 1, (size_t)(sorted.size() * p / 100))];
+}
+
+inline void reportRss() {
+    lshbox::MemoryReport::line(std::cout, "current RSS", lshbox::currentRssBytes());
+    lshbox::MemoryReport::line(std::cout, "peak RSS", lshbox::peakRssBytes());
+}
+
+template<typename DATATYPE, typename LSHTYPE>
+void reportIndexMemory(const lshbox::Matrix<DATATYPE>& data, const lshbox::Matrix<DATATYPE>& query, const LSHTYPE& mylsh) {
+    lshbox::MemoryReport report;
+    report.add("base matrix", data.memoryBytes());
+    report.add("query matrix", query.memoryBytes());
+    size_t tableBytes = 0;
+    for (unsigned t = 0; t != mylsh.getNumTables(); ++t) {
+        lshbox::TableMemory table = mylsh.getTableMemory(t);
+        string name = "table " + std::to_string(t);
+        report.add(name + " keys", table.keys);
+        report.add(name + " postings", table.postings);
+        report.add(name + " overhead", table.overhead);
+        tableBytes += table.total();
+    }
+    report.add("model", mylsh.modelBytes());
+    report.print(std::cout);
+    // the tables grow with items times tables, use this to size other configurations
+    std::cout << "MEMORY    , table bytes per item per table, "
+        << (data.getSize() && mylsh.getNumTables() ? (double)tableBytes / data.getSize() / mylsh.getNumTables() : 0) << std::endl;
+    reportRss();
+}
+
+template<typename PROBERTYPE>
+void reportProberMemory(const PROBERTYPE* probers, unsigned numProbers) {
+    size_t total = 0;
+    size_t largest = 0;
+    for (unsigned i = 0; i != numProbers; ++i) {
+        size_t bytes = probers[i].memoryBytes();
+        total += bytes;
+        largest = std::max(largest, bytes);
+    }
+    lshbox::MemoryReport::line(std::cout, "prober per query, avg", numProbers ? total / numProbers : 0);
+    lshbox::MemoryReport::line(std::cout, "prober per query, max", largest);
+    lshbox::MemoryReport::line(std::cout, "probers, " + std::to_string(numProbers) + " live", total);
+    reportRss();
+}
+
+/*
+ * The last round of annQuery and annQueryReuse, --probe_items=N ends the
+ * doubling at N items, e.g. at the budget chosen by --tune_recall.
+ * */
+inline int maxProbeItems(int numAllItems, const unordered_map<string, string>& params) {
+    if (params.find("probe_items") != params.end()) {
+        return std::min(numAllItems, std::max(1, std::stoi(params.find("probe_items")->second)));
+    }
+    return numAllItems;
+}
+
 template<typename DATATYPE, typename LSHTYPE, typename PROBERTYPE>
 void annQuery(const lshbox::Matrix<DATATYPE>& data, const lshbox::Matrix<DATATYPE>& query, LSHTYPE& mylsh, const lshbox::Benchmark& bench, PROBERTYPE* probers, const unordered_map<string, string>& params) {
     string benchFile = params.find("benchmark_file")->second; 
@@ -27,10 +165,32 @@ void annQuery(const lshbox::Matrix<DATATYPE>& data, const lshbox::Matrix<DATATYP
     // std::cout << "expected avg items, " << "overall query time, " 
     //     << "avg recall, " << "avg precision, " << "avg error ratio, " << "actual avg items" << "\n";
 
+    // --threads=T probes the queries on T threads, --interleave=G steps G queries
+    // per thread in turn, both time the rounds by wall clock
+    unsigned threads = 1;
+    unsigned interleave = 1;
+    if (params.find("threads") != params.end()) {
+        threads = std::max(1, std::stoi(params.find("threads")->second));
+    }
+    if (params.find("interleave") != params.end()) {
+        interleave = std::max(1, std::stoi(params.find("interleave")->second));
+    }
+    bool parallel = threads > 1 || interleave > 1;
+    vector<const DATATYPE*> queries(numQueries);
+    for (unsigned i = 0; i != numQueries; ++i) {
+        queries[i] = query[bench.getQuery(i)];
+    }
+    lshbox::ProbePool<LSHTYPE, PROBERTYPE, DATATYPE> pool(mylsh, probers, queries, threads, interleave);
+    if (parallel) {
+        std::cout << "QUERY MODE    , " << (interleave > 1 ? "interleaved" : "plain")
+            << ", threads " << threads << ", interleave " << interleave << std::endl;
+    }
+
     std::cout << "# retrieved items, " << "overall query time, " << "avg recall" << "\n";
     double runtime = 0;
     lshbox::timer timer;
-    int numAllItems = data.getSize();
+    lshbox::wall_timer wallTimer;
+    int numAllItems = maxProbeItems(data.getSize(), params);
 
     // unsigned step = data.getSize() * 0.001;
     // for (unsigned numItems = 1; true ; numItems += step) { //  # step wise probing
@@ -43,11 +203,16 @@ void annQuery(const lshbox::Matrix<DATATYPE>& data, const lshbox::Matrix<DATATYP
         //     probers[i].getScanner().opqReserve(numItems); 
         // }
         timer.restart();
+        wallTimer.restart();
         // queries are applied incrementally, i.e. the result of this round depends on the last round
-        for (unsigned i = 0; i != numQueries; ++i) {
-            mylsh.KItemByProber(query[bench.getQuery(i)], probers[i], numItems);
+        if (parallel) {
+            pool.run(numItems);
+        } else {
+            for (unsigned i = 0; i != numQueries; ++i) {
+                mylsh.KItemByProber(queries[i], probers[i], numItems);
+            }
         }
-        double roundTime= timer.elapsed();
+        double roundTime= parallel ? wallTimer.elapsed() : timer.elapsed();
         runtime += roundTime;
         
         vector<unsigned> numItemProbed;
@@ -58,7 +223,7 @@ void annQuery(const lshbox::Matrix<DATATYPE>& data, const lshbox::Matrix<DATATYP
             numItemProbed.push_back(probers[i].getNumItemsProbed());
 
             // const vector<pair<float, unsigned>>& src = probers[i].getScanner().getOpqResult(); 
-            const vector<pair<float, unsigned>>& src = probers[i].getScanner().getMutableTopk().genTopk(); 
+            const vector<pair<float, unsigned>>& src = probers[i].getScanner().genTopk(); 
             vector<pair<unsigned, float>> dst(src.size()); 
             for (int j = 0; j < src.size(); ++j) {
                 dst[j].first = src[j].second;
@@ -74,15 +239,293 @@ void annQuery(const lshbox::Matrix<DATATYPE>& data, const lshbox::Matrix<DATATYP
             break;
     }
 
-    // release memory of prober;
+    unsigned long long dimsTouched = 0;
+    unsigned long long numVerified = 0;
+    for (unsigned i = 0; i != numQueries; ++i) {
+        dimsTouched += probers[i].getScanner().dimsTouched();
+        numVerified += probers[i].getNumItemsProbed();
+    }
+    std::cout << "avg dims touched per item, " << (numVerified ? (double)dimsTouched / numVerified : 0)
+        << " of " << data.getDim() << std::endl;
+    std::cout << "throughput, " << (runtime > 0 ? numQueries / runtime : 0) << " queries/s" << std::endl;
+    if (memoryReport(params)) {
+        reportProberMemory(probers, numQueries);
+    }
+
+    // release memory of prober, the caller frees the storage
     std::cout << "numQueries " << numQueries << std::endl;
-    for (unsigned i = numQueries - 1; i !=0; --i) {
+    for (unsigned i = 0; i != numQueries; ++i) {
         probers[i].~PROBERTYPE();
     }
+    reportCounters(numQueries);
 
     std::cout << "end of program" << std::endl;
 }
 
+/*
+ * Latency mode, --table_threads=T: the queries are answered one by one, the
+ * tables of each split over T threads (see lshbox::TableParallelSearch), up to
+ * --probe_items items per query. Reports the latency distribution, T=1 probes
+ * all tables on the calling thread for reference.
+ * */
+template<typename PROBERTYPE, typename DATATYPE, typename LSHTYPE, typename SCANNER, typename FACTORY>
+void annQueryTableParallel(const lshbox::Matrix<DATATYPE>& data, const lshbox::Matrix<DATATYPE>& query, LSHTYPE& mylsh, const lshbox::Benchmark& bench, const SCANNER& initScanner, FACTORY factory, const unordered_map<string, string>& params) {
+    string benchFile = params.find("benchmark_file")->second; 
+    Bencher opqBencher(benchFile.c_str());
+    int numQueries = bench.getQ();
+
+    unsigned threads = std::max(1, std::stoi(params.find("table_threads")->second));
+    unsigned numItems = data.getSize() / 100;
+    if (params.find("probe_items") != params.end()) {
+        numItems = std::stoi(params.find("probe_items")->second);
+    }
+    vector<double> latencies(numQueries);
+    vector<unsigned> numItemProbed(numQueries);
+    vector<vector<pair<unsigned, float>>> benchResult(numQueries);
+    {
+        lshbox::TableParallelSearch<LSHTYPE, DATATYPE, SCANNER, PROBERTYPE, FACTORY> searcher(mylsh, initScanner, factory, threads);
+        std::cout << "TABLE THREADS    , " << searcher.getNumThreads() << " for " << mylsh.getNumTables() << " tables" << std::endl;
+
+        lshbox::wall_timer timer;
+        for (unsigned i = 0; i != numQueries; ++i) {
+            timer.restart();
+            const vector<pair<float, unsigned>>& src = searcher.query(query[bench.getQuery(i)], numItems);
+            latencies[i] = timer.elapsed();
+            numItemProbed[i] = searcher.getNumItemsProbed();
+            benchResult[i].resize(src.size());
+            for (int j = 0; j < src.size(); ++j) {
+                benchResult[i][j].first = src[j].second;
+                benchResult[i][j].second = src[j].first;
+            }
+        }
+    }
+    double total = 0;
+    for (double latency : latencies) {
+        total += latency;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << "# retrieved items, " << "avg latency ms, " << "p50 ms, " << "p99 ms, " << "avg recall" << "\n";
+    std::cout << cal_avg(numItemProbed) << ", " << total / numQueries * 1000 << ", "
+        << latencyPercentile(latencies, 50) * 1000 << ", " << latencyPercentile(latencies, 99) * 1000 << ", "
+        << cal_avg_recall(opqBencher, benchResult, true) << std::endl;
+    std::cout << "throughput, " << numQueries / total << " queries/s" << std::endl;
+    if (memoryReport(params)) {
+        reportRss();
+    }
+    reportCounters(numQueries);
+}
+
+/*
+ * Same rounds and output as annQuery, --reuse_probers=true: instead of one
+ * prober per query for the whole run, a single prober is reset to each query
+ * in turn and taken through all rounds, so the per-query state takes the
+ * memory of one query rather than all of them. The probed items and results
+ * are those of annQuery, the time of a round is summed over the queries.
+ *
+ * The prober is built by factory(place, query, shard, scanner) over a shard
+ * of all tables, as in annQueryTableParallel.
+ * */
+inline bool reuseProbers(const unordered_map<string, string>& params) {
+    return params.find("reuse_probers") != params.end() && params.find("reuse_probers")->second == "true";
+}
+
+template<typename PROBERTYPE, typename DATATYPE, typename LSHTYPE, typename SCANNER, typename FACTORY>
+void annQueryReuse(const lshbox::Matrix<DATATYPE>& data, const lshbox::Matrix<DATATYPE>& query, LSHTYPE& mylsh, const lshbox::Benchmark& bench, SCANNER& initScanner, FACTORY factory, const unordered_map<string, string>& params) {
+    string benchFile = params.find("benchmark_file")->second; 
+    Bencher opqBencher(benchFile.c_str());
+    int numQueries = bench.getQ();
+    if (params.find("threads") != params.end() || params.find("interleave") != params.end()) {
+        std::cerr << "reuse_probers runs on one thread, without threads or interleave" << std::endl;
+        assert(false);
+    }
+
+    std::cout << "HASH TABLE SIZE    , " << mylsh.getTableSize() << std::endl;
+    std::cout << "LARGEST BUCKET SIZE    , " << mylsh.getMaxBucketSize() << std::endl;
+    std::cout << "QUERY MODE    , reused prober" << std::endl;
+
+    // the probed items of every round, as in annQuery
+    int numAllItems = maxProbeItems(data.getSize(), params);
+    vector<unsigned> rounds;
+    for (unsigned numItems = 1; true ; numItems *= 2) {
+        if (numItems > numAllItems) 
+            numItems = numAllItems;
+        rounds.push_back(numItems);
+        if (numItems == numAllItems)
+            break;
+    }
+
+    vector<unsigned> allTables(mylsh.getNumTables());
+    for (unsigned t = 0; t != allTables.size(); ++t) {
+        allTables[t] = t;
+    }
+    lshbox::HasherShard<LSHTYPE, DATATYPE> shard(mylsh, allTables);
+    typedef typename std::aligned_storage<sizeof(PROBERTYPE), alignof(PROBERTYPE)>::type Storage;
+    Storage storage;
+    PROBERTYPE* prober = reinterpret_cast<PROBERTYPE*>(&storage);
+
+    vector<double> roundTimes(rounds.size(), 0);
+    vector<vector<unsigned>> numItemProbed(rounds.size(), vector<unsigned>(numQueries));
+    vector<vector<vector<pair<unsigned, float>>>> benchResult(rounds.size(), vector<vector<pair<unsigned, float>>>(numQueries));
+    unsigned long long dimsTouched = 0;
+    unsigned long long numVerified = 0;
+    double resetTime = 0;
+    lshbox::timer timer;
+    for (unsigned i = 0; i != numQueries; ++i) {
+        const DATATYPE* q = query[bench.getQuery(i)];
+        timer.restart();
+        if (i == 0) {
+            factory(prober, q, shard, initScanner);
+        } else {
+            prober->reset(q, shard);
+        }
+        resetTime += timer.elapsed();
+        for (unsigned r = 0; r != rounds.size(); ++r) {
+            timer.restart();
+            mylsh.KItemByProber(q, *prober, rounds[r]);
+            roundTimes[r] += timer.elapsed();
+
+            numItemProbed[r][i] = prober->getNumItemsProbed();
+            const vector<pair<float, unsigned>>& src = prober->getScanner().genTopk(); 
+            vector<pair<unsigned, float>>& dst = benchResult[r][i];
+            dst.resize(src.size());
+            for (int j = 0; j < src.size(); ++j) {
+                dst[j].first = src[j].second;
+                dst[j].second = src[j].first;
+            }
+        }
+        dimsTouched += prober->getScanner().dimsTouched();
+        numVerified += prober->getNumItemsProbed();
+    }
+    if (numQueries > 0) {
+        if (memoryReport(params)) {
+            reportProberMemory(prober, 1);
+        }
+        prober->~PROBERTYPE();
+    }
+
+    std::cout << "prober reset time : " << resetTime << "." << std::endl;
+    std::cout << "# retrieved items, " << "overall query time, " << "avg recall" << "\n";
+    double runtime = 0;
+    for (unsigned r = 0; r != rounds.size(); ++r) {
+        runtime += roundTimes[r];
+        std::cout << cal_avg(numItemProbed[r]) << ", " << runtime <<", "
+            << cal_avg_recall(opqBencher, benchResult[r], true) << std::endl;
+    }
+    std::cout << "avg dims touched per item, " << (numVerified ? (double)dimsTouched / numVerified : 0)
+        << " of " << data.getDim() << std::endl;
+    std::cout << "throughput, " << (runtime > 0 ? numQueries / runtime : 0) << " queries/s" << std::endl;
+    reportCounters(numQueries);
+}
+
+/*
+ * Deadline mode, --deadline_ms=D: every query gets D ms to construct or reset
+ * its prober and probe up to --probe_items items (all by default). The prober
+ * reads the clock every --check_every buckets (8 by default), and a query
+ * that runs out of time keeps the TopK found so far. Reports the verified
+ * items, the latency distribution, the share of queries cut short and the
+ * recall. One prober is reset to each query, as in annQueryReuse.
+ * */
+template<typename PROBERTYPE, typename DATATYPE, typename LSHTYPE, typename SCANNER, typename FACTORY>
+void annQueryDeadline(const lshbox::Matrix<DATATYPE>& data, const lshbox::Matrix<DATATYPE>& query, LSHTYPE& mylsh, const lshbox::Benchmark& bench, SCANNER& initScanner, FACTORY factory, const unordered_map<string, string>& params) {
+    string benchFile = params.find("benchmark_file")->second; 
+    Bencher opqBencher(benchFile.c_str());
+    int numQueries = bench.getQ();
+
+    double deadlineMs = std::stod(params.find("deadline_ms")->second);
+    unsigned checkEvery = 8;
+    if (params.find("check_every") != params.end()) {
+        checkEvery = std::max(1, std::stoi(params.find("check_every")->second));
+    }
+    unsigned numItems = data.getSize();
+    if (params.find("probe_items") != params.end()) {
+        numItems = std::stoi(params.find("probe_items")->second);
+    }
+    std::cout << "DEADLINE    , " << deadlineMs << " ms, clock read every " << checkEvery << " buckets" << std::endl;
+
+    vector<unsigned> allTables(mylsh.getNumTables());
+    for (unsigned t = 0; t != allTables.size(); ++t) {
+        allTables[t] = t;
+    }
+    lshbox::HasherShard<LSHTYPE, DATATYPE> shard(mylsh, allTables);
+    typedef typename std::aligned_storage<sizeof(PROBERTYPE), alignof(PROBERTYPE)>::type Storage;
+    Storage storage;
+    PROBERTYPE* prober = reinterpret_cast<PROBERTYPE*>(&storage);
+
+    vector<double> latencies(numQueries);
+    vector<unsigned> numItemProbed(numQueries);
+    vector<vector<pair<unsigned, float>>> benchResult(numQueries);
+    unsigned cutShort = 0;
+    lshbox::wall_timer timer;
+    for (unsigned i = 0; i != numQueries; ++i) {
+        const DATATYPE* q = query[bench.getQuery(i)];
+        timer.restart();
+        lshbox::deadline due(deadlineMs / 1000);
+        if (i == 0) {
+            factory(prober, q, shard, initScanner);
+        } else {
+            prober->reset(q, shard);
+        }
+        if (mylsh.KItemByDeadline(q, *prober, numItems, due, checkEvery)) {
+            cutShort++;
+        }
+        const vector<pair<float, unsigned>>& partial = prober->getScanner().partialTopk();
+        latencies[i] = timer.elapsed();
+
+        numItemProbed[i] = prober->getNumItemsProbed();
+        vector<pair<unsigned, float>>& dst = benchResult[i];
+        dst.resize(std::min<size_t>(partial.size(), bench.getK()));
+        vector<pair<float, unsigned>> sorted(partial);
+        std::sort(sorted.begin(), sorted.end());
+        for (int j = 0; j < dst.size(); ++j) {
+            dst[j].first = sorted[j].second;
+            dst[j].second = prober->getScanner().finalize(sorted[j].first);
+        }
+    }
+    if (numQueries > 0) {
+        if (memoryReport(params)) {
+            reportProberMemory(prober, 1);
+        }
+        prober->~PROBERTYPE();
+    }
+
+    double total = 0;
+    for (double latency : latencies) {
+        total += latency;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << "# verified items, " << "avg latency ms, " << "p50 ms, " << "p99 ms, " << "cut short, " << "avg recall" << "\n";
+    std::cout << cal_avg(numItemProbed) << ", " << total / numQueries * 1000 << ", "
+        << latencyPercentile(latencies, 50) * 1000 << ", " << latencyPercentile(latencies, 99) * 1000 << ", "
+        << (double)cutShort / numQueries << ", "
+        << cal_avg_recall(opqBencher, benchResult, true) << std::endl;
+    std::cout << "throughput, " << numQueries / total << " queries/s" << std::endl;
+    reportCounters(numQueries);
+}
+
+// the modes that construct their probers by a factory, see annQueryByFactory
+inline bool queryByFactory(const unordered_map<string, string>& params) {
+    return params.find("table_threads") != params.end() || params.find("deadline_ms") != params.end() || reuseProbers(params);
+}
+
+/*
+ * Runs the mode of params that builds probers with factory(place, query,
+ * shard, scanner): table-parallel, deadline or reused-prober search.
+ * */
+template<typename PROBERTYPE, typename DATATYPE, typename LSHTYPE, typename SCANNER, typename FACTORY>
+void annQueryByFactory(const lshbox::Matrix<DATATYPE>& data, const lshbox::Matrix<DATATYPE>& query, LSHTYPE& mylsh, const lshbox::Benchmark& bench, SCANNER& initScanner, FACTORY factory, const unordered_map<string, string>& params) {
+    if (params.find("table_threads") != params.end()) {
+        if (params.find("deadline_ms") != params.end()) {
+            std::cerr << "deadline_ms does not support table_threads" << std::endl;
+            assert(false);
+        }
+        annQueryTableParallel<PROBERTYPE>(data, query, mylsh, bench, initScanner, factory, params);
+    } else if (params.find("deadline_ms") != params.end()) {
+        annQueryDeadline<PROBERTYPE>(data, query, mylsh, bench, initScanner, factory, params);
+    } else {
+        annQueryReuse<PROBERTYPE>(data, query, mylsh, bench, initScanner, factory, params);
+    }
+}
+
 template<typename DATATYPE, typename LSHTYPE, typename SCANNER>
 void search_gqr(
     const lshbox::Matrix<DATATYPE>& data,
@@ -95,6 +538,16 @@ void search_gqr(
     // initialized tree lookup
     typedef TreeLookup<typename lshbox::Matrix<DATATYPE>::Accessor> GQRT;
     Tree fvs(mylsh.getCodeLength());
+    if (memoryReport(params)) {
+        lshbox::MemoryReport::line(std::cout, "flipping vector tree", fvs.memoryBytes());
+    }
+    if (queryByFactory(params)) {
+        auto factory = [&fvs](GQRT* place, const DATATYPE* q, lshbox::HasherShard<LSHTYPE, DATATYPE>& shard, SCANNER& scanner) {
+            new(place) GQRT(q, scanner, shard, &fvs);
+        };
+        annQueryByFactory<GQRT>(data, query, mylsh, bench, initScanner, factory, params);
+        return;
+    }
 
     void* raw_memory = operator new[]( 
         sizeof(GQRT) * bench.getQ());
@@ -107,6 +560,7 @@ void search_gqr(
             &fvs);// for non losslookup probers
     }
     annQuery(data, query, mylsh, bench, probers, params);
+    operator delete[](raw_memory);
 }
 
 template<typename DATATYPE, typename LSHTYPE, typename SCANNER>
@@ -119,6 +573,13 @@ void search_hr(
     const unordered_map<string, string>& params) {
 
     typedef HammingRanking<typename lshbox::Matrix<DATATYPE>::Accessor> HRT;
+    if (queryByFactory(params)) {
+        auto factory = [](HRT* place, const DATATYPE* q, lshbox::HasherShard<LSHTYPE, DATATYPE>& shard, SCANNER& scanner) {
+            new(place) HRT(q, scanner, shard);
+        };
+        annQueryByFactory<HRT>(data, query, mylsh, bench, initScanner, factory, params);
+        return;
+    }
 
     void* raw_memory = operator new[]( 
         sizeof(HRT) * bench.getQ());
@@ -136,6 +597,7 @@ void search_hr(
     construct_time= timer.elapsed();
     std::cout << "HR constructing time : " << construct_time << "." << std::endl;
     annQuery(data, query, mylsh, bench, probers, params);
+    operator delete[](raw_memory);
 }
 
 template<typename DATATYPE, typename LSHTYPE, typename SCANNER>
@@ -149,6 +611,16 @@ void search_ghr(
 
     typedef HashLookupPP<typename lshbox::Matrix<DATATYPE>::Accessor> GHRT;
     FV fvs(mylsh.getCodeLength());
+    if (memoryReport(params)) {
+        lshbox::MemoryReport::line(std::cout, "flipping vectors", fvs.memoryBytes());
+    }
+    if (queryByFactory(params)) {
+        auto factory = [&fvs](GHRT* place, const DATATYPE* q, lshbox::HasherShard<LSHTYPE, DATATYPE>& shard, SCANNER& scanner) {
+            new(place) GHRT(q, scanner, shard, &fvs);
+        };
+        annQueryByFactory<GHRT>(data, query, mylsh, bench, initScanner, factory, params);
+        return;
+    }
 
     void* raw_memory = operator new[]( 
         sizeof(GHRT) * bench.getQ());
@@ -161,6 +633,7 @@ void search_ghr(
             &fvs);// for non losslookup probers
     }
     annQuery(data, query, mylsh, bench, probers, params);
+    operator delete[](raw_memory);
 }
 
 template<typename DATATYPE, typename LSHTYPE, typename SCANNER>
@@ -173,6 +646,13 @@ void search_qr(
     const unordered_map<string, string>& params) {
 
     typedef LossRanking<typename lshbox::Matrix<DATATYPE>::Accessor> QR;
+    if (queryByFactory(params)) {
+        auto factory = [](QR* place, const DATATYPE* q, lshbox::HasherShard<LSHTYPE, DATATYPE>& shard, SCANNER& scanner) {
+            new(place) QR(q, scanner, shard);
+        };
+        annQueryByFactory<QR>(data, query, mylsh, bench, initScanner, factory, params);
+        return;
+    }
 
     void* raw_memory = operator new[]( 
         sizeof(QR) * bench.getQ());
@@ -190,6 +670,7 @@ void search_qr(
     construct_time= timer.elapsed();
     std::cout << "QR constructing time : " << construct_time << "." << std::endl;
     annQuery(data, query, mylsh, bench, probers, params);
+    operator delete[](raw_memory);
 }
 
 template<typename DATATYPE, typename LSHTYPE, typename SCANNER>
@@ -222,6 +703,9 @@ void search_mih(
             bid >>= substringLen;
         }
     }
+    if (memoryReport(params)) {
+        lshbox::MemoryReport::line(std::cout, "MIH subtables", lshbox::heapBytes(subtables));
+    }
 
     void* raw_memory = operator new[](
         sizeof(MIH_) * bench.getQ());
@@ -235,6 +719,7 @@ void search_mih(
             substringNum);
     }
     annQuery(data, query, mylsh, bench, probers, params);
+    operator delete[](raw_memory);
 }
 
 template<typename DATATYPE, typename LSHTYPE, typename SCANNER>
@@ -261,6 +746,7 @@ void search_agqr(
                 &fvs);// for non losslookup probers
     }
     annQuery(data, query, mylsh, bench, probers, params);
+    operator delete[](raw_memory);
 }
 
 template<typename DATATYPE, typename LSHTYPE, typename SCANNER>
@@ -293,7 +779,66 @@ void search_hook(
                 &hooker);// for non losslookup probers
     }
     annQuery(data, query, mylsh, bench, probers, params);
-    delete[] probers;
+    operator delete[](raw_memory);
+}
+
+/*
+ * --query_method=LINEAR: exact search of the whole base by lshbox::BruteForce,
+ * the baseline the probing methods are compared to, on --threads threads.
+ * Supports the euclidean, angular and product metrics.
+ * */
+template<typename DATATYPE>
+void search_linear(
+        const lshbox::Matrix<DATATYPE>& data,
+        const lshbox::Matrix<DATATYPE>& query,
+        const lshbox::Benchmark& bench,
+        const unordered_map<string, string>& params,
+        const unsigned TYPE_DIST) {
+    lshbox::BruteForce::Metric metric;
+    if (TYPE_DIST == L2_DIST) {
+        metric = lshbox::BruteForce::EUCLIDEAN;
+    } else if (TYPE_DIST == AG_DIST) {
+        metric = lshbox::BruteForce::ANGULAR;
+    } else if (TYPE_DIST == IP_DIST) {
+        metric = lshbox::BruteForce::PRODUCT;
+    } else {
+        std::cerr << "LINEAR supports the euclidean, angular and product metrics" << std::endl;
+        assert(false);
+        return;
+    }
+    unsigned threads = 1;
+    if (params.find("threads") != params.end()) {
+        threads = std::max(1, std::stoi(params.find("threads")->second));
+    }
+    string benchFile = params.find("benchmark_file")->second;
+    Bencher opqBencher(benchFile.c_str());
+    int numQueries = bench.getQ();
+
+    // the queries in the dimension order of the base, see --reorder_dims
+    const vector<unsigned>& order = data.getDimOrder();
+    unsigned dim = data.getDim();
+    vector<float> queries((size_t)numQueries * dim);
+    for (int i = 0; i < numQueries; ++i) {
+        const DATATYPE* q = query[bench.getQuery(i)];
+        for (unsigned d = 0; d < dim; ++d) {
+            queries[(size_t)i * dim + d] = order.empty() ? q[d] : q[order[d]];
+        }
+    }
+
+    lshbox::wall_timer timer;
+    lshbox::BruteForce engine(&queries[0], numQueries, dim, bench.getK(), metric, threads);
+    engine.add(data.getData(), data.getSize(), 0);
+    double runtime = timer.elapsed();
+
+    vector<vector<pair<unsigned, float>>> benchResult(numQueries);
+    for (int i = 0; i < numQueries; ++i) {
+        benchResult[i] = engine.getTopK(i);
+    }
+    std::cout << "QUERY MODE    , linear, threads " << threads << std::endl;
+    std::cout << "# retrieved items, " << "overall query time, " << "avg recall" << "\n";
+    std::cout << data.getSize() << ", " << runtime << ", "
+        << cal_avg_recall(opqBencher, benchResult, true) << std::endl;
+    std::cout << "throughput, " << (runtime > 0 ? numQueries / runtime : 0) << " queries/s" << std::endl;
 }
 
 
@@ -315,7 +860,68 @@ void search(
         metric,
         bench.getK()
     );
+    if (params.find("early_abandon") != params.end() && params.find("early_abandon")->second == "false") {
+        initScanner.setEarlyAbandon(false);
+    }
+    if (memoryReport(params)) {
+        reportIndexMemory(data, query, mylsh);
+    }
+    // stop a query before its budget: --stop_bound=true once the quantization distance
+    // bound of the next bucket passes the K-th distance (GQR and QR, euclidean), and / or
+    // --patience=P after P buckets in a row that did not improve the result
+    bool stopBound = params.find("stop_bound") != params.end() && params.find("stop_bound")->second == "true";
+    unsigned patience = params.find("patience") != params.end() ? std::stoi(params.find("patience")->second) : 0;
+    if (stopBound || patience != 0) {
+        initScanner.setStopRule(stopBound, patience);
+        std::cout << "STOP RULE    , bound " << (stopBound ? "on" : "off") << ", patience " << patience << std::endl;
+    }
+    // two-stage verification: score candidates on uint8 codes, re-rank the best sq_rerank exactly
+    lshbox::ScalarQuantizer<DATATYPE> sq;
+    if (params.find("sq_rerank") != params.end()) {
+        lshbox::timer timer;
+        sq.train(data);
+        initScanner.setQuantizer(&sq, std::stoi(params.find("sq_rerank")->second));
+        std::cout << "SQ training time, " << timer.elapsed() << ", code bytes, " << sq.bytes() << std::endl;
+    }
+    // or on PQ / OPQ codes by ADC, --pq_rerank=0 reports the approximate distances
+    lshbox::ProductQuantizer<DATATYPE> pq;
+    if (params.find("pq_m") != params.end() || params.find("pq_file") != params.end()) {
+        lshbox::timer timer;
+        auto param = [&params](const string& key, int value) {
+            return params.find(key) != params.end() ? std::stoi(params.find(key)->second) : value;
+        };
+        if (params.find("pq_file") != params.end()) {
+            if (!pq.load(params.find("pq_file")->second, data)) {
+                std::cerr << "cannot use --pq_file, train with --pq_m and save with --pq_save" << std::endl;
+                assert(false);
+                return;
+            }
+        } else {
+            pq.train(data, param("pq_m", 8), param("pq_bits", 8), param("opq_iters", 0),
+                param("pq_train", 65536), param("kmeans_iters", 25));
+        }
+        if (params.find("pq_save") != params.end()) {
+            pq.save(params.find("pq_save")->second);
+        }
+        initScanner.setQuantizer(&pq, param("pq_rerank", 0));
+        std::cout << "PQ training time, " << timer.elapsed() << ", code bytes, " << pq.bytes() << std::endl;
+    }
 
+    if (params.find("tune_recall") != params.end()) {
+        tune(data, query, mylsh, bench, initScanner, params, TYPE_DIST);
+        return;
+    }
+
+    if (queryByFactory(params)
+        && method != "GQR" && method != "HR" && method != "GHR" && method != "HL" && method != "QR") {
+        std::cerr << "table_threads, deadline_ms and reuse_probers support GQR, HR, HL and QR, not " << method << std::endl;
+        assert(false);
+    }
+
+    startTrace(params);
+    if (perfCounters(params)) {
+        lshbox::startPerf();
+    }
     if (method == "GQR") {
         search_gqr(data, query, mylsh, bench, initScanner, params);
     } else if (method == "HR") {
@@ -330,8 +936,14 @@ void search(
         search_agqr(data, query, mylsh, bench, initScanner, params);
     } else if (method == "HOOK") {
         search_hook(data, query, mylsh, bench, initScanner, params);
+    } else if (method == "LINEAR") {
+        search_linear(data, query, bench, params, TYPE_DIST);
     } else {
         std::cerr << "does not exist method " << method << std::endl;
         assert(false);
     }
+    writeTrace(params);
+    if (perfCounters(params)) {
+        reportPerf(bench.getQ());
+    }
 }
@@ -0,0 +1,276 @@
+#pragma once
+#include <lshbox.h>
+#include <lshbox/query/treelookup.h>
+#include <lshbox/query/tableshard.h>
+#include "apps/opq_evaluate.cpp"
+#include "lshbox/bench/bencher.h"
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <unordered_map>
+#include <algorithm>
+
+using std::string;
+using std::unordered_map;
+
+/*
+ * Operating-point tuner, --tune_recall=R: searches query method, probe budget
+ * and stop rule for the setting that reaches an average recall of R on the
+ * queries of the benchmark at the lowest latency, and writes it as a config
+ * file that search loads with --config. All trials share the loaded index.
+ *
+ *   --tune_methods=GQR,HR,HL,QR     query methods to try
+ *   --tune_patience=0,8,32,128      patience values to try, 0 is off
+ *   --tune_step=1.25                ratio between successive probe budgets
+ *   --tune_objective=mean|p99       latency to minimize, mean by default
+ *   --tune_max_ms=M                 reject settings slower than M ms
+ *   --tune_queries=N                tune on the first N queries only
+ *   --tune_output=tuned.cfg         config file to write
+ *
+ * The stop bound is tried for GQR and QR under euclidean distance. Latency
+ * is measured per query on the calling thread, prober construction included.
+ * */
+struct TunePoint {
+    string method;
+    bool stopBound;
+    unsigned patience;
+    unsigned probeItems;
+    float itemsProbed; // average items actually verified
+    float recall;
+    double meanMs;
+    double p99Ms;
+    bool reached;
+
+    double objective(bool p99) const {
+        return p99 ? p99Ms : meanMs;
+    }
+};
+
+/*
+ * One trial: every query gets its own prober, the budgets are probed in
+ * increasing order, each round continuing the last one as in annQuery. Stops
+ * at the first budget whose average recall reaches targetRecall, or once the
+ * objective exceeds maxMs. Fills point with the last budget probed.
+ * */
+template<typename PROBERTYPE, typename DATATYPE, typename LSHTYPE, typename SCANNER, typename FACTORY>
+void tuneTrial(const lshbox::Matrix<DATATYPE>& query, LSHTYPE& mylsh, const lshbox::Benchmark& bench, const Bencher& opqBencher,
+    unsigned numQueries, SCANNER& scanner, FACTORY factory, const vector<unsigned>& budgets,
+    float targetRecall, double maxMs, bool p99, TunePoint& point) {
+
+    vector<unsigned> allTables(mylsh.getNumTables());
+    for (unsigned t = 0; t != allTables.size(); ++t) {
+        allTables[t] = t;
+    }
+    lshbox::HasherShard<LSHTYPE, DATATYPE> shard(mylsh, allTables);
+
+    void* raw_memory = operator new[](sizeof(PROBERTYPE) * numQueries);
+    PROBERTYPE* probers = static_cast<PROBERTYPE*>(raw_memory);
+    vector<double> latencies(numQueries);
+    lshbox::wall_timer timer;
+    for (unsigned i = 0; i != numQueries; ++i) {
+        timer.restart();
+        factory(&probers[i], query[bench.getQuery(i)], shard, scanner);
+        latencies[i] = timer.elapsed();
+    }
+
+    vector<unsigned> numItemProbed(numQueries);
+    vector<vector<pair<unsigned, float>>> benchResult(numQueries);
+    for (unsigned numItems : budgets) {
+        for (unsigned i = 0; i != numQueries; ++i) {
+            timer.restart();
+            mylsh.KItemByProber(query[bench.getQuery(i)], probers[i], numItems);
+            latencies[i] += timer.elapsed();
+        }
+        for (unsigned i = 0; i != numQueries; ++i) {
+            numItemProbed[i] = probers[i].getNumItemsProbed();
+            const vector<pair<float, unsigned>>& src = probers[i].getScanner().genTopk();
+            vector<pair<unsigned, float>>& dst = benchResult[i];
+            dst.resize(src.size());
+            for (int j = 0; j < src.size(); ++j) {
+                dst[j].first = src[j].second;
+                dst[j].second = src[j].first;
+            }
+        }
+        vector<double> sorted(latencies);
+        std::sort(sorted.begin(), sorted.end());
+        double total = 0;
+        for (double latency : latencies) {
+            total += latency;
+        }
+        point.probeItems = numItems;
+        point.itemsProbed = cal_avg(numItemProbed);
+        point.recall = cal_avg_recall(opqBencher, benchResult, true);
+        point.meanMs = total / numQueries * 1000;
+        point.p99Ms = sorted[std::min(numQueries - 1, numQueries * 99 / 100)] * 1000;
+        point.reached = point.recall >= targetRecall;
+        if (point.reached || (maxMs > 0 && point.objective(p99) > maxMs)) {
+            break;
+        }
+    }
+
+    for (unsigned i = 0; i != numQueries; ++i) {
+        probers[i].~PROBERTYPE();
+    }
+    operator delete[](raw_memory);
+}
+
+// runs tuneTrial with the prober of method, see search_gqr and friends
+template<typename DATATYPE, typename LSHTYPE, typename SCANNER>
+void tuneMethod(const string& method, const lshbox::Matrix<DATATYPE>& query, LSHTYPE& mylsh, const lshbox::Benchmark& bench,
+    const Bencher& opqBencher, unsigned numQueries, SCANNER& scanner, const vector<unsigned>& budgets,
+    float targetRecall, double maxMs, bool p99, TunePoint& point) {
+    typedef typename lshbox::Matrix<DATATYPE>::Accessor ACCESSOR;
+    typedef lshbox::HasherShard<LSHTYPE, DATATYPE> SHARD;
+    if (method == "GQR") {
+        typedef TreeLookup<ACCESSOR> GQRT;
+        Tree fvs(mylsh.getCodeLength());
+        auto factory = [&fvs](GQRT* place, const DATATYPE* q, SHARD& shard, SCANNER& scanner) {
+            new(place) GQRT(q, scanner, shard, &fvs);
+        };
+        tuneTrial<GQRT>(query, mylsh, bench, opqBencher, numQueries, scanner, factory, budgets, targetRecall, maxMs, p99, point);
+    } else if (method == "HR") {
+        typedef HammingRanking<ACCESSOR> HRT;
+        auto factory = [](HRT* place, const DATATYPE* q, SHARD& shard, SCANNER& scanner) {
+            new(place) HRT(q, scanner, shard);
+        };
+        tuneTrial<HRT>(query, mylsh, bench, opqBencher, numQueries, scanner, factory, budgets, targetRecall, maxMs, p99, point);
+    } else if (method == "HL" || method == "GHR") {
+        typedef HashLookupPP<ACCESSOR> GHRT;
+        FV fvs(mylsh.getCodeLength());
+        auto factory = [&fvs](GHRT* place, const DATATYPE* q, SHARD& shard, SCANNER& scanner) {
+            new(place) GHRT(q, scanner, shard, &fvs);
+        };
+        tuneTrial<GHRT>(query, mylsh, bench, opqBencher, numQueries, scanner, factory, budgets, targetRecall, maxMs, p99, point);
+    } else if (method == "QR") {
+        typedef LossRanking<ACCESSOR> QR;
+        auto factory = [](QR* place, const DATATYPE* q, SHARD& shard, SCANNER& scanner) {
+            new(place) QR(q, scanner, shard);
+        };
+        tuneTrial<QR>(query, mylsh, bench, opqBencher, numQueries, scanner, factory, budgets, targetRecall, maxMs, p99, point);
+    } else {
+        std::cerr << "tune_recall supports GQR, HR, HL and QR, not " << method << std::endl;
+        assert(false);
+    }
+}
+
+inline vector<string> splitList(const string& list) {
+    vector<string> items;
+    std::istringstream iss(list);
+    string item;
+    while (std::getline(iss, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+template<typename DATATYPE, typename LSHTYPE, typename SCANNER>
+void tune(
+    const lshbox::Matrix<DATATYPE>& data,
+    const lshbox::Matrix<DATATYPE>& query,
+    LSHTYPE& mylsh,
+    const lshbox::Benchmark& bench,
+    const SCANNER& initScanner,
+    const unordered_map<string, string>& params,
+    const unsigned TYPE_DIST) {
+
+    auto param = [&params](const string& key, const string& value) {
+        return params.find(key) != params.end() ? params.find(key)->second : value;
+    };
+    float targetRecall = std::stof(params.find("tune_recall")->second);
+    vector<string> methods = splitList(param("tune_methods", "GQR,HR,HL,QR"));
+    vector<unsigned> patiences;
+    for (const string& p : splitList(param("tune_patience", "0,8,32,128"))) {
+        patiences.push_back(std::stoi(p));
+    }
+    double step = std::max(1.01, std::stod(param("tune_step", "1.25")));
+    bool p99 = param("tune_objective", "mean") == "p99";
+    double maxMs = std::stod(param("tune_max_ms", "0"));
+    unsigned numQueries = std::min<unsigned>(bench.getQ(), std::stoi(param("tune_queries", std::to_string(bench.getQ()))));
+    string output = param("tune_output", "tuned.cfg");
+    if (numQueries == 0 || methods.empty() || patiences.empty()) {
+        std::cerr << "tune_recall needs queries, tune_methods and tune_patience" << std::endl;
+        assert(false);
+    }
+
+    // geometric budgets from K up to the whole base
+    vector<unsigned> budgets;
+    unsigned numAllItems = data.getSize();
+    for (double numItems = std::max<unsigned>(1, bench.getK()); ; numItems *= step) {
+        unsigned budget = std::min<unsigned>(numAllItems, (unsigned)numItems);
+        if (budgets.empty() || budget != budgets.back()) {
+            budgets.push_back(budget);
+        }
+        if (budget == numAllItems)
+            break;
+    }
+
+    Bencher opqBencher(params.find("benchmark_file")->second.c_str());
+    std::cout << "TUNE    , recall " << targetRecall << ", objective " << (p99 ? "p99" : "mean") << " latency"
+        << (maxMs > 0 ? ", at most " + std::to_string(maxMs) + " ms" : string()) << ", "
+        << numQueries << " queries, " << budgets.size() << " budgets" << std::endl;
+    std::cout << "method, stop bound, patience, probe items, avg items, avg recall, mean ms, p99 ms" << std::endl;
+
+    lshbox::wall_timer tuneTimer;
+    vector<TunePoint> points;
+    for (const string& method : methods) {
+        vector<bool> bounds(1, false);
+        if ((method == "GQR" || method == "QR") && TYPE_DIST == L2_DIST) {
+            bounds.push_back(true);
+        }
+        for (bool bound : bounds) {
+            for (unsigned patience : patiences) {
+                SCANNER scanner = initScanner;
+                scanner.setStopRule(bound, patience);
+                TunePoint point;
+                point.method = method;
+                point.stopBound = bound;
+                point.patience = patience;
+                tuneMethod(method, query, mylsh, bench, opqBencher, numQueries, scanner, budgets, targetRecall, maxMs, p99, point);
+                std::cout << method << ", " << (bound ? "on" : "off") << ", " << patience << ", "
+                    << point.probeItems << ", " << point.itemsProbed << ", " << point.recall << ", "
+                    << point.meanMs << ", " << point.p99Ms << (point.reached ? "" : ", target missed") << std::endl;
+                points.push_back(point);
+            }
+        }
+    }
+
+    // the fastest setting at the target recall within tune_max_ms, otherwise
+    // the one of the highest recall
+    const TunePoint* best = NULL;
+    for (const TunePoint& point : points) {
+        if (!point.reached || (maxMs > 0 && point.objective(p99) > maxMs)) {
+            continue;
+        }
+        if (best == NULL || point.objective(p99) < best->objective(p99)) {
+            best = &point;
+        }
+    }
+    if (best == NULL) {
+        std::cout << "no setting reaches recall " << targetRecall << ", taking the highest recall" << std::endl;
+        for (const TunePoint& point : points) {
+            if (best == NULL || point.recall > best->recall) {
+                best = &point;
+            }
+        }
+    }
+    std::cout << "tuning time, " << tuneTimer.elapsed() << " s" << std::endl;
+    std::cout << "TUNED    , " << best->method << ", stop bound " << (best->stopBound ? "on" : "off")
+        << ", patience " << best->patience << ", probe items " << best->probeItems
+        << ", recall " << best->recall << ", mean ms " << best->meanMs << ", p99 ms " << best->p99Ms << std::endl;
+
+    std::ofstream fout(output.c_str());
+    if (!fout) {
+        std::cerr << "cannot write tune_output " << output << std::endl;
+        assert(false);
+    }
+    fout << "# written by search --tune_recall=" << targetRecall << " for " << param("model_file", "") << std::endl;
+    fout << "# recall " << best->recall << ", mean ms " << best->meanMs << ", p99 ms " << best->p99Ms
+        << " on " << numQueries << " queries" << std::endl;
+    fout << "query_method=" << best->method << std::endl;
+    fout << "probe_items=" << best->probeItems << std::endl;
+    fout << "stop_bound=" << (best->stopBound ? "true" : "false") << std::endl;
+    fout << "patience=" << best->patience << std::endl;
+    std::cout << "config written to " << output << ", load it with --config=" << output << std::endl;
+}
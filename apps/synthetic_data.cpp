@@ -0,0 +1,332 @@
+// synthetic workload generator: a base and held-out queries drawn from one
+// Gaussian mixture of controllable structure, written as fvecs (or the
+// Matrix::save layout), and the exact ground truth of the queries in .lshbox
+// and .ivecs. The base is generated block by block on all threads and
+// streamed through the ground truth, so it never has to be in memory.
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <unordered_map>
+#include <algorithm>
+
+#include <eigen/Eigen/Dense>
+#include "lshbox/utils.h"
+#include "lshbox/basis.h"
+#include "gqr/util/cal_groundtruth.h"
+#include "gqr/util/bruteforce.h"
+
+using std::string;
+using std::vector;
+using std::unordered_map;
+
+typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMatrix;
+
+struct Options {
+    unsigned dim;
+    unsigned intrinsicDim; // rank of the subspace the clusters live in
+    unsigned clusters;
+    float anisotropy;      // largest over smallest axis of a cluster
+    float centerSpread;    // std of the cluster centers
+    float noise;           // std of the isotropic noise in all dim dimensions
+    float normSkew;        // std of the log of the scale of a base vector
+    unsigned seed;
+    unsigned threads;
+};
+
+/*
+ * The mixture: the centers and the axes of every cluster lie in one random
+ * intrinsicDim-dimensional subspace of the space. A cluster is a Gaussian
+ * whose std along the axes of the subspace falls geometrically from 1 to
+ * 1 / anisotropy, in an order of the axes of its own, so the clusters are
+ * stretched in different directions. Isotropic noise then gives the data
+ * full rank, and the base vectors are scaled by a log-normal factor so that
+ * their norms are skewed as inner product search expects.
+ * */
+class Mixture {
+public:
+    explicit Mixture(const Options& opt) : opt_(opt) {
+        const unsigned r = opt_.intrinsicDim;
+        std::mt19937_64 rng(opt_.seed);
+        std::normal_distribution<float> normal(0, 1);
+        // orthonormal basis of the subspace, r x dim
+        Eigen::MatrixXf gauss(opt_.dim, r);
+        for (unsigned i = 0; i < opt_.dim; ++i) {
+            for (unsigned j = 0; j < r; ++j) {
+                gauss(i, j) = normal(rng);
+            }
+        }
+        Eigen::HouseholderQR<Eigen::MatrixXf> qr(gauss);
+        basis_ = (qr.householderQ() * Eigen::MatrixXf::Identity(opt_.dim, r)).transpose();
+
+        centers_.resize(opt_.clusters, r);
+        scales_.resize(opt_.clusters, r);
+        vector<unsigned> axes(r);
+        for (unsigned c = 0; c < opt_.clusters; ++c) {
+            for (unsigned j = 0; j < r; ++j) {
+                centers_(c, j) = opt_.centerSpread * normal(rng);
+                axes[j] = j;
+            }
+            std::shuffle(axes.begin(), axes.end(), rng);
+            for (unsigned j = 0; j < r; ++j) {
+                scales_(c, axes[j]) = r > 1 ? std::pow(opt_.anisotropy, -(float)j / (r - 1)) : 1;
+            }
+        }
+    }
+
+    /*
+     * vectors first .. first + n - 1 of a stream into rows (n x dim). The ids
+     * are split into blocks at absolute multiples of BLOCK, each drawn from a
+     * generator seeded by the seed, the stream and its block index, so the
+     * vectors depend on the seed, stream and id only, not on how the ids are
+     * batched or on the threads that generate them
+     * */
+    void generate(float* rows, unsigned n, unsigned stream, unsigned long long first, bool skewNorms) const {
+        if (n == 0) {
+            return;
+        }
+        const unsigned long long block0 = first / BLOCK;
+        const unsigned numBlocks = (first + n - 1) / BLOCK - block0 + 1;
+        std::atomic<unsigned> nextBlock(0);
+        auto work = [&]() {
+            RowMatrix latent;
+            vector<float> partial;
+            unsigned b;
+            while ((b = nextBlock++) < numBlocks) {
+                const unsigned long long id0 = (block0 + b) * BLOCK;
+                const unsigned long long begin = std::max(first, id0);
+                const unsigned long long end = std::min(first + n, id0 + BLOCK);
+                float* out = rows + (size_t)(begin - first) * opt_.dim;
+                if (begin == id0 && end == id0 + BLOCK) {
+                    generateBlock(out, block0 + b, stream, skewNorms, latent);
+                } else {
+                    // a block cut by first or first + n, drawn whole
+                    partial.resize((size_t)BLOCK * opt_.dim);
+                    generateBlock(partial.data(), block0 + b, stream, skewNorms, latent);
+                    std::copy(partial.begin() + (size_t)(begin - id0) * opt_.dim,
+                        partial.begin() + (size_t)(end - id0) * opt_.dim, out);
+                }
+            }
+        };
+        unsigned numThreads = std::max(1u, std::min(opt_.threads, numBlocks));
+        if (numThreads == 1) {
+            work();
+            return;
+        }
+        vector<std::thread> threads;
+        for (unsigned t = 0; t < numThreads; ++t) {
+            threads.push_back(std::thread(work));
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+private:
+    enum : unsigned { BLOCK = 4096 };
+
+    // the BLOCK vectors of block index of a stream into rows (BLOCK x dim)
+    void generateBlock(float* rows, unsigned long long index, unsigned stream, bool skewNorms, RowMatrix& latent) const {
+        const unsigned r = opt_.intrinsicDim;
+        std::seed_seq seq{opt_.seed, stream, (unsigned)index, (unsigned)(index >> 32)};
+        std::mt19937_64 rng(seq);
+        std::normal_distribution<float> normal(0, 1);
+        std::uniform_int_distribution<unsigned> pick(0, opt_.clusters - 1);
+        latent.resize(BLOCK, r);
+        for (unsigned i = 0; i < BLOCK; ++i) {
+            unsigned c = pick(rng);
+            for (unsigned j = 0; j < r; ++j) {
+                latent(i, j) = centers_(c, j) + scales_(c, j) * normal(rng);
+            }
+        }
+        Eigen::Map<RowMatrix> out(rows, BLOCK, opt_.dim);
+        out.noalias() = latent * basis_;
+        for (unsigned i = 0; i < BLOCK; ++i) {
+            float* row = rows + (size_t)i * opt_.dim;
+            if (opt_.noise > 0) {
+                for (unsigned j = 0; j < opt_.dim; ++j) {
+                    row[j] += opt_.noise * normal(rng);
+                }
+            }
+            if (skewNorms && opt_.normSkew > 0) {
+                float scale = std::exp(opt_.normSkew * normal(rng));
+                for (unsigned j = 0; j < opt_.dim; ++j) {
+                    row[j] *= scale;
+                }
+            }
+        }
+    }
+
+    Options opt_;
+    RowMatrix basis_;   // intrinsicDim x dim
+    RowMatrix centers_; // clusters x intrinsicDim
+    RowMatrix scales_;  // clusters x intrinsicDim
+};
+
+/*
+ * rows in fvecs, or in the layout of Matrix::save: the header sizeof(float),
+ * size, dim, then the rows without headers
+ * */
+class VectorFile {
+public:
+    VectorFile(const string& path, bool native, unsigned size, unsigned dim)
+        : native_(native), dim_(dim) {
+        if (native_) {
+            raw_.open(path.c_str(), std::ios::binary);
+            if (!raw_) {
+                std::cerr << "cannot create file " << path << std::endl;
+                assert(false);
+            }
+            unsigned header[3] = {sizeof(float), size, dim};
+            raw_.write((char*)header, sizeof(header));
+        } else {
+            fvecs_.reset(new lshbox::FvecsWriter(path));
+        }
+    }
+
+    void write(const float* rows, unsigned n) {
+        if (native_) {
+            raw_.write((const char*)rows, sizeof(float) * (size_t)n * dim_);
+            return;
+        }
+        for (unsigned i = 0; i < n; ++i) {
+            fvecs_->write(rows + (size_t)i * dim_, dim_);
+        }
+    }
+
+private:
+    bool native_;
+    unsigned dim_;
+    std::ofstream raw_;
+    std::unique_ptr<lshbox::FvecsWriter> fvecs_;
+};
+
+/*
+ * whether the first n base vectors are the same bytes when generated in
+ * one call and in batches of a few sizes that are not multiples of a block
+ * */
+static bool sameInBatches(const Mixture& mixture, unsigned n, unsigned dim) {
+    vector<float> whole((size_t)n * dim);
+    mixture.generate(whole.data(), n, 0, 0, true);
+    const unsigned sizes[] = {1000, 4097, 200000};
+    for (unsigned size : sizes) {
+        vector<float> batched((size_t)n * dim);
+        for (unsigned first = 0; first < n; first += size) {
+            unsigned m = std::min(size, n - first);
+            mixture.generate(batched.data() + (size_t)first * dim, m, 0, first, true);
+        }
+        if (std::memcmp(whole.data(), batched.data(), sizeof(float) * whole.size()) != 0) {
+            std::cerr << "batches of " << size << " differ from one batch" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+template<typename T>
+static T param(const unordered_map<string, string>& params, const string& key, T value) {
+    auto it = params.find(key);
+    if (it == params.end()) {
+        return value;
+    }
+    std::istringstream iss(it->second);
+    iss >> value;
+    return value;
+}
+
+int main(int argc, const char **argv)
+{
+    unordered_map<string, string> params = lshbox::parseParams(argc, argv);
+    if (params.find("output") == params.end()) {
+        std::cerr << "Usage: "
+            << "./synthetic_data "
+            << "--output=dir/name "
+            << "[--num_items=1000000] [--num_queries=1000] [--dim=128] [--intrinsic_dim=dim] "
+            << "[--clusters=100] [--anisotropy=1] [--center_spread=4] [--noise=0.1] [--norm_skew=0] "
+            << "[--topk=20] [--metric=euclidean|angular|product] [--format=fvecs|native] "
+            << "[--seed=time] [--threads=cores] [--batch=200000] [--check_batches=0]"
+            << std::endl;
+        return -1;
+    }
+    const string output = params["output"];
+    const unsigned numItems = param<unsigned>(params, "num_items", 1000000);
+    const unsigned numQueries = param<unsigned>(params, "num_queries", 1000);
+    const unsigned topk = param<unsigned>(params, "topk", 20);
+    const string metric = param<string>(params, "metric", "euclidean");
+    const string format = param<string>(params, "format", "fvecs");
+    Options opt;
+    opt.dim = param<unsigned>(params, "dim", 128);
+    opt.intrinsicDim = std::max(1u, std::min(opt.dim, param<unsigned>(params, "intrinsic_dim", opt.dim)));
+    opt.clusters = std::max(1u, param<unsigned>(params, "clusters", 100));
+    opt.anisotropy = std::max(1.0f, param<float>(params, "anisotropy", 1));
+    opt.centerSpread = param<float>(params, "center_spread", 4);
+    opt.noise = param<float>(params, "noise", 0.1);
+    opt.normSkew = param<float>(params, "norm_skew", 0);
+    opt.seed = param<unsigned>(params, "seed", std::time(0));
+    opt.threads = std::max(1u, param<unsigned>(params, "threads", std::thread::hardware_concurrency()));
+    if (format != "fvecs" && format != "native") {
+        std::cerr << "synthetic_data does not support format " << format << std::endl;
+        return -1;
+    }
+    const unsigned batch = std::max(1u, param<unsigned>(params, "batch", 200000));
+    const bool native = format == "native";
+    const string suffix = native ? ".bin" : ".fvecs";
+
+    lshbox::wall_timer timer;
+    Mixture mixture(opt);
+    if (param<int>(params, "check_batches", 0) != 0) {
+        // the output must not depend on --batch
+        if (!sameInBatches(mixture, std::min(numItems, 300000u), opt.dim)) {
+            return -1;
+        }
+        std::cout << "batches, same output for every batch size" << std::endl;
+    }
+    // queries first, a stream of their own, so they are not items of the base
+    vector<float> queries((size_t)numQueries * opt.dim);
+    mixture.generate(queries.data(), numQueries, 1, 0, false);
+    {
+        VectorFile queryFile(output + "_query" + suffix, native, numQueries, opt.dim);
+        queryFile.write(queries.data(), numQueries);
+    }
+
+    std::unique_ptr<lshbox::BruteForce> engine;
+    if (topk > 0 && numQueries > 0) {
+        engine.reset(new lshbox::BruteForce(queries.data(), numQueries, opt.dim, topk,
+            lshbox::BruteForce::parseMetric(metric), opt.threads));
+    }
+    VectorFile baseFile(output + "_base" + suffix, native, numItems, opt.dim);
+    vector<float> items;
+    for (unsigned first = 0; first < numItems; first += batch) {
+        unsigned n = std::min(batch, numItems - first);
+        items.resize((size_t)n * opt.dim);
+        mixture.generate(items.data(), n, 0, first, true);
+        baseFile.write(items.data(), n);
+        if (engine) {
+            engine->add(items.data(), n, first);
+        }
+        std::cout << first + n << " items have been generated" << std::endl;
+    }
+
+    if (engine) {
+        vector<vector<lshbox::IdAndDstPair>> topks(numQueries);
+        for (unsigned i = 0; i < numQueries; ++i) {
+            for (const auto& item : engine->getTopK(i)) {
+                topks[i].push_back(lshbox::IdAndDstPair(item.first, item.second));
+            }
+        }
+        lshbox::GroundWriter writer;
+        writer.writeLSHBOX((output + "_groundtruth.lshbox").c_str(), topks, topk);
+        writer.writeIVECS((output + "_groundtruth.ivecs").c_str(), topks, topk);
+    }
+    std::cout << "SYNTHETIC    , " << numItems << " items, " << numQueries << " queries, dim " << opt.dim
+        << ", intrinsic dim " << opt.intrinsicDim << ", " << opt.clusters << " clusters, anisotropy "
+        << opt.anisotropy << ", norm skew " << opt.normSkew << ", seed " << opt.seed << ", "
+        << timer.elapsed() << " s" << std::endl;
+    return 0;
+}
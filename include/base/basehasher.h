@@ -6,8 +6,15 @@
 #include <sstream>
 #include <functional>
 #include <unordered_map>
+#include <assert.h>
 #include "gqr/util/gqrhash.h"
 #include "gqr/util/io.h"
+#include "lshbox/simd/distance.h"
+#include "lshbox/basis.h"
+#include "lshbox/memory.h"
+#include "lshbox/trace.h"
+#include "lshbox/perfcounters.h"
+#include "lshbox/counters.h"
 using std::vector;
 using std::unordered_map;
 using std::string;
@@ -32,6 +39,18 @@ using lshbox::gqrhash;
 
 namespace lshbox {
 
+/*
+ * Where a query stands in KItemByProber, so that probeStep() can run it in
+ * small steps interleaved with other queries.
+ * */
+struct ProbeState {
+    enum Stage {LOOKUP, FETCH, SCAN, DONE};
+    Stage stage;
+    // items of the bucket found by the last LOOKUP
+    const vector<unsigned>* items;
+    ProbeState(): stage(LOOKUP), items(NULL) {}
+};
+
 template<typename DATATYPE = float, typename BIDTYPE = unsigned long long>
 class BaseHasher {
 public:
@@ -48,6 +67,9 @@ public:
 
     virtual BIDTYPE getBuckets(unsigned tb, const DATATYPE *domin) const = 0;
 
+    // buckets of all tables, hashers that transform the query override this to transform it once
+    virtual vector<BIDTYPE> getAllBuckets(const DATATYPE *domin) const;
+
     vector<unsigned> getAllTableSize() const;
 
     vector<unsigned> getAllMaxBucketSize() const;
@@ -64,13 +86,40 @@ public:
 
     unsigned getNumTables() const;
 
+    const unordered_map<BIDTYPE, vector<unsigned>, gqrhash<BIDTYPE>>& getTable(unsigned t) const;
+
+    // keys, postings and map overhead of table t, see lshbox::tableMemory
+    lshbox::TableMemory getTableMemory(unsigned t) const {
+        return lshbox::tableMemory(tables[t]);
+    }
+
+    // bytes of the model parameters, 0 if the hasher does not report them
+    virtual size_t modelBytes() const {
+        return 0;
+    }
+
     template<typename PROBER>
     int probe(unsigned t, BIDTYPE bucketId, PROBER &prober);
 
     template<typename PROBER>
     void KItemByProber(const DATATYPE *domin, PROBER &prober, int numItems);
 
+    // one step of KItemByProber, returns false once the query is done
+    template<typename PROBER>
+    bool probeStep(ProbeState& state, PROBER &prober, int numItems);
+
+    // KItemByProber that also stops at due, returns true if cut short by it
+    template<typename PROBER>
+    bool KItemByDeadline(const DATATYPE *domin, PROBER &prober, int numItems, const lshbox::deadline& due, unsigned checkEvery);
+
 protected:
+    // getNextBID() counted as the generate phase, see lshbox/perfcounters.h
+    template<typename PROBER>
+    static std::pair<unsigned, BIDTYPE> nextBucket(PROBER &prober) {
+        lshbox::PerfScope scope(lshbox::PerfCounters::GENERATE);
+        return prober.getNextBID();
+    }
+
     vector<vector<float>> loadFloatMatrixTranspose(ifstream& fin, unsigned numLine, unsigned dimension) const ;
 
     vector<float> loadFloatVector(ifstream& fin, unsigned dimension) const;
@@ -87,6 +136,15 @@ protected:
 };
 
 //--------------------- Implementations ------------------
+template<typename DATATYPE, typename BIDTYPE>
+vector<BIDTYPE> BaseHasher<DATATYPE, BIDTYPE>::getAllBuckets(const DATATYPE *domin) const {
+    vector<BIDTYPE> buckets(tables.size());
+    for (unsigned tb = 0; tb < buckets.size(); ++tb) {
+        buckets[tb] = getBuckets(tb, domin);
+    }
+    return buckets;
+}
+
 template<typename DATATYPE, typename BIDTYPE>
 vector<unsigned> BaseHasher<DATATYPE, BIDTYPE>::getAllTableSize() const {
     vector<unsigned> vec;
@@ -145,31 +203,119 @@ unsigned BaseHasher<DATATYPE, BIDTYPE>::getNumTables() const {
     return this->tables.size();
 }
 
+template<typename DATATYPE, typename BIDTYPE>
+const unordered_map<BIDTYPE, vector<unsigned>, gqrhash<BIDTYPE>>& BaseHasher<DATATYPE, BIDTYPE>::getTable(unsigned t) const {
+    return this->tables[t];
+}
+
 
 template<typename DATATYPE, typename BIDTYPE>
 template<typename PROBER>
 int BaseHasher<DATATYPE, BIDTYPE>::probe(unsigned t, BIDTYPE bucketId, PROBER& prober) {
-    int numProbed = 0;
-    if (this->tables[t].find(bucketId) != this->tables[t].end())
-    {
-        numProbed = this->tables[t][bucketId].size();
-        for (std::vector<unsigned>::iterator iter = this->tables[t][bucketId].begin(); iter != this->tables[t][bucketId].end(); ++iter)
-        {
-            prober(*iter);
-        }
+    lshbox::PerfScope scope(lshbox::PerfCounters::VERIFY);
+    lshbox::TraceSpan span(lshbox::Trace::PROBE, t);
+    typename unordered_map<BIDTYPE, vector<unsigned>, gqrhash<BIDTYPE>>::const_iterator it = this->tables[t].find(bucketId);
+    lshbox::Counters& counters = prober.counters();
+    counters.count(lshbox::Counters::BUCKETS_PROBED);
+    counters.countTable(t);
+    if (it == this->tables[t].end() || it->second.empty()) {
+        counters.count(lshbox::Counters::BUCKETS_EMPTY);
+        return 0;
     }
-    return numProbed;
+    const vector<unsigned>& items = it->second;
+    span.setArg(1, items.size());
+    prober.probeItems(&items[0], items.size());
+    return items.size();
 }
 
 template<typename DATATYPE, typename BIDTYPE>
 template<typename PROBER>
 void BaseHasher<DATATYPE, BIDTYPE>::KItemByProber(const DATATYPE *domin, PROBER &prober, int numItems) {
 
+    prober.resumeTrace();
+    lshbox::TraceSpan span(lshbox::Trace::QUERY, numItems);
     while(prober.getNumItemsProbed() < numItems && prober.nextBucketExisted()) {
         // <table, bucketId>
-        const std::pair<unsigned, BIDTYPE>& probePair = prober.getNextBID();
+        const std::pair<unsigned, BIDTYPE> probePair = nextBucket(prober);
+        probe(probePair.first, probePair.second, prober); 
+    }
+    span.setArg(1, prober.getNumItemsProbed());
+}
+
+/*
+ * The clock is read before every checkEvery-th bucket, so a query overruns
+ * due by at most the time of checkEvery buckets. The results found so far
+ * stay in the scanner of the prober, see Scanner::partialTopk.
+ * */
+template<typename DATATYPE, typename BIDTYPE>
+template<typename PROBER>
+bool BaseHasher<DATATYPE, BIDTYPE>::KItemByDeadline(const DATATYPE *domin, PROBER &prober, int numItems, const lshbox::deadline& due, unsigned checkEvery) {
+
+    prober.resumeTrace();
+    lshbox::TraceSpan span(lshbox::Trace::QUERY, numItems);
+    unsigned sinceCheck = 0;
+    while(prober.getNumItemsProbed() < numItems && prober.nextBucketExisted()) {
+        if (++sinceCheck >= checkEvery) {
+            sinceCheck = 0;
+            if (due.passed()) {
+                span.setArg(1, prober.getNumItemsProbed());
+                return true;
+            }
+        }
+        const std::pair<unsigned, BIDTYPE> probePair = nextBucket(prober);
         probe(probePair.first, probePair.second, prober); 
     }
+    span.setArg(1, prober.getNumItemsProbed());
+    return false;
+}
+
+/*
+ * Probes the same buckets as KItemByProber, but every step only starts a
+ * memory access and returns: LOOKUP finds the next bucket and prefetches its
+ * item list, FETCH prefetches the rows of the items, SCAN verifies them.
+ * Stepping several queries in turn keeps their accesses in flight together.
+ * */
+template<typename DATATYPE, typename BIDTYPE>
+template<typename PROBER>
+bool BaseHasher<DATATYPE, BIDTYPE>::probeStep(ProbeState& state, PROBER &prober, int numItems) {
+    // steps of several queries interleave on the thread
+    prober.resumeTrace();
+    switch (state.stage) {
+    case ProbeState::LOOKUP: {
+        if (!(prober.getNumItemsProbed() < numItems && prober.nextBucketExisted())) {
+            state.stage = ProbeState::DONE;
+            return false;
+        }
+        const std::pair<unsigned, BIDTYPE> probePair = nextBucket(prober);
+        lshbox::PerfScope scope(lshbox::PerfCounters::VERIFY);
+        typename unordered_map<BIDTYPE, vector<unsigned>, gqrhash<BIDTYPE>>::const_iterator it = this->tables[probePair.first].find(probePair.second);
+        prober.counters().count(lshbox::Counters::BUCKETS_PROBED);
+        prober.counters().countTable(probePair.first);
+        if (it != this->tables[probePair.first].end() && !it->second.empty()) {
+            state.items = &it->second;
+            lshbox::traceInstant(lshbox::Trace::PROBE, probePair.first, it->second.size());
+            simd::prefetch(&it->second[0], sizeof(unsigned) * it->second.size());
+            state.stage = ProbeState::FETCH;
+        } else {
+            prober.counters().count(lshbox::Counters::BUCKETS_EMPTY);
+        }
+        return true;
+    }
+    case ProbeState::FETCH: {
+        lshbox::PerfScope scope(lshbox::PerfCounters::VERIFY);
+        prober.prefetchItems(&(*state.items)[0], state.items->size());
+        state.stage = ProbeState::SCAN;
+        return true;
+    }
+    case ProbeState::SCAN: {
+        lshbox::PerfScope scope(lshbox::PerfCounters::VERIFY);
+        prober.probeItems(&(*state.items)[0], state.items->size());
+        state.stage = ProbeState::LOOKUP;
+        return true;
+    }
+    default:
+        return false;
+    }
 }
 
 /*
@@ -1,6 +1,11 @@
 #pragma once
 #include <cmath>
+#include <limits>
 #include "lshbox/utils.h"
+#include "lshbox/arena.h"
+#include "lshbox/counters.h"
+#include "lshbox/trace.h"
+#include "lshbox/perfcounters.h"
 template<typename ACCESSOR, typename BIDTYPE>
 class BaseProber {
 public:
@@ -12,16 +17,40 @@ public:
         lshbox::Scanner<ACCESSOR>& scanner,
         LSHTYPE& mylsh) : scanner_(scanner) {
 
+        // left current, so that the spans of derived constructors go to the query
+        traceId_ = lshbox::beginTraceQuery();
+
         // initialize scanner_, this->hashBits_, and this->R_
         scanner_.reset(domin);
 
-        buckets_.resize(mylsh.tables.size());
-        for (unsigned tb = 0; tb < buckets_.size(); ++tb) {
-            buckets_[tb] = mylsh.getBuckets(tb, domin);
-        }
+        buckets_ = hashQuery(domin, mylsh);
         R_ = mylsh.getCodeLength();
 
         totalItems_ = mylsh.getBaseSize();
+        resetStopRule();
+    }
+
+    // the counters of the last query go to the thread that destroys the prober
+    ~BaseProber() {
+        flushCounters();
+    }
+
+    /*
+     * start over with a new query, as if constructed again, so that one
+     * prober can serve many queries. Frees arena_ in O(1), derived probers
+     * must drop everything they keep on it before calling this.
+     * */
+    template<typename LSHTYPE>
+    void reset(const DATATYPE* domin, LSHTYPE& mylsh) {
+        flushCounters();
+        traceId_ = lshbox::beginTraceQuery();
+        scanner_.reset(domin);
+        buckets_ = hashQuery(domin, mylsh);
+        R_ = mylsh.getCodeLength();
+        totalItems_ = mylsh.getBaseSize();
+        numBucketsProbed_ = 0;
+        arena_.reset();
+        resetStopRule();
     }
 
     lshbox::Scanner<ACCESSOR>& getScanner(){
@@ -32,10 +61,51 @@ public:
         return scanner_.cnt();
     }
 
+    /*
+     * hot-path events of the current query, see lshbox/counters.h. Buckets
+     * generated are added when the query is flushed, as numBucketsProbed_
+     * already counts them.
+     * */
+    lshbox::Counters& counters() {
+        return scanner_.counters();
+    }
+
+    // counters of the current query, buckets generated included
+    lshbox::Counters queryCounters() {
+        lshbox::Counters counters = scanner_.counters();
+        counters.count(lshbox::Counters::BUCKETS_GENERATED, numBucketsProbed_);
+        return counters;
+    }
+
+    // trace id of the query, -1 if it is not sampled, see lshbox/trace.h
+    int traceId() const {
+        return traceId_;
+    }
+
+    // make the query the current trace of the calling thread again
+    void resumeTrace() const {
+        if (lshbox::traceEnabled())
+            lshbox::currentTrace() = traceId_;
+    }
+
     virtual void operator()(unsigned key){
         scanner_(key);
     }
 
+    /*
+     * probe the items of a bucket, same as operator() on each of them but
+     * verified in batches by the scanner. Probers that override operator()
+     * must override this as well.
+     * */
+    virtual void probeItems(const unsigned* keys, unsigned n) {
+        scanner_.scan(keys, n);
+    }
+
+    // hint the data probeItems() is going to read
+    void prefetchItems(const unsigned* keys, unsigned n) const {
+        scanner_.prefetch(keys, n);
+    }
+
     /*
      * return (unvisited, distance)
      * if unvisited = false, variable distance has no meaning
@@ -46,18 +116,32 @@ public:
 
     virtual bool nextBucketExisted() {
         if (getNumItemsProbed() < totalItems_)
-            return true;
+            return !stopEarly();
         else return false;
     }
 
+    /*
+     * lower bound on the squared L2 distance of the items in the bucket
+     * getNextBID() returns next, 0 if the prober knows none. Used by the stop
+     * rule of the scanner, see Scanner::setStopRule.
+     * */
+    virtual float nextBucketBound() {
+        return 0;
+    }
+
     virtual std::pair<unsigned, BIDTYPE> getNextBID() = 0; 
 
-    float calL2Norm(const DATATYPE* domin) {
-        float sum = 0;
-        for (int i = 0; i < R_; ++i) {
-            sum += domin[i] * domin[i];
-        }
-        return sqrt(sum);
+    /*
+     * bytes of the per-query state: the arena (e.g. HRTable, LRTable and
+     * TSTable), the buckets of the query and the scanner
+     * */
+    virtual size_t memoryBytes() const {
+        return arena_.capacity() + lshbox::heapBytes(buckets_) + scanner_.memoryBytes();
+    }
+
+    // L2 norm of the query, computed once by the scanner
+    float queryNorm() const {
+        return scanner_.queryNorm();
     }
     
     void reportCDD(){
@@ -72,8 +156,68 @@ protected:
     unsigned int numBucketsProbed_ = 0;
     unsigned R_; // code length
     std::vector<BIDTYPE> buckets_; // L hash tables
+    lshbox::Arena arena_; // per-query state whose size depends on the tables
 
 private:
     lshbox::Scanner<ACCESSOR> scanner_;
     unsigned totalItems_; // 
+    int traceId_;
+
+    // state of the stop rule, stopped_ is sticky for the query
+    bool stopped_;
+    unsigned sinceImproved_; // buckets probed since the TopK last improved
+    unsigned lastProbed_;
+    unsigned lastSize_;
+    float lastThreshold_;
+
+    template<typename LSHTYPE>
+    std::vector<BIDTYPE> hashQuery(const DATATYPE* domin, LSHTYPE& mylsh) {
+        lshbox::PerfScope scope(lshbox::PerfCounters::ENCODE);
+        lshbox::TraceSpan span(lshbox::Trace::HASH);
+        std::vector<BIDTYPE> buckets = mylsh.getAllBuckets(domin);
+        span.setArg(0, buckets.size());
+        return buckets;
+    }
+
+    // add the current query to the counters of the calling thread
+    void flushCounters() {
+        if (lshbox::COUNTERS_ENABLED) {
+            lshbox::threadCounters().add(queryCounters());
+            scanner_.counters().clear();
+        }
+    }
+
+    void resetStopRule() {
+        stopped_ = false;
+        sinceImproved_ = 0;
+        lastProbed_ = 0;
+        lastSize_ = 0;
+        lastThreshold_ = std::numeric_limits<float>::infinity();
+    }
+
+    /*
+     * called before every bucket, the TopK has changed since the last call
+     * iff the last bucket improved it
+     * */
+    bool stopEarly() {
+        if (stopped_)
+            return true;
+        if (scanner_.stopOnBound() && nextBucketBound() > scanner_.l2Threshold()) {
+            stopped_ = true;
+            return true;
+        }
+        if (scanner_.patience() != 0 && numBucketsProbed_ != lastProbed_) {
+            lastProbed_ = numBucketsProbed_;
+            const lshbox::Topk& topk = scanner_.candidates();
+            if (topk.size() != lastSize_ || topk.threshold() < lastThreshold_) {
+                lastSize_ = topk.size();
+                lastThreshold_ = topk.threshold();
+                sinceImproved_ = 0;
+            } else if (++sinceImproved_ >= scanner_.patience()) {
+                stopped_ = true;
+                return true;
+            }
+        }
+        return false;
+    }
 };
@@ -0,0 +1,155 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "base/basehasher.h"
+using std::vector;
+
+namespace lshbox {
+
+/*
+ * Runs the probers of the queries ids up to numItems items.
+ *
+ * With group > 1, group queries are kept open at once and advanced one
+ * probeStep() each in turn: every step issues a prefetch and moves on to the
+ * next query, so one thread has the memory accesses of group queries in
+ * flight instead of waiting on each in turn. A finished query is replaced by
+ * the next id. The probed items and results are those of KItemByProber.
+ * */
+template<typename LSHTYPE, typename PROBER, typename DATATYPE>
+void probeQueries(
+    LSHTYPE& mylsh,
+    PROBER* probers,
+    const vector<const DATATYPE*>& queries,
+    const vector<unsigned>& ids,
+    int numItems,
+    unsigned group) {
+
+    if (group <= 1) {
+        for (unsigned i : ids) {
+            mylsh.KItemByProber(queries[i], probers[i], numItems);
+        }
+        return;
+    }
+
+    vector<ProbeState> states(group);
+    vector<unsigned> slots(group);
+    unsigned next = 0;
+    unsigned active = 0;
+    for (; active < group && next < ids.size(); ++active) {
+        slots[active] = ids[next++];
+    }
+    while (active > 0) {
+        for (unsigned g = 0; g < active; ) {
+            if (mylsh.probeStep(states[g], probers[slots[g]], numItems)) {
+                ++g;
+            } else if (next < ids.size()) {
+                slots[g] = ids[next++];
+                states[g] = ProbeState();
+                ++g;
+            } else {
+                --active;
+                slots[g] = slots[active];
+                states[g] = states[active];
+            }
+        }
+    }
+}
+
+/*
+ * A pool of threads that probes all queries round by round, see annQuery.
+ *
+ * Query i always runs on thread i % threads: the visited set of a query may
+ * hold the epoch array of its thread (see lshbox::VisitedSet), so queries
+ * must not move between threads and the threads must outlive the rounds.
+ * The pool must outlive the probers as well. With one thread the queries
+ * run on the calling thread.
+ * */
+template<typename LSHTYPE, typename PROBER, typename DATATYPE>
+class ProbePool {
+public:
+    ProbePool(
+        LSHTYPE& mylsh,
+        PROBER* probers,
+        const vector<const DATATYPE*>& queries,
+        unsigned threads,
+        unsigned group) :
+        mylsh_(mylsh), probers_(probers), queries_(queries), group_(group),
+        ids_(std::max(1u, threads)), numItems_(0), round_(0), done_(0), stop_(false) {
+
+        for (unsigned i = 0; i < queries.size(); ++i) {
+            ids_[i % ids_.size()].push_back(i);
+        }
+        if (ids_.size() > 1) {
+            workers_.reserve(ids_.size());
+            for (unsigned t = 0; t < ids_.size(); ++t) {
+                workers_.emplace_back(&ProbePool::work, this, t);
+            }
+        }
+    }
+
+    ~ProbePool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    // probe every query up to numItems items, returns once all are done
+    void run(int numItems) {
+        if (workers_.empty()) {
+            probeQueries(mylsh_, probers_, queries_, ids_[0], numItems, group_);
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        numItems_ = numItems;
+        done_ = 0;
+        ++round_;
+        wake_.notify_all();
+        finished_.wait(lock, [this]() { return done_ == workers_.size(); });
+    }
+
+private:
+    void work(unsigned t) {
+        unsigned seen = 0;
+        while (true) {
+            int numItems;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [this, seen]() { return stop_ || round_ != seen; });
+                if (stop_) {
+                    return;
+                }
+                seen = round_;
+                numItems = numItems_;
+            }
+            probeQueries(mylsh_, probers_, queries_, ids_[t], numItems, group_);
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (++done_ == workers_.size()) {
+                finished_.notify_one();
+            }
+        }
+    }
+
+    LSHTYPE& mylsh_;
+    PROBER* probers_;
+    const vector<const DATATYPE*>& queries_;
+    unsigned group_;
+    vector<vector<unsigned>> ids_; // queries of every thread
+    vector<std::thread> workers_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable finished_;
+    int numItems_;
+    unsigned round_;
+    unsigned done_;
+    bool stop_;
+};
+}
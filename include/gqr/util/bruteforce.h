@@ -0,0 +1,224 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <utility>
+#include <cmath>
+#include <cfloat>
+#include <limits>
+#include <iostream>
+#include <assert.h>
+#include <eigen/Eigen/Dense>
+#include "lshbox/simd/distance.h"
+#include "gqr/util/vecsio.h"
+
+namespace lshbox {
+/*
+ * Exact k-NN of a set of queries over a base added block by block, e.g. as
+ * read from a file by FvecsStream. A tile of queries is multiplied with a
+ * tile of the base in one Eigen GEMM, the products are turned into distances
+ * (euclidean by |q|^2 + |x|^2 - 2 q.x, angular from q.x / |q||x|) and only
+ * the items under the K-th distance of a query reach its heap; whole runs of
+ * the row are skipped by a vectorized minimum. Euclidean and angular
+ * candidates are re-checked with the exact distance, so the rounding of the
+ * norm trick cannot change the result. The query tiles are shared by
+ * numThreads threads.
+ *
+ * Distances are those of cal_groundtruth.h: euclidean, acos of the cosine,
+ * and the negated inner product; ties go to the smaller id.
+ * */
+class BruteForce {
+public:
+    enum Metric {EUCLIDEAN, ANGULAR, PRODUCT};
+    typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMatrix;
+    typedef Eigen::Map<const RowMatrix> ConstRowMap;
+
+    // "euclidean", "angular" or "product"
+    static Metric parseMetric(const std::string& name) {
+        if (name == "euclidean") {
+            return EUCLIDEAN;
+        } else if (name == "angular") {
+            return ANGULAR;
+        } else if (name == "product") {
+            return PRODUCT;
+        }
+        std::cerr << "brute force does not support metric " << name << std::endl;
+        assert(false);
+        return EUCLIDEAN;
+    }
+
+    /*
+     * queries is numQueries x dim, row-major, and is copied. K must be positive.
+     * */
+    BruteForce(const float* queries, unsigned numQueries, unsigned dim, unsigned K, Metric metric, unsigned numThreads = 1)
+        : queries_(ConstRowMap(queries, numQueries, dim)), dim_(dim), K_(K), metric_(metric),
+          numThreads_(std::max(1u, numThreads)), heaps_(numQueries) {
+        if (K_ == 0) {
+            std::cerr << "brute force needs K > 0" << std::endl;
+            assert(false);
+        }
+        queryNorms_ = queries_.rowwise().squaredNorm();
+        for (auto& heap : heaps_) {
+            heap.reserve(K_ + 1);
+        }
+    }
+
+    unsigned getK() const {
+        return K_;
+    }
+
+    unsigned numQueries() const {
+        return heaps_.size();
+    }
+
+    /*
+     * compare all queries with n base vectors, row-major, whose ids start at
+     * firstId. Blocks must come in the order of their ids.
+     * */
+    void add(const float* base, unsigned n, unsigned firstId) {
+        if (n == 0 || K_ == 0) {
+            return;
+        }
+        ConstRowMap block(base, n, dim_);
+        Eigen::VectorXf baseNorms = block.rowwise().squaredNorm();
+        const unsigned numTiles = (numQueries() + QUERY_TILE - 1) / QUERY_TILE;
+        std::atomic<unsigned> nextTile(0);
+        auto work = [&]() {
+            RowMatrix products;
+            unsigned tile;
+            while ((tile = nextTile++) < numTiles) {
+                unsigned q0 = tile * QUERY_TILE;
+                unsigned q1 = std::min(numQueries(), q0 + QUERY_TILE);
+                for (unsigned b0 = 0; b0 < n; b0 += BASE_TILE) {
+                    unsigned b1 = std::min(n, b0 + BASE_TILE);
+                    products.noalias() = queries_.middleRows(q0, q1 - q0) * block.middleRows(b0, b1 - b0).transpose();
+                    for (unsigned q = q0; q < q1; ++q) {
+                        select(q, products.row(q - q0), baseNorms.segment(b0, b1 - b0), block, b0, firstId);
+                    }
+                }
+            }
+        };
+        if (numThreads_ == 1 || numTiles == 1) {
+            work();
+            return;
+        }
+        std::vector<std::thread> threads;
+        for (unsigned t = 0; t < std::min(numThreads_, numTiles); ++t) {
+            threads.push_back(std::thread(work));
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    /*
+     * the K nearest (id, distance) of query q, nearest first
+     * */
+    std::vector<std::pair<unsigned, float>> getTopK(unsigned q) const {
+        std::vector<std::pair<float, int>> sorted = heaps_[q];
+        std::sort(sorted.begin(), sorted.end());
+        std::vector<std::pair<unsigned, float>> results;
+        results.reserve(sorted.size());
+        for (const auto& item : sorted) {
+            results.push_back(std::make_pair((unsigned)item.second, distance(item.first)));
+        }
+        return results;
+    }
+
+private:
+    static const unsigned QUERY_TILE = 256;
+    static const unsigned BASE_TILE = 4096;
+    // runs of the product row skipped at once if none is under the K-th distance
+    static const unsigned RUN = 64;
+
+    /*
+     * push the items of one product row that beat the K-th score of query q,
+     * scores are squared distance, -cosine or -inner product
+     * */
+    template<typename ROW, typename NORMS>
+    void select(unsigned q, const ROW& products, const NORMS& baseNorms, const ConstRowMap& block, unsigned b0, unsigned firstId) {
+        const unsigned n = products.size();
+        Eigen::Array<float, 1, Eigen::Dynamic> scores;
+        float slack = 0;
+        if (metric_ == EUCLIDEAN) {
+            scores = queryNorms_(q) + baseNorms.transpose().array() - 2 * products.array();
+            // rounding of the norm trick, a candidate is then checked exactly
+            slack = 2 * (dim_ + 2) * FLT_EPSILON * (queryNorms_(q) + baseNorms.maxCoeff());
+        } else if (metric_ == ANGULAR) {
+            float queryNorm = std::sqrt(queryNorms_(q));
+            scores = -products.array() / (baseNorms.transpose().array().sqrt() * queryNorm).max(FLT_MIN);
+            slack = 2 * (dim_ + 2) * FLT_EPSILON;
+        } else {
+            scores = -products.array();
+        }
+        std::vector<std::pair<float, int>>& heap = heaps_[q];
+        for (unsigned r0 = 0; r0 < n; r0 += RUN) {
+            unsigned r1 = std::min(n, r0 + RUN);
+            if (heap.size() == K_ && scores.segment(r0, r1 - r0).minCoeff() >= threshold(heap) + slack) {
+                continue;
+            }
+            for (unsigned r = r0; r < r1; ++r) {
+                float score = scores(r);
+                if (heap.size() == K_ && score >= threshold(heap) + slack) {
+                    continue;
+                }
+                const float* query = queries_.data() + (size_t)q * dim_;
+                const float* item = block.data() + (size_t)(b0 + r) * dim_;
+                if (metric_ == EUCLIDEAN) {
+                    score = simd::KernelSet<float>::get().l2sqr(query, item, dim_);
+                } else if (metric_ == ANGULAR) {
+                    score = -cosine(query, item);
+                }
+                push(heap, score, firstId + b0 + r);
+            }
+        }
+    }
+
+    // in double, the angle of close items is sensitive to the cosine
+    float cosine(const float* a, const float* b) const {
+        double dot = 0, normA = 0, normB = 0;
+        for (unsigned i = 0; i < dim_; ++i) {
+            dot += (double)a[i] * b[i];
+            normA += (double)a[i] * a[i];
+            normB += (double)b[i] * b[i];
+        }
+        return normA > 0 && normB > 0 ? dot / std::sqrt(normA * normB) : 0;
+    }
+
+    static float threshold(const std::vector<std::pair<float, int>>& heap) {
+        return heap.front().first;
+    }
+
+    // max-heap of the K best (score, id), items arrive by increasing id
+    void push(std::vector<std::pair<float, int>>& heap, float score, int id) {
+        if (heap.size() < K_) {
+            heap.push_back(std::make_pair(score, id));
+            std::push_heap(heap.begin(), heap.end());
+        } else if (score < heap.front().first) {
+            std::pop_heap(heap.begin(), heap.end());
+            heap.back() = std::make_pair(score, id);
+            std::push_heap(heap.begin(), heap.end());
+        }
+    }
+
+    float distance(float score) const {
+        if (metric_ == EUCLIDEAN) {
+            return std::sqrt(std::max(score, 0.0f));
+        } else if (metric_ == ANGULAR) {
+            return std::acos(std::min(1.0f, std::max(-1.0f, -score)));
+        }
+        return score;
+    }
+
+    RowMatrix queries_;
+    Eigen::VectorXf queryNorms_;
+    unsigned dim_;
+    unsigned K_;
+    Metric metric_;
+    unsigned numThreads_;
+    std::vector<std::vector<std::pair<float, int>>> heaps_;
+};
+}
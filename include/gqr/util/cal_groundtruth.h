@@ -200,18 +200,26 @@ class GroundWriter {
 public:
     template<typename FeatureType>
     void writeLSHBOX(const char* lshboxBenchFileName, const vector<GTQuery<FeatureType>>& queryObjs) {
+        writeLSHBOX(lshboxBenchFileName, collect(queryObjs), queryObjs[0].getK());
+    }
+
+    template<typename FeatureType>
+    void writeIVECS(const char* ivecsBenchFileName, const vector<GTQuery<FeatureType>>& queryObjs) {
+        writeIVECS(ivecsBenchFileName, collect(queryObjs), queryObjs[0].getK());
+    }
+
+    // the K nearest items of every query, nearest first
+    void writeLSHBOX(const char* lshboxBenchFileName, const vector<vector<IdAndDstPair>>& topks, int K) {
         // lshbox file
         ofstream lshboxFout(lshboxBenchFileName);
         if (!lshboxFout) {
             cout << "cannot create output file " << lshboxBenchFileName << endl;
             assert(false);
         }
-        int K = queryObjs[0].getK();
-        lshboxFout << queryObjs.size() << "\t" << K << endl;
-        for (int i = 0; i < queryObjs.size(); ++i) {
-            assert(queryObjs[i].getK() == K);
+        lshboxFout << topks.size() << "\t" << K << endl;
+        for (int i = 0; i < topks.size(); ++i) {
             lshboxFout << i << "\t";
-            vector<IdAndDstPair> topker = queryObjs[i].getTopK();
+            const vector<IdAndDstPair>& topker = topks[i];
             for (int idx = 0; idx < topker.size(); ++idx) {
                 lshboxFout << topker[idx].id << "\t" << topker[idx].distance << "\t";
             }
@@ -221,19 +229,16 @@ public:
         cout << "lshbox groundtruth are written into " << lshboxBenchFileName << endl;
     }
 
-    template<typename FeatureType>
-    void writeIVECS(const char* ivecsBenchFileName, const vector<GTQuery<FeatureType>>& queryObjs) {
+    void writeIVECS(const char* ivecsBenchFileName, const vector<vector<IdAndDstPair>>& topks, int K) {
         // ivecs file
         ofstream fout(ivecsBenchFileName, ios::binary);
         if (!fout) {
             cout << "cannot create output file " << ivecsBenchFileName << endl;
             assert(false);
         }
-        int K = queryObjs[0].getK();
-        for (int i = 0; i < queryObjs.size(); ++i) {
-            assert(queryObjs[i].getK() == K);
+        for (int i = 0; i < topks.size(); ++i) {
             fout.write((char*)&K, sizeof(int));
-            vector<IdAndDstPair> topker = queryObjs[i].getTopK();
+            const vector<IdAndDstPair>& topker = topks[i];
             for (int idx = 0; idx < topker.size(); ++idx) {
                 fout.write((char*)&topker[idx].id, sizeof(int));
             }
@@ -241,5 +246,16 @@ public:
         fout.close();
         cout << "ivecs groundtruth are written into " << ivecsBenchFileName << endl;
      }
+
+private:
+    template<typename FeatureType>
+    static vector<vector<IdAndDstPair>> collect(const vector<GTQuery<FeatureType>>& queryObjs) {
+        vector<vector<IdAndDstPair>> topks;
+        for (int i = 0; i < queryObjs.size(); ++i) {
+            assert(queryObjs[i].getK() == queryObjs[0].getK());
+            topks.push_back(queryObjs[i].getTopK());
+        }
+        return topks;
+    }
 };
 }
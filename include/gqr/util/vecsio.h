@@ -0,0 +1,256 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <cstring>
+#include <iostream>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace lshbox {
+/*
+ * reads an fvecs file block by block into one row-major buffer, records are
+ * read CHUNK at a time in one sequential read
+ * */
+class FvecsStream {
+public:
+    explicit FvecsStream(const std::string& path) : fin_(path.c_str(), std::ios::binary), dim_(0), numRead_(0) {
+        if (!fin_) {
+            std::cerr << "cannot open file " << path << std::endl;
+            assert(false);
+        }
+        int dim = 0;
+        if (fin_.read((char*)&dim, sizeof(int))) {
+            dim_ = dim;
+        }
+        fin_.seekg(0);
+    }
+
+    unsigned getDim() const {
+        return dim_;
+    }
+
+    // vectors read so far, i.e. the id of the next one
+    unsigned numRead() const {
+        return numRead_;
+    }
+
+    /*
+     * read up to maxRows vectors into rows (resized to rows x dim), returns
+     * the number read, 0 at the end of the file
+     * */
+    unsigned read(std::vector<float>& rows, unsigned maxRows) {
+        rows.clear();
+        const size_t recordBytes = sizeof(int) + sizeof(float) * (size_t)dim_;
+        unsigned n = 0;
+        while (n < maxRows && fin_) {
+            unsigned chunk = std::min<unsigned>(maxRows - n, CHUNK);
+            records_.resize(chunk * recordBytes);
+            fin_.read(&records_[0], records_.size());
+            unsigned got = fin_.gcount() / recordBytes;
+            rows.resize((size_t)(n + got) * dim_);
+            for (unsigned i = 0; i < got; ++i) {
+                const char* record = &records_[i * recordBytes];
+                int dim;
+                std::memcpy(&dim, record, sizeof(int));
+                assert((unsigned)dim == dim_);
+                std::memcpy(&rows[(size_t)(n + i) * dim_], record + sizeof(int), sizeof(float) * dim_);
+            }
+            n += got;
+            if (got < chunk) {
+                break;
+            }
+        }
+        numRead_ += n;
+        return n;
+    }
+
+private:
+    // an enumerator, std::min takes it by reference
+    enum : unsigned { CHUNK = 4096 };
+
+    std::ifstream fin_;
+    unsigned dim_;
+    unsigned numRead_;
+    std::vector<char> records_;
+};
+
+/*
+ * writes fvecs, or idfvecs whose records start with the int id of the
+ * vector, through one large buffer
+ * */
+class FvecsWriter {
+public:
+    explicit FvecsWriter(const std::string& path, bool withIds = false, size_t bufferBytes = 1 << 24)
+        : fout_(path.c_str(), std::ios::binary), withIds_(withIds), bufferBytes_(bufferBytes) {
+        if (!fout_) {
+            std::cerr << "cannot create file " << path << std::endl;
+            assert(false);
+        }
+        buffer_.reserve(bufferBytes_);
+    }
+
+    ~FvecsWriter() {
+        flush();
+    }
+
+    // id is written only to idfvecs
+    void write(const float* row, unsigned dim, int id = 0) {
+        if (withIds_) {
+            append(&id, sizeof(int));
+        }
+        int d = dim;
+        append(&d, sizeof(int));
+        append(row, sizeof(float) * dim);
+    }
+
+    void flush() {
+        if (!buffer_.empty()) {
+            fout_.write(&buffer_[0], buffer_.size());
+            buffer_.clear();
+        }
+        fout_.flush();
+    }
+
+private:
+    void append(const void* data, size_t bytes) {
+        if (buffer_.size() + bytes > bufferBytes_) {
+            flush();
+        }
+        const char* begin = (const char*)data;
+        buffer_.insert(buffer_.end(), begin, begin + bytes);
+    }
+
+    std::ofstream fout_;
+    bool withIds_;
+    size_t bufferBytes_;
+    std::vector<char> buffer_;
+};
+
+/*
+ * uniform sample of k items of a stream of unknown length (Algorithm R):
+ * offer() is called once per item in order and returns the slot the item
+ * takes, replacing the item held there, or -1 if it is not kept
+ * */
+class Reservoir {
+public:
+    Reservoir(unsigned k, unsigned seed) : k_(k), seen_(0), rng_(seed) {}
+
+    int offer() {
+        unsigned long long i = seen_++;
+        if (i < k_) {
+            return i;
+        }
+        unsigned long long j = std::uniform_int_distribution<unsigned long long>(0, i)(rng_);
+        return j < k_ ? (int)j : -1;
+    }
+
+    unsigned long long seen() const {
+        return seen_;
+    }
+
+    // slots in use, min(k, seen)
+    unsigned size() const {
+        return std::min<unsigned long long>(k_, seen_);
+    }
+
+private:
+    unsigned k_;
+    unsigned long long seen_;
+    std::mt19937_64 rng_;
+};
+
+/*
+ * converts a headerless file of rows of dim values of type T into fvecs.
+ * The row count follows from the file size, so every thread converts its
+ * blocks of rows with one pread and one pwrite at their own offsets; a
+ * trailing partial row is dropped. Returns the number of rows written.
+ * */
+template<typename T>
+unsigned long long rawToFvecs(const std::string& inPath, const std::string& outPath, unsigned dim, unsigned numThreads) {
+    int in = open(inPath.c_str(), O_RDONLY);
+    if (in < 0) {
+        std::cerr << "cannot open file " << inPath << std::endl;
+        assert(false);
+        return 0;
+    }
+    int out = open(outPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        std::cerr << "cannot create file " << outPath << std::endl;
+        close(in);
+        assert(false);
+        return 0;
+    }
+    struct stat st;
+    fstat(in, &st);
+    const size_t inRow = sizeof(T) * (size_t)dim;
+    const size_t outRow = sizeof(int) + sizeof(float) * (size_t)dim;
+    const unsigned long long numRows = st.st_size / inRow;
+    if (ftruncate(out, numRows * outRow) != 0) {
+        std::cerr << "cannot resize file " << outPath << std::endl;
+        assert(false);
+    }
+
+    // about 8MB of input per block
+    const unsigned long long blockRows = std::max<size_t>(1, (8 << 20) / inRow);
+    const unsigned long long numBlocks = (numRows + blockRows - 1) / blockRows;
+    std::atomic<unsigned long long> nextBlock(0);
+    std::atomic<bool> failed(false);
+    auto work = [&]() {
+        std::vector<T> input;
+        std::vector<char> output;
+        unsigned long long block;
+        while ((block = nextBlock++) < numBlocks && !failed) {
+            unsigned long long first = block * blockRows;
+            size_t rows = std::min(blockRows, numRows - first);
+            input.resize(rows * dim);
+            output.resize(rows * outRow);
+            size_t bytes = rows * inRow;
+            if (pread(in, (char*)&input[0], bytes, first * inRow) != (ssize_t)bytes) {
+                failed = true;
+                break;
+            }
+            const int d = dim;
+            for (size_t r = 0; r < rows; ++r) {
+                char* record = &output[r * outRow];
+                std::memcpy(record, &d, sizeof(int));
+                float* values = (float*)(record + sizeof(int));
+                const T* row = &input[r * dim];
+                for (unsigned i = 0; i < dim; ++i) {
+                    values[i] = (float)row[i];
+                }
+            }
+            if (pwrite(out, &output[0], output.size(), first * outRow) != (ssize_t)output.size()) {
+                failed = true;
+                break;
+            }
+        }
+    };
+    numThreads = std::max<unsigned long long>(1, std::min<unsigned long long>(numThreads, numBlocks));
+    if (numThreads == 1) {
+        work();
+    } else {
+        std::vector<std::thread> threads;
+        for (unsigned t = 0; t < numThreads; ++t) {
+            threads.push_back(std::thread(work));
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+    close(in);
+    close(out);
+    if (failed) {
+        std::cerr << "failed to convert " << inPath << " to " << outPath << std::endl;
+        assert(false);
+        return 0;
+    }
+    return numRows;
+}
+}
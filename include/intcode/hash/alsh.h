@@ -53,9 +53,18 @@ namespace lshbox {
          * @return a new vector stored normalized data, without change origin data.
          */
         vector<DATATYPE > scale(const DATATYPE* data, unsigned long dimension, DATATYPE targetNorm) const ;
+
+        /**
+         * q ---scale to 1, add m terms of 0.5---> the vector hashed by every table,
+         * depends only on the query so it is computed once per query.
+         */
+        vector<DATATYPE > transformQuery(const DATATYPE* data) const ;
+
+        vector<float> projectTransformed(unsigned k, const vector<DATATYPE>& transformed) const ;
     public:
         virtual void loadModel(const string& modelFile, const string& baseBitsFile) override;
         vector<float> getHashFloats(unsigned k, const DATATYPE *domin) const override ;
+        vector<vector<float>> getAllHashFloats(const DATATYPE *domin) const override ;
     };
 
 
@@ -126,18 +135,20 @@ namespace lshbox {
     }
 
     template<typename DATATYPE>
-    vector<float> ALSH<DATATYPE>::getHashFloats(unsigned tableIdx, const DATATYPE *data) const
-    {
-
+    vector<DATATYPE > ALSH<DATATYPE>::transformQuery(const DATATYPE* data) const {
         //scale to U
         vector<DATATYPE> normalizedData = this->scale(data, this->mean.size() - this->m, 1.0f);
         // transform
         for (unsigned i = 0; i < this->m; ++i) {
             normalizedData.push_back(0.5);
         }
+        return normalizedData;
+    }
 
+    template<typename DATATYPE>
+    vector<float> ALSH<DATATYPE>::projectTransformed(unsigned tableIdx, const vector<DATATYPE>& transformed) const {
         // project
-        vector<float> projVector = this->getProjection(normalizedData.data(), this->pcsAll[tableIdx], this->mean);
+        vector<float> projVector = this->getProjection(transformed.data(), this->pcsAll[tableIdx], this->mean);
 
         // shift and chop
         for (int i = 0; i < projVector.size(); ++i) {
@@ -147,4 +158,21 @@ namespace lshbox {
         return projVector;
     }
 
+    template<typename DATATYPE>
+    vector<float> ALSH<DATATYPE>::getHashFloats(unsigned tableIdx, const DATATYPE *data) const
+    {
+        return projectTransformed(tableIdx, transformQuery(data));
+    }
+
+    template<typename DATATYPE>
+    vector<vector<float>> ALSH<DATATYPE>::getAllHashFloats(const DATATYPE *data) const
+    {
+        vector<DATATYPE> transformed = transformQuery(data);
+        vector<vector<float>> hashFloats(this->tables.size());
+        for (unsigned tb = 0; tb < hashFloats.size(); ++tb) {
+            hashFloats[tb] = projectTransformed(tb, transformed);
+        }
+        return hashFloats;
+    }
+
 };
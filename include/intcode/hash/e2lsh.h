@@ -41,7 +41,12 @@ public:
 
     virtual vector<float> getHashFloats(unsigned k, const DATATYPE *domin) const;
 
+    // hash floats of all tables
+    virtual vector<vector<float>> getAllHashFloats(const DATATYPE *domin) const;
+
     BIDTYPE getBuckets(unsigned k, const DATATYPE *domin) const override;
+
+    vector<BIDTYPE> getAllBuckets(const DATATYPE *domin) const override;
     // BIDTYPE getHashVal(unsigned k, const DATATYPE *domin);
 
     // virtual vector<int> quantization(const vector<float>& hashFloats);
@@ -134,6 +139,16 @@ vector<float> E2LSH<DATATYPE>::getHashFloats(unsigned tableIdx, const DATATYPE *
     return projVector;
 }
 
+template<typename DATATYPE>
+vector<vector<float>> E2LSH<DATATYPE>::getAllHashFloats(const DATATYPE *data) const
+{
+    vector<vector<float>> hashFloats(this->tables.size());
+    for (unsigned tb = 0; tb < hashFloats.size(); ++tb) {
+        hashFloats[tb] = getHashFloats(tb, data);
+    }
+    return hashFloats;
+}
+
 template<typename DATATYPE>
 vector<int> E2LSH<DATATYPE>::getBuckets(unsigned tableIdx, const DATATYPE *data) const
 {
@@ -145,4 +160,19 @@ vector<int> E2LSH<DATATYPE>::getBuckets(unsigned tableIdx, const DATATYPE *data)
     }
     return hashVal;
 }
+
+template<typename DATATYPE>
+vector<vector<int>> E2LSH<DATATYPE>::getAllBuckets(const DATATYPE *data) const
+{
+    vector<vector<float>> hashFloats = getAllHashFloats(data);
+
+    vector<vector<int>> hashVals(hashFloats.size());
+    for (unsigned tb = 0; tb < hashVals.size(); ++tb) {
+        hashVals[tb].resize(hashFloats[tb].size());
+        for (int i = 0; i < hashVals[tb].size(); ++i) {
+            hashVals[tb][i] = floor(hashFloats[tb][i]);
+        }
+    }
+    return hashVals;
+}
 };
@@ -26,8 +26,9 @@ public:
         LSHTYPE& mylsh) : MTableProber<ACCESSOR, BIDTYPE>(query, scanner, mylsh) {
 
         this->LTable_.reserve(mylsh.tables.size());
+        vector<vector<float>> allHashFloats = mylsh.getAllHashFloats(query);
         for (int tb = 0; tb < mylsh.tables.size(); ++tb) {
-            vector<float> hashFloats = mylsh.getHashFloats(tb, query);
+            const vector<float>& hashFloats = allHashFloats[tb];
 
             auto distor = [&hashFloats](const BIDTYPE& bucket) {
                 float distance = 0;
@@ -0,0 +1,232 @@
+/**
+ * @file arena.h
+ *
+ * @brief Monotonic arena for per-query state, and huge-page backed buffers
+ * for the large tables shared by all queries.
+ */
+#pragma once
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+namespace lshbox
+{
+const size_t HUGE_PAGE_BYTES = 2 << 20;
+
+/**
+ * Process-wide switch of huge-page backing, off by default. Only buffers
+ * allocated after it is turned on are affected.
+ */
+inline bool &hugePages()
+{
+    static bool enabled = false;
+    return enabled;
+}
+
+/**
+ * Allocate bytes bytes, on huge pages if they are enabled and bytes spans at
+ * least one. Tries explicit huge pages first, then transparent huge pages on
+ * a 2MB aligned range. huge tells freePages() how the buffer was allocated.
+ */
+inline void *allocPages(size_t bytes, bool &huge)
+{
+    huge = false;
+#ifdef __linux__
+    if (hugePages() && bytes >= HUGE_PAGE_BYTES)
+    {
+        size_t size = (bytes + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+#ifdef MAP_HUGETLB
+        void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED)
+        {
+            huge = true;
+            return p;
+        }
+#endif
+        // over-map by one huge page and trim both ends to align the range
+        char *raw = static_cast<char *>(mmap(NULL, size + HUGE_PAGE_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (raw != MAP_FAILED)
+        {
+            size_t head = (HUGE_PAGE_BYTES - reinterpret_cast<size_t>(raw) % HUGE_PAGE_BYTES) % HUGE_PAGE_BYTES;
+            if (head != 0)
+            {
+                munmap(raw, head);
+            }
+            munmap(raw + head + size, HUGE_PAGE_BYTES - head);
+#ifdef MADV_HUGEPAGE
+            madvise(raw + head, size, MADV_HUGEPAGE);
+#endif
+            huge = true;
+            return raw + head;
+        }
+    }
+#endif
+    void *p = std::malloc(bytes);
+    if (p == NULL && bytes != 0)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+inline void freePages(void *p, size_t bytes, bool huge)
+{
+#ifdef __linux__
+    if (huge)
+    {
+        munmap(p, (bytes + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES);
+        return;
+    }
+#endif
+    std::free(p);
+}
+
+/**
+ * Monotonic allocator: memory is handed out from large blocks and only given
+ * back all at once by reset() or the destructor.
+ *
+ * A block that is too small is followed by one at least twice its size, and
+ * reset() keeps only the largest block, so after the first few queries a
+ * query fits in one block and reset() is a pointer rewind.
+ */
+class Arena
+{
+public:
+    explicit Arena(size_t blockBytes = 64 << 10): blockBytes_(blockBytes), cur_(NULL), end_(NULL) {}
+
+    Arena(const Arena &) = delete;
+    Arena &operator = (const Arena &) = delete;
+
+    ~Arena()
+    {
+        for (size_t i = 0; i != blocks_.size(); ++i)
+        {
+            freePages(blocks_[i].data, blocks_[i].size, blocks_[i].huge);
+        }
+    }
+
+    /**
+     * Uninitialized memory of bytes bytes aligned to align, a power of two.
+     */
+    void *allocate(size_t bytes, size_t align = alignof(std::max_align_t))
+    {
+        char *p = alignUp(cur_, align);
+        if (cur_ == NULL || p + bytes > end_)
+        {
+            grow(bytes + align);
+            p = alignUp(cur_, align);
+        }
+        cur_ = p + bytes;
+        return p;
+    }
+
+    template<typename T>
+    T *alloc(size_t n)
+    {
+        return static_cast<T *>(allocate(n * sizeof(T), alignof(T)));
+    }
+
+    /**
+     * Release all memory handed out. Everything allocated before becomes
+     * invalid, containers on the arena must be destroyed first.
+     */
+    void reset()
+    {
+        if (blocks_.size() > 1)
+        {
+            // the last block is the largest
+            for (size_t i = 0; i + 1 < blocks_.size(); ++i)
+            {
+                freePages(blocks_[i].data, blocks_[i].size, blocks_[i].huge);
+            }
+            blocks_.erase(blocks_.begin(), blocks_.end() - 1);
+        }
+        if (!blocks_.empty())
+        {
+            cur_ = blocks_[0].data;
+            end_ = blocks_[0].data + blocks_[0].size;
+        }
+    }
+
+    // bytes held by the arena
+    size_t capacity() const
+    {
+        size_t bytes = 0;
+        for (size_t i = 0; i != blocks_.size(); ++i)
+        {
+            bytes += blocks_[i].size;
+        }
+        return bytes;
+    }
+
+private:
+    struct Block
+    {
+        char *data;
+        size_t size;
+        bool huge;
+    };
+
+    size_t blockBytes_;
+    std::vector<Block> blocks_;
+    char *cur_;
+    char *end_;
+
+    static char *alignUp(char *p, size_t align)
+    {
+        return reinterpret_cast<char *>((reinterpret_cast<size_t>(p) + align - 1) & ~(align - 1));
+    }
+
+    void grow(size_t bytes)
+    {
+        size_t size = blocks_.empty() ? blockBytes_ : 2 * blocks_.back().size;
+        while (size < bytes)
+        {
+            size *= 2;
+        }
+        Block block;
+        block.data = static_cast<char *>(allocPages(size, block.huge));
+        block.size = size;
+        blocks_.push_back(block);
+        cur_ = block.data;
+        end_ = block.data + size;
+    }
+};
+
+/**
+ * STL allocator on an Arena, deallocate() is a no-op.
+ */
+template<typename T>
+struct ArenaAllocator
+{
+    typedef T value_type;
+    Arena *arena;
+
+    explicit ArenaAllocator(Arena &a): arena(&a) {}
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other): arena(other.arena) {}
+
+    T *allocate(size_t n)
+    {
+        return arena->alloc<T>(n);
+    }
+
+    void deallocate(T *, size_t) {}
+
+    template<typename U>
+    bool operator == (const ArenaAllocator<U> &other) const
+    {
+        return arena == other.arena;
+    }
+
+    template<typename U>
+    bool operator != (const ArenaAllocator<U> &other) const
+    {
+        return arena != other.arena;
+    }
+};
+}
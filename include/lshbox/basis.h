@@ -30,6 +30,7 @@
 #include <string>
 #include <iostream>
 #include <time.h>
+#include <chrono>
 namespace lshbox
 {
 #define CAUCHY   1
@@ -148,4 +149,50 @@ public:
 private:
     double time;
 };
+/**
+ * A timer measuring wall-clock time, timer only counts the CPU time of the
+ * process and thus sums up the time of all threads.
+ */
+class wall_timer
+{
+public:
+    wall_timer(): start(std::chrono::steady_clock::now()) {};
+    ~wall_timer() {};
+    /**
+     * Restart the timer.
+     */
+    void restart()
+    {
+        start = std::chrono::steady_clock::now();
+    }
+    /**
+     * Measures elapsed time.
+     *
+     * @return The elapsed time in seconds
+     */
+    double elapsed()
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+private:
+    std::chrono::steady_clock::time_point start;
+};
+/**
+ * A point in time on the monotonic clock, seconds from its construction.
+ */
+class deadline
+{
+public:
+    deadline(double seconds): end(std::chrono::steady_clock::now()
+        + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds))) {}
+    /**
+     * Whether the deadline has passed, costs one read of the clock.
+     */
+    bool passed() const
+    {
+        return std::chrono::steady_clock::now() >= end;
+    }
+private:
+    std::chrono::steady_clock::time_point end;
+};
 }
\ No newline at end of file
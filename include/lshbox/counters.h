@@ -0,0 +1,194 @@
+/**
+ * @file counters.h
+ *
+ * @brief Event counters of the probing hot path, compiled in with
+ * -DGQR_ENABLE_COUNTERS (cmake -DGQR_ENABLE_COUNTERS=ON).
+ *
+ * Every Scanner holds the counters of its current query, which its prober
+ * adds to the counters of the calling thread when it is reset or destroyed.
+ * flushThreadCounters() adds those to the global counters. Without the flag
+ * Counters is empty and count() compiles to nothing.
+ */
+#pragma once
+#include <vector>
+#include <mutex>
+#include <ostream>
+namespace lshbox
+{
+#ifdef GQR_ENABLE_COUNTERS
+const bool COUNTERS_ENABLED = true;
+#else
+const bool COUNTERS_ENABLED = false;
+#endif
+
+class Counters
+{
+public:
+    enum Event
+    {
+        BUCKETS_GENERATED, // buckets returned by getNextBID()
+        BUCKETS_PROBED,    // buckets looked up in their table
+        BUCKETS_EMPTY,     // looked up but missing or without items
+        ITEMS_SEEN,        // items of the probed buckets
+        DUPLICATES,        // items rejected by the visited set
+        DISTANCES,         // exact distances computed, abandoned ones included
+        CODES_SCORED,      // approximate distances on quantized codes
+        TOPK_UPDATES,      // items that entered the TopK
+        NUM_EVENTS
+    };
+
+    static const char *name(Event event)
+    {
+        static const char *names[NUM_EVENTS] = {
+            "buckets generated", "buckets probed", "empty buckets", "items seen",
+            "duplicates", "distances", "codes scored", "topk updates"};
+        return names[event];
+    }
+
+    Counters()
+    {
+        clear();
+    }
+
+    void count(Event event, unsigned long long n = 1)
+    {
+#ifdef GQR_ENABLE_COUNTERS
+        values_[event] += n;
+#else
+        (void)event;
+        (void)n;
+#endif
+    }
+
+    // a bucket of table t was probed
+    void countTable(unsigned t)
+    {
+#ifdef GQR_ENABLE_COUNTERS
+        if (t >= perTable_.size())
+        {
+            perTable_.resize(t + 1, 0);
+        }
+        ++perTable_[t];
+#else
+        (void)t;
+#endif
+    }
+
+    unsigned long long get(Event event) const
+    {
+#ifdef GQR_ENABLE_COUNTERS
+        return values_[event];
+#else
+        (void)event;
+        return 0;
+#endif
+    }
+
+    // buckets probed per table, empty without the flag
+    std::vector<unsigned long long> bucketsPerTable() const
+    {
+#ifdef GQR_ENABLE_COUNTERS
+        return perTable_;
+#else
+        return std::vector<unsigned long long>();
+#endif
+    }
+
+    void add(const Counters &other)
+    {
+#ifdef GQR_ENABLE_COUNTERS
+        for (unsigned e = 0; e != NUM_EVENTS; ++e)
+        {
+            values_[e] += other.values_[e];
+        }
+        if (other.perTable_.size() > perTable_.size())
+        {
+            perTable_.resize(other.perTable_.size(), 0);
+        }
+        for (unsigned t = 0; t != other.perTable_.size(); ++t)
+        {
+            perTable_[t] += other.perTable_[t];
+        }
+#else
+        (void)other;
+#endif
+    }
+
+    void clear()
+    {
+#ifdef GQR_ENABLE_COUNTERS
+        for (unsigned e = 0; e != NUM_EVENTS; ++e)
+        {
+            values_[e] = 0;
+        }
+        perTable_.clear();
+#endif
+    }
+
+    /**
+     * One "name, value" line per event and one of buckets per table, values
+     * divided by per, e.g. the number of queries.
+     */
+    void print(std::ostream &os, double per = 1) const
+    {
+        for (unsigned e = 0; e != NUM_EVENTS; ++e)
+        {
+            os << "COUNTER    , " << name(Event(e)) << ", " << get(Event(e)) / per << "\n";
+        }
+        std::vector<unsigned long long> tables = bucketsPerTable();
+        os << "COUNTER    , buckets per table";
+        for (unsigned t = 0; t != tables.size(); ++t)
+        {
+            os << ", " << tables[t] / per;
+        }
+        os << std::endl;
+    }
+
+private:
+#ifdef GQR_ENABLE_COUNTERS
+    unsigned long long values_[NUM_EVENTS];
+    std::vector<unsigned long long> perTable_;
+#endif
+};
+
+// the counters of the queries finished on the calling thread
+inline Counters &threadCounters()
+{
+    static thread_local Counters counters;
+    return counters;
+}
+
+inline std::mutex &globalCountersMutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+inline Counters &globalCountersUnlocked()
+{
+    static Counters counters;
+    return counters;
+}
+
+/**
+ * Move the counters of the calling thread to the global ones, threads do
+ * this before they exit.
+ */
+inline void flushThreadCounters()
+{
+    if (!COUNTERS_ENABLED)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(globalCountersMutex());
+    globalCountersUnlocked().add(threadCounters());
+    threadCounters().clear();
+}
+
+// a copy of the global counters
+inline Counters globalCounters()
+{
+    std::lock_guard<std::mutex> lock(globalCountersMutex());
+    return globalCountersUnlocked();
+}
+}
@@ -45,4 +45,10 @@ public:
             minHeap_.push(ElementT(p.second, key));
         }
     }
+
+    void probeItems(const unsigned* keys, unsigned n) {
+        for (unsigned i = 0; i < n; ++i) {
+            (*this)(keys[i]);
+        }
+    }
 };
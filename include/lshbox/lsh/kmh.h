@@ -30,6 +30,10 @@ public:
 
     void loadModel(const string& modelFile, const string& baseBitsFile); 
 
+    size_t modelBytes() const override {
+        return lshbox::heapBytes(R) + lshbox::heapBytes(center_tables) + lshbox::heapBytes(mean);
+    }
+
 private:
     int d, d_subspace, num_bits, num_bits_subspace, num_subspace, num_center;
     vector<vector<float> > R;
@@ -35,6 +35,10 @@ public:
 
     void loadModel(const string& modelFile, const string& baseBitsFile); 
 
+    size_t modelBytes() const override {
+        return lshbox::heapBytes(pcsAll) + lshbox::heapBytes(mean);
+    }
+
 private:
     vector<vector<vector<float> > > pcsAll;
     vector<float> mean;
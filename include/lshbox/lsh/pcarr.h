@@ -26,6 +26,10 @@ public:
 
     void loadModel(const string& modelFile, const string& baseBitsFile); 
 
+    size_t modelBytes() const override {
+        return lshbox::heapBytes(pcs) + lshbox::heapBytes(rotateAll) + lshbox::heapBytes(mean);
+    }
+
 private:
     vector<vector<float> >  pcs;
     vector<vector<vector<float> > > rotateAll;
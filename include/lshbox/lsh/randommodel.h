@@ -0,0 +1,323 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <cassert>
+#include <eigen/Eigen/Dense>
+#include <lshbox/matrix.h>
+
+/*
+ * Model files drawn at random instead of trained by the Matlab scripts, in
+ * the formats loadModel() of the hashers reads, so that indexes can be built
+ * and benchmarked from C++ alone. The projections are Gaussian, which makes
+ * PCAH and SIMH models random-projection LSH; the data only supplies the
+ * mean and the statistics that keep the bits balanced. writePCAH() is the
+ * exception, it computes the principal components with Eigen.
+ * */
+namespace lshbox {
+
+// first line of the model file of every hasher but KMH
+inline void writeModelHeader(std::ofstream& fout, unsigned numTables, unsigned dim, unsigned codelen, unsigned numItems) {
+    fout << numTables << " " << dim << " " << codelen << " " << numItems << " " << 0 << "\n";
+}
+
+inline std::ofstream openModel(const std::string& path) {
+    std::ofstream fout(path.c_str());
+    if (!fout) {
+        std::cerr << "cannot open file " << path << std::endl;
+        assert(false);
+    }
+    return fout;
+}
+
+template<typename DATATYPE>
+std::vector<float> columnMean(const Matrix<DATATYPE>& data) {
+    std::vector<double> sum(data.getDim(), 0);
+    for (int i = 0; i < data.getSize(); ++i) {
+        for (int j = 0; j < data.getDim(); ++j) {
+            sum[j] += data[i][j];
+        }
+    }
+    std::vector<float> mean(data.getDim());
+    for (int j = 0; j < data.getDim(); ++j) {
+        mean[j] = data.getSize() ? sum[j] / data.getSize() : 0;
+    }
+    return mean;
+}
+
+inline void writeRow(std::ofstream& fout, const float* row, unsigned n) {
+    for (unsigned i = 0; i < n; ++i) {
+        fout << (i ? " " : "") << row[i];
+    }
+    fout << "\n";
+}
+
+// rows x cols Gaussian matrix, one line per row
+inline void writeGaussian(std::ofstream& fout, unsigned rows, unsigned cols, std::mt19937& rng) {
+    std::normal_distribution<float> normal(0, 1);
+    std::vector<float> row(cols);
+    for (unsigned r = 0; r < rows; ++r) {
+        for (unsigned c = 0; c < cols; ++c) {
+            row[c] = normal(rng);
+        }
+        writeRow(fout, &row[0], cols);
+    }
+}
+
+// random orthogonal n x n matrix, the Q of a Gaussian one
+inline void writeRotation(std::ofstream& fout, unsigned n, std::mt19937& rng) {
+    std::normal_distribution<float> normal(0, 1);
+    Eigen::MatrixXf gaussian(n, n);
+    for (unsigned r = 0; r < n; ++r) {
+        for (unsigned c = 0; c < n; ++c) {
+            gaussian(r, c) = normal(rng);
+        }
+    }
+    Eigen::MatrixXf q = gaussian.householderQr().householderQ();
+    std::vector<float> row(n);
+    for (unsigned r = 0; r < n; ++r) {
+        for (unsigned c = 0; c < n; ++c) {
+            row[c] = q(r, c);
+        }
+        writeRow(fout, &row[0], n);
+    }
+}
+
+/*
+ * PCAH (and SIMH) model: the mean, then per table a dim x codelen matrix of
+ * Gaussian projections.
+ * */
+template<typename DATATYPE>
+void writeRandomPCAH(const std::string& path, const Matrix<DATATYPE>& data, unsigned numTables, unsigned codelen, unsigned seed = 0) {
+    std::mt19937 rng(seed);
+    std::ofstream fout = openModel(path);
+    writeModelHeader(fout, numTables, data.getDim(), codelen, data.getSize());
+    std::vector<float> mean = columnMean(data);
+    writeRow(fout, &mean[0], mean.size());
+    for (unsigned t = 0; t < numTables; ++t) {
+        writeGaussian(fout, data.getDim(), codelen, rng);
+    }
+}
+
+/*
+ * PCAH model trained in C++: the top codelen principal components of the
+ * covariance of a random sample of at most sampleSize items. Every table
+ * gets its own sample, so the tables differ a little as with bagging.
+ * */
+template<typename DATATYPE>
+void writePCAH(const std::string& path, const Matrix<DATATYPE>& data, unsigned numTables, unsigned codelen, unsigned sampleSize = 20000, unsigned seed = 0) {
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> pick(0, data.getSize() - 1);
+    std::ofstream fout = openModel(path);
+    writeModelHeader(fout, numTables, data.getDim(), codelen, data.getSize());
+    std::vector<float> mean = columnMean(data);
+    writeRow(fout, &mean[0], mean.size());
+    const unsigned dim = data.getDim();
+    const unsigned numSamples = std::min<unsigned>(sampleSize, data.getSize());
+    Eigen::MatrixXf sample(numSamples, dim);
+    std::vector<float> row(codelen);
+    for (unsigned t = 0; t < numTables; ++t) {
+        for (unsigned s = 0; s < numSamples; ++s) {
+            const DATATYPE* item = data[numSamples == (unsigned)data.getSize() ? s : pick(rng)];
+            for (unsigned j = 0; j < dim; ++j) {
+                sample(s, j) = item[j] - mean[j];
+            }
+        }
+        Eigen::MatrixXf covariance = sample.transpose() * sample / std::max(1u, numSamples - 1);
+        // eigenvalues in increasing order, the components are the last columns
+        Eigen::SelfAdjointEigenSolver<Eigen::MatrixXf> solver(covariance);
+        const Eigen::MatrixXf& vectors = solver.eigenvectors();
+        for (unsigned j = 0; j < dim; ++j) {
+            for (unsigned b = 0; b < codelen; ++b) {
+                row[b] = b < dim ? vectors(j, dim - 1 - b) : 0;
+            }
+            writeRow(fout, &row[0], codelen);
+        }
+    }
+}
+
+/*
+ * PCARR (ITQ, IsoH) model: the mean, one dim x codelen Gaussian projection
+ * shared by the tables and a random rotation per table.
+ * */
+template<typename DATATYPE>
+void writeRandomPCARR(const std::string& path, const Matrix<DATATYPE>& data, unsigned numTables, unsigned codelen, unsigned seed = 0) {
+    std::mt19937 rng(seed);
+    std::ofstream fout = openModel(path);
+    writeModelHeader(fout, numTables, data.getDim(), codelen, data.getSize());
+    std::vector<float> mean = columnMean(data);
+    writeRow(fout, &mean[0], mean.size());
+    writeGaussian(fout, data.getDim(), codelen, rng);
+    for (unsigned t = 0; t < numTables; ++t) {
+        writeRotation(fout, codelen, rng);
+    }
+}
+
+/*
+ * SpH model: per table codelen pivots drawn from the data, each with the
+ * median distance to a sample of the data as radius, so that about half of
+ * the items fall inside every hypersphere.
+ * */
+template<typename DATATYPE>
+void writeRandomSpH(const std::string& path, const Matrix<DATATYPE>& data, unsigned numTables, unsigned codelen, unsigned seed = 0) {
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> pick(0, data.getSize() - 1);
+    std::ofstream fout = openModel(path);
+    writeModelHeader(fout, numTables, data.getDim(), codelen, data.getSize());
+    const unsigned numSamples = std::min(1000, data.getSize());
+    std::vector<float> row(data.getDim());
+    std::vector<float> dists(numSamples);
+    for (unsigned t = 0; t < numTables; ++t) {
+        std::vector<int> pivots(codelen);
+        for (unsigned b = 0; b < codelen; ++b) {
+            pivots[b] = pick(rng);
+            std::copy(data[pivots[b]], data[pivots[b]] + data.getDim(), row.begin());
+            writeRow(fout, &row[0], row.size());
+        }
+        for (unsigned b = 0; b < codelen; ++b) {
+            for (unsigned s = 0; s < numSamples; ++s) {
+                const DATATYPE* item = data[pick(rng)];
+                float dist = 0;
+                for (int j = 0; j < data.getDim(); ++j) {
+                    float diff = data[pivots[b]][j] - item[j];
+                    dist += diff * diff;
+                }
+                dists[s] = std::sqrt(dist);
+            }
+            std::nth_element(dists.begin(), dists.begin() + numSamples / 2, dists.end());
+            fout << dists[numSamples / 2] << "\n";
+        }
+    }
+}
+
+/*
+ * SH model: the mean, then per table a Gaussian projection, the modes (the
+ * lowest mode of every projected dimension, i.e. one bit per dimension) and
+ * the range of the projected data.
+ * */
+template<typename DATATYPE>
+void writeRandomSH(const std::string& path, const Matrix<DATATYPE>& data, unsigned numTables, unsigned codelen, unsigned seed = 0) {
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> normal(0, 1);
+    std::ofstream fout = openModel(path);
+    writeModelHeader(fout, numTables, data.getDim(), codelen, data.getSize());
+    std::vector<float> mean = columnMean(data);
+    writeRow(fout, &mean[0], mean.size());
+    const unsigned dim = data.getDim();
+    std::vector<float> row(std::max(dim, codelen));
+    for (unsigned t = 0; t < numTables; ++t) {
+        std::vector<float> projection(dim * codelen);
+        for (unsigned j = 0; j < dim; ++j) {
+            for (unsigned b = 0; b < codelen; ++b) {
+                projection[j * codelen + b] = normal(rng);
+            }
+            writeRow(fout, &projection[j * codelen], codelen);
+        }
+        for (unsigned m = 0; m < codelen; ++m) {
+            for (unsigned b = 0; b < codelen; ++b) {
+                row[b] = m == b ? 1 : 0;
+            }
+            writeRow(fout, &row[0], codelen);
+        }
+        std::vector<float> mn(codelen, std::numeric_limits<float>::max());
+        std::vector<float> mx(codelen, -std::numeric_limits<float>::max());
+        for (int i = 0; i < data.getSize(); ++i) {
+            for (unsigned b = 0; b < codelen; ++b) {
+                float y = 0;
+                for (unsigned j = 0; j < dim; ++j) {
+                    y += (data[i][j] - mean[j]) * projection[j * codelen + b];
+                }
+                mn[b] = std::min(mn[b], y);
+                mx[b] = std::max(mx[b], y);
+            }
+        }
+        writeRow(fout, &mn[0], codelen);
+        writeRow(fout, &mx[0], codelen);
+    }
+}
+
+/*
+ * KMH model of one table: codelen / bitsPerSubspace subspaces of the
+ * centered data with 2^bitsPerSubspace centers each, drawn from the data,
+ * and the identity as rotation. dim must be a multiple of the number of
+ * subspaces.
+ * */
+template<typename DATATYPE>
+void writeRandomKMH(const std::string& path, const Matrix<DATATYPE>& data, unsigned codelen, unsigned bitsPerSubspace = 4, unsigned seed = 0) {
+    const unsigned dim = data.getDim();
+    const unsigned numSubspaces = codelen / bitsPerSubspace;
+    if (numSubspaces == 0 || codelen % bitsPerSubspace != 0 || dim % numSubspaces != 0) {
+        std::cerr << "KMH needs codelen a multiple of " << bitsPerSubspace
+            << " and dim a multiple of codelen / " << bitsPerSubspace << std::endl;
+        assert(false);
+    }
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> pick(0, data.getSize() - 1);
+    std::ofstream fout = openModel(path);
+    fout << data.getSize() << " " << dim << " " << codelen << " " << bitsPerSubspace << "\n";
+    std::vector<float> mean = columnMean(data);
+    writeRow(fout, &mean[0], dim);
+    const unsigned subDim = dim / numSubspaces;
+    std::vector<float> center(subDim);
+    for (unsigned m = 0; m < numSubspaces; ++m) {
+        for (unsigned c = 0; c < (1u << bitsPerSubspace); ++c) {
+            const DATATYPE* item = data[pick(rng)];
+            for (unsigned j = 0; j < subDim; ++j) {
+                center[j] = item[m * subDim + j] - mean[m * subDim + j];
+            }
+            writeRow(fout, &center[0], subDim);
+        }
+    }
+    std::vector<float> row(dim);
+    for (unsigned r = 0; r < dim; ++r) {
+        std::fill(row.begin(), row.end(), 0);
+        row[r] = 1;
+        writeRow(fout, &row[0], dim);
+    }
+}
+
+/*
+ * The base bits file of a hasher with a loaded model: the codes of all items
+ * of table 0, then of table 1, and so on, one code per line.
+ * */
+template<typename LSHTYPE, typename DATATYPE>
+void writeBaseBits(const LSHTYPE& mylsh, unsigned numTables, const Matrix<DATATYPE>& data, const std::string& path) {
+    std::ofstream fout(path.c_str());
+    if (!fout) {
+        std::cerr << "cannot open file " << path << std::endl;
+        assert(false);
+    }
+    std::string line;
+    for (unsigned t = 0; t < numTables; ++t) {
+        for (int i = 0; i < data.getSize(); ++i) {
+            std::vector<bool> bits = mylsh.getHashBits(t, data[i]);
+            line.clear();
+            for (unsigned b = 0; b < bits.size(); ++b) {
+                line += b ? (bits[b] ? " 1" : " 0") : (bits[b] ? "1" : "0");
+            }
+            fout << line << "\n";
+        }
+    }
+}
+
+/*
+ * Index data with the model in modelFile: hash the items with the model
+ * alone, write their codes to bitsFile and load mylsh from both files.
+ * */
+template<typename LSHTYPE, typename DATATYPE>
+void buildIndex(LSHTYPE& mylsh, unsigned numTables, const Matrix<DATATYPE>& data, const std::string& modelFile, const std::string& bitsFile) {
+    {
+        // a hasher without tables, its model is all the codes need
+        std::ofstream(bitsFile.c_str());
+        LSHTYPE encoder;
+        encoder.loadModel(modelFile, bitsFile);
+        writeBaseBits(encoder, numTables, data, bitsFile);
+    }
+    mylsh.loadModel(modelFile, bitsFile);
+}
+}
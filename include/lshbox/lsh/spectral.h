@@ -37,6 +37,11 @@ namespace lshbox
 
         void loadModel(const string& modelFile, const string& baseBitsFile);
 
+        size_t modelBytes() const override {
+            return lshbox::heapBytes(pcsAll) + lshbox::heapBytes(mean) + lshbox::heapBytes(mn) + lshbox::heapBytes(mx)
+                + lshbox::heapBytes(omegas) + lshbox::heapBytes(modes);
+        }
+
     private:
         vector<vector<vector<float> > > pcsAll;
         vector<float > mean;
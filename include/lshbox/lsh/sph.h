@@ -26,6 +26,10 @@ public:
 
     void loadModel(const string& modelFile, const string& baseBitsFile); 
 
+    size_t modelBytes() const override {
+        return lshbox::heapBytes(pivots) + lshbox::heapBytes(thresholds);
+    }
+
 private:
     std::vector<std::vector<std::vector<DATATYPE>>> pivots;  // L hash tabels, c pivots, each with d dimensions
     std::vector<std::vector<float>> thresholds;
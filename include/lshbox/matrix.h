@@ -33,6 +33,11 @@
 #include <string.h>
 #include <cmath>
 #include <iostream>
+#include <algorithm>
+#include "lshbox/visited.h"
+#include "lshbox/arena.h"
+#include "lshbox/memory.h"
+#include "lshbox/simd/distance.h"
 namespace lshbox
 {
 /**
@@ -48,6 +53,12 @@ class Matrix
     int dim;
     int N;
     T *dims;
+    // dims is on huge pages, see lshbox::hugePages()
+    bool huge_;
+    // L2 norm of each vector, empty until calNorms() or normalize()
+    std::vector<float> norms_;
+    // column j holds original dimension dimOrder_[j], empty if not permuted
+    std::vector<unsigned> dimOrder_;
 public:
     /**
      * Reset the size.
@@ -57,16 +68,18 @@ public:
      */
     void reset(int _dim, int _N)
     {
-        dim = _dim;
-        N = _N;
         if (dims != NULL)
         {
-            delete [] dims;
+            freePages(dims, sizeof(T) * dim * N, huge_);
         }
-        dims = new T[dim * N];
+        dim = _dim;
+        N = _N;
+        norms_.clear();
+        dimOrder_.clear();
+        dims = static_cast<T *>(allocPages(sizeof(T) * dim * N, huge_));
     }
-    Matrix(): dim(0), N(0), dims(NULL) {}
-    Matrix(int _dim, int _N): dims(NULL)
+    Matrix(): dim(0), N(0), dims(NULL), huge_(false) {}
+    Matrix(int _dim, int _N): dims(NULL), huge_(false)
     {
         reset(_dim, _N);
     }
@@ -74,7 +87,7 @@ public:
     {
         if (dims != NULL)
         {
-            delete [] dims;
+            freePages(dims, sizeof(T) * dim * N, huge_);
         }
     }
     /**
@@ -105,6 +118,13 @@ public:
     {
         return N;
     }
+    /**
+     * Bytes held by the vectors, their cached norms and the dimension order.
+     */
+    size_t memoryBytes() const
+    {
+        return sizeof(T) * dim * N + heapBytes(norms_) + heapBytes(dimOrder_);
+    }
     /**
      * Get the data.
      */
@@ -157,70 +177,201 @@ public:
         os.write((char *)dims, sizeof(T) * dim * N);
         os.close();
     }
-    Matrix(const std::string &path): dims(NULL)
+    Matrix(const std::string &path): dims(NULL), huge_(false)
     {
         load(path);
     }
-    Matrix(const Matrix& M): dims(NULL)
+    Matrix(const Matrix& M): dims(NULL), huge_(false)
     {
         reset(M.getDim(), M.getSize());
         memcpy(dims, M.getData(), sizeof(T) * dim * N);
+        norms_ = M.norms_;
+        dimOrder_ = M.dimOrder_;
     }
     Matrix& operator = (const Matrix& M)
     {
         dims = NULL;
         reset(M.getDim(), M.getSize());
         memcpy(dims, M.getData(), sizeof(T) * dim * N);
+        norms_ = M.norms_;
+        dimOrder_ = M.dimOrder_;
         return *this;
     }
 
-    std::vector<float> calNorms() {
-        std::vector<float> results(this->getSize());
-        float norm;
-        for (int i = 0; i < results.size(); ++i) {
-            norm = 0;
-            for (int idx = 0; idx < this->getDim(); ++idx) {
-                norm += (*this)[i][idx] * (*this)[i][idx];
+    /**
+     * Compute and cache the L2 norm of every vector.
+     */
+    const std::vector<float>& calNorms() {
+        norms_.resize(this->getSize());
+        typename simd::KernelSet<T>::Func dot = simd::KernelSet<T>::get().dot;
+        for (int i = 0; i < N; ++i) {
+            norms_[i] = std::sqrt(dot((*this)[i], (*this)[i], dim));
+        }
+        return norms_;
+    }
+
+    /**
+     * Scale every vector to unit length in place, zero vectors are left as
+     * they are. Angular distances are unchanged.
+     */
+    void normalize() {
+        calNorms();
+        for (int i = 0; i < N; ++i) {
+            if (norms_[i] > 0) {
+                T *vec = (*this)[i];
+                for (int idx = 0; idx < dim; ++idx) {
+                    vec[idx] /= norms_[i];
+                }
+                norms_[i] = 1;
             }
-            results[i] = sqrt(norm);
         }
-        return results;
+    }
+
+    /**
+     * Dimensions sorted by decreasing variance over all vectors.
+     */
+    std::vector<unsigned> dimsByVariance() const {
+        std::vector<double> sum(dim, 0), sqrSum(dim, 0);
+        for (int i = 0; i < N; ++i) {
+            const T *vec = (*this)[i];
+            for (int idx = 0; idx < dim; ++idx) {
+                sum[idx] += vec[idx];
+                sqrSum[idx] += (double)vec[idx] * vec[idx];
+            }
+        }
+        std::vector<double> variance(dim);
+        for (int idx = 0; idx < dim; ++idx) {
+            double mean = sum[idx] / N;
+            variance[idx] = sqrSum[idx] / N - mean * mean;
+        }
+        std::vector<unsigned> order(dim);
+        for (int idx = 0; idx < dim; ++idx) {
+            order[idx] = idx;
+        }
+        std::stable_sort(order.begin(), order.end(), [&variance](unsigned a, unsigned b) {
+            return variance[a] > variance[b];
+        });
+        return order;
+    }
+
+    /**
+     * Reorder the dimensions of every vector in place, column j becomes the
+     * original dimension order[j]. Queries are permuted the same way by the
+     * scanner, so L1, L2, angular and inner product distances are unchanged.
+     * Only verification reads the permuted rows: hash models are trained on
+     * the original order, so code that hashes a base vector must take it
+     * from originalRow().
+     */
+    void permuteDims(const std::vector<unsigned>& order) {
+        assert(order.size() == (unsigned)dim);
+        std::vector<T> buffer(dim);
+        for (int i = 0; i < N; ++i) {
+            T *vec = (*this)[i];
+            for (int idx = 0; idx < dim; ++idx) {
+                buffer[idx] = vec[order[idx]];
+            }
+            std::copy(buffer.begin(), buffer.end(), vec);
+        }
+        if (dimOrder_.empty()) {
+            dimOrder_ = order;
+        } else {
+            std::vector<unsigned> composed(dim);
+            for (int idx = 0; idx < dim; ++idx) {
+                composed[idx] = dimOrder_[order[idx]];
+            }
+            dimOrder_ = composed;
+        }
+    }
+
+    /**
+     * Row i in the original dimension order, as the hash model sees it.
+     * Returns the row itself if the dimensions were never permuted, else
+     * fills buffer.
+     */
+    const T *originalRow(int i, std::vector<T>& buffer) const {
+        if (dimOrder_.empty()) {
+            return (*this)[i];
+        }
+        buffer.resize(dim);
+        const T *vec = (*this)[i];
+        for (int idx = 0; idx < dim; ++idx) {
+            buffer[dimOrder_[idx]] = vec[idx];
+        }
+        return &buffer[0];
+    }
+
+    /**
+     * The permutation applied by permuteDims(), empty if none.
+     */
+    const std::vector<unsigned>& getDimOrder() const {
+        return dimOrder_;
+    }
+
+    /**
+     * The cached norms, empty if calNorms() was never called.
+     */
+    const std::vector<float>& getNorms() const {
+        return norms_;
     }
 
 
     /**
      * An accessor class to be used with LSH index.
+     *
+     * The visited set scales with the number of candidates of a query, see
+     * lshbox::VisitedSet.
      */
     class Accessor
     {
         const Matrix &matrix_;
-        std::vector<bool> flags_;
+        VisitedSet visited_;
     public:
         typedef unsigned Key;
         typedef const T *Value;
         typedef T DATATYPE;
-        Accessor(const Matrix &matrix): matrix_(matrix)
+        Accessor(const Matrix &matrix): matrix_(matrix), visited_(matrix.getSize()) {}
+        /**
+         * Clear the visited set.
+         *
+         * @param expected The expected number of candidates, 0 if unknown.
+         */
+        void reset(unsigned expected = 0)
         {
-            flags_.resize(matrix_.getSize());
-        }
-        void reset()
-        {
-            flags_.clear();
-            flags_.resize(matrix_.getSize());
+            visited_.reset(expected);
         }
         bool mark(unsigned key)
         {
-            if (flags_[key])
-            {
-                return false;
-            }
-            flags_[key] = true;
-            return true;
+            return visited_.mark(key);
         }
         const T *operator () (unsigned key) const
         {
             return matrix_[key];
         }
+        /**
+         * Bytes of the visited set, the matrix is not included.
+         */
+        size_t memoryBytes() const
+        {
+            return visited_.memoryBytes();
+        }
+        /**
+         * Whether the matrix has cached norms, see Matrix::calNorms().
+         */
+        bool hasNorms() const
+        {
+            return !matrix_.getNorms().empty();
+        }
+        float norm(unsigned key) const
+        {
+            return matrix_.getNorms()[key];
+        }
+        /**
+         * The permutation of the dimensions, see Matrix::permuteDims().
+         */
+        const std::vector<unsigned> &dimOrder() const
+        {
+            return matrix_.getDimOrder();
+        }
     };
 
     template<typename DATATYPE>
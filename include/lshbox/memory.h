@@ -0,0 +1,212 @@
+/**
+ * @file memory.h
+ *
+ * @brief Byte accounting of the datasets, the index and the per-query state,
+ * printed by search --memory_report=true.
+ *
+ * Container sizes are estimates of what the allocator hands out: capacity
+ * times element size for vectors, plus one node per entry and the bucket
+ * array for unordered maps as laid out by libstdc++ (hash code cached), every
+ * heap block rounded up as by glibc malloc.
+ */
+#pragma once
+#include <vector>
+#include <queue>
+#include <unordered_map>
+#include <string>
+#include <ostream>
+#include <fstream>
+#include <cstddef>
+#include <cstdlib>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/resource.h>
+namespace lshbox
+{
+/**
+ * Bytes taken by a malloc of n bytes, chunk header and alignment included.
+ */
+inline size_t mallocBytes(size_t n)
+{
+    if (n == 0)
+    {
+        return 0;
+    }
+    size_t chunk = (n + sizeof(size_t) + 15) & ~(size_t)15;
+    return chunk < 32 ? 32 : chunk;
+}
+
+template <typename T>
+size_t heapBytes(const T &);
+template <typename T, typename A>
+size_t heapBytes(const std::vector<T, A> &v);
+template <typename A>
+size_t heapBytes(const std::vector<bool, A> &v);
+template <typename T, typename C, typename P>
+size_t heapBytes(const std::priority_queue<T, C, P> &q);
+template <typename K, typename V, typename H, typename E, typename A>
+size_t heapBytes(const std::unordered_map<K, V, H, E, A> &m);
+
+/**
+ * Heap bytes owned by a value, 0 for anything but the containers below.
+ */
+template <typename T>
+inline size_t heapBytes(const T &)
+{
+    return 0;
+}
+template <typename T, typename A>
+inline size_t heapBytes(const std::vector<T, A> &v)
+{
+    size_t bytes = mallocBytes(v.capacity() * sizeof(T));
+    for (const T &x : v)
+    {
+        bytes += heapBytes(x);
+    }
+    return bytes;
+}
+template <typename A>
+inline size_t heapBytes(const std::vector<bool, A> &v)
+{
+    return mallocBytes((v.capacity() + 7) / 8);
+}
+template <typename T, typename C, typename P>
+inline size_t heapBytes(const std::priority_queue<T, C, P> &q)
+{
+    // the container is a protected member
+    struct Access: std::priority_queue<T, C, P>
+    {
+        static const C &container(const std::priority_queue<T, C, P> &q)
+        {
+            return q.*(&Access::c);
+        }
+    };
+    return heapBytes(Access::container(q));
+}
+template <typename K, typename V, typename H, typename E, typename A>
+inline size_t heapBytes(const std::unordered_map<K, V, H, E, A> &m)
+{
+    // node: next pointer, the pair and the cached hash code
+    size_t node = mallocBytes(sizeof(void *) + sizeof(std::pair<const K, V>) + sizeof(size_t));
+    size_t bytes = mallocBytes(m.bucket_count() * sizeof(void *)) + m.size() * node;
+    for (const auto &entry : m)
+    {
+        bytes += heapBytes(entry.second);
+    }
+    return bytes;
+}
+
+/**
+ * Bytes of a hash table of the index: the keys, the postings (item ids) and
+ * the rest, i.e. map nodes, bucket array, vector headers, spare capacity and
+ * allocator overhead.
+ */
+struct TableMemory
+{
+    size_t keys;
+    size_t postings;
+    size_t overhead;
+    size_t total() const
+    {
+        return keys + postings + overhead;
+    }
+};
+
+template <typename K, typename V, typename H, typename E, typename A>
+TableMemory tableMemory(const std::unordered_map<K, std::vector<V>, H, E, A> &table)
+{
+    TableMemory memory;
+    memory.keys = table.size() * sizeof(K);
+    memory.postings = 0;
+    for (const auto &entry : table)
+    {
+        memory.postings += entry.second.size() * sizeof(V);
+    }
+    memory.overhead = heapBytes(table) - memory.keys - memory.postings;
+    return memory;
+}
+
+/**
+ * Current resident set size of the process, 0 without /proc.
+ */
+inline size_t currentRssBytes()
+{
+    std::ifstream fin("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+    if (!(fin >> pages >> resident))
+    {
+        return 0;
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * Peak resident set size of the process so far. VmHWM of /proc/self/status
+ * is preferred to getrusage(), whose ru_maxrss is updated lazily, and the
+ * result is never below currentRssBytes().
+ */
+inline size_t peakRssBytes()
+{
+    size_t peak = 0;
+    std::ifstream fin("/proc/self/status");
+    std::string line;
+    while (std::getline(fin, line))
+    {
+        if (line.compare(0, 6, "VmHWM:") == 0)
+        {
+            // in kB
+            peak = std::strtoull(line.c_str() + 6, NULL, 10) * 1024;
+            break;
+        }
+    }
+    if (peak == 0)
+    {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        // kilobytes on Linux
+        peak = (size_t)usage.ru_maxrss * 1024;
+    }
+    return std::max(peak, currentRssBytes());
+}
+
+/**
+ * Named byte counts printed as "MEMORY    , name, bytes, MB" lines.
+ */
+class MemoryReport
+{
+public:
+    void add(const std::string &name, size_t bytes)
+    {
+        entries_.push_back(std::make_pair(name, bytes));
+    }
+    size_t total() const
+    {
+        size_t bytes = 0;
+        for (const auto &entry : entries_)
+        {
+            bytes += entry.second;
+        }
+        return bytes;
+    }
+    /**
+     * Print the entries, and their sum as total if there is more than one.
+     */
+    void print(std::ostream &os) const
+    {
+        for (const auto &entry : entries_)
+        {
+            line(os, entry.first, entry.second);
+        }
+        if (entries_.size() > 1)
+        {
+            line(os, "total", total());
+        }
+    }
+    static void line(std::ostream &os, const std::string &name, size_t bytes)
+    {
+        os << "MEMORY    , " << name << ", " << bytes << " bytes, " << bytes / 1048576.0 << " MB" << std::endl;
+    }
+private:
+    std::vector<std::pair<std::string, size_t> > entries_;
+};
+}
@@ -28,6 +28,9 @@
  */
 #pragma once
 #include <cmath>
+#include <cassert>
+#include <algorithm>
+#include "lshbox/simd/distance.h"
 namespace lshbox
 {
 #define L1_DIST 1
@@ -44,20 +47,76 @@ DATATYPE sqr(const DATATYPE &x)
 }
 /**
  * Use for common distance functions.
+ *
+ * The distance type is chosen at runtime, the kernel is bound once in the
+ * constructor so dist() is a single indirect call. dist() returns a ranking
+ * distance, monotone in the real one, and finalize() converts it, so sqrt and
+ * acos are only paid once per result.
  */
 template <typename DATATYPE>
 class Metric
 {
-    unsigned type_;
+    typedef typename simd::KernelSet<DATATYPE>::Func Kernel;
+    typedef typename simd::KernelSet<DATATYPE>::BoundedFunc BoundedKernel;
+    typedef typename simd::KernelSet<DATATYPE>::ManyFunc ManyKernel;
     unsigned dim_;
+    unsigned type_;
+    Kernel kernel_;
+    Kernel dot_;
+    // IP_DIST negates the dot products of many_
+    ManyKernel many_;
+    ManyKernel dotMany_;
+    // NULL if the distance cannot be abandoned early
+    BoundedKernel bounded_;
+
+    static Kernel bind(unsigned type)
+    {
+        const simd::KernelSet<DATATYPE> &kernels = simd::KernelSet<DATATYPE>::get();
+        switch (type)
+        {
+        case L1_DIST:
+            return kernels.l1;
+        case L2_DIST:
+            return kernels.l2sqr;
+        case AG_DIST:
+            return kernels.cosine;
+        case IP_DIST:
+            return kernels.negDot;
+        default:
+            assert(false);
+            return NULL;
+        }
+    }
+    static ManyKernel bindMany(unsigned type)
+    {
+        const simd::KernelSet<DATATYPE> &kernels = simd::KernelSet<DATATYPE>::get();
+        switch (type)
+        {
+        case L1_DIST:
+            return kernels.l1Many;
+        case L2_DIST:
+            return kernels.l2sqrMany;
+        case AG_DIST:
+            return kernels.cosineMany;
+        case IP_DIST:
+            return kernels.dotMany;
+        default:
+            assert(false);
+            return NULL;
+        }
+    }
 public:
     /**
      * Constructor for this class.
      *
      * @param dim  Dimension of each vector
-     * @param type The way to measure the distance, you can choose 1(L1_DIST) or 2(L2_DIST)
+     * @param type The way to measure the distance, L1_DIST, L2_DIST, AG_DIST or IP_DIST
      */
-    Metric(unsigned dim, unsigned type): dim_(dim), type_(type) {}
+    Metric(unsigned dim, unsigned type): dim_(dim), type_(type), kernel_(bind(type)),
+        dot_(simd::KernelSet<DATATYPE>::get().dot),
+        many_(bindMany(type)), dotMany_(simd::KernelSet<DATATYPE>::get().dotMany),
+        bounded_(type == L1_DIST ? simd::KernelSet<DATATYPE>::get().l1Bounded
+                 : type == L2_DIST ? simd::KernelSet<DATATYPE>::get().l2sqrBounded : NULL) {}
     ~Metric() {}
     /**
      * Get the dimension of the vectors
@@ -66,59 +125,108 @@ public:
     {
         return dim_;
     }
+    unsigned type() const
+    {
+        return type_;
+    }
     /**
-     * measure the distance.
+     * measure the ranking distance, see finalize().
      *
      * @param  vec1 The first vector
      * @param  vec2 The second vector
-     * @return      The distance
+     * @return      The distance, squared for L2_DIST and 1 - cos for AG_DIST
      */
     float dist(const DATATYPE *vec1, const DATATYPE *vec2) const
     {
-        float dist_ = 0.0;
-        switch (type_)
-        {
-        case L1_DIST:
+        return kernel_(vec1, vec2, dim_);
+    }
+    /**
+     * measure the ranking distance with the L2 norms of both vectors known,
+     * for AG_DIST this is a single dot product.
+     */
+    float dist(const DATATYPE *vec1, float norm1, const DATATYPE *vec2, float norm2) const
+    {
+        if (type_ == AG_DIST)
         {
-            for (unsigned i = 0; i != dim_; ++i)
-            {
-                dist_ += float(std::abs(vec1[i] * 1.0 - vec2[i]));
-            }
-            return dist_;
+            return 1 - dot_(vec1, vec2, dim_) / (norm1 * norm2);
         }
-        case L2_DIST:
+        return kernel_(vec1, vec2, dim_);
+    }
+    /**
+     * The L2 norm of a vector.
+     */
+    float norm(const DATATYPE *vec) const
+    {
+        return std::sqrt(dot_(vec, vec, dim_));
+    }
+    /**
+     * Whether distBounded() can stop before reading all dimensions.
+     */
+    bool canAbandon() const
+    {
+        return bounded_ != NULL;
+    }
+    /**
+     * measure the ranking distance, but stop once it exceeds bound.
+     *
+     * @param  bound   The distance a candidate has to beat
+     * @param  touched Set to the number of dimensions read
+     * @return         The distance, or a partial sum above bound
+     */
+    float distBounded(const DATATYPE *vec1, const DATATYPE *vec2, float bound, unsigned *touched) const
+    {
+        if (bounded_ == NULL)
         {
-            for (unsigned i = 0; i != dim_; ++i)
-            {
-                dist_ += sqr(vec1[i] - vec2[i]);
-            }
-            return std::sqrt(dist_);
+            *touched = dim_;
+            return kernel_(vec1, vec2, dim_);
         }
-        case AG_DIST:
+        return bounded_(vec1, vec2, dim_, bound, touched);
+    }
+    /**
+     * measure the ranking distances of vec1 to n vectors at once.
+     *
+     * @param out Set to dist(vec1, vecs[i]) for i < n
+     */
+    void distMany(const DATATYPE *vec1, const DATATYPE *const *vecs, unsigned n, float *out) const
+    {
+        many_(vec1, vecs, n, dim_, out);
+        if (type_ == IP_DIST)
         {
-            float norm_1 = 0.0;
-            float norm_2 = 0.0;
-            for (unsigned i = 0; i != dim_; ++i)
+            for (unsigned i = 0; i != n; ++i)
             {
-                dist_ += vec1[i] * vec2[i];
-                norm_1 += sqr(vec1[i]);
-                norm_2 += sqr(vec2[i]);
+                out[i] = -out[i];
             }
-            return acos( dist_ / std::sqrt(norm_1*norm_2) );
         }
-        case IP_DIST:
+    }
+    /**
+     * distMany() with the L2 norms of all vectors known, see dist().
+     */
+    void distMany(const DATATYPE *vec1, float norm1, const DATATYPE *const *vecs, const float *norms, unsigned n, float *out) const
+    {
+        if (type_ != AG_DIST)
         {
-            for (unsigned i = 0; i != dim_; ++i)
-            {
-                dist_ += vec1[i] * vec2[i];
-            }
-            return - dist_;
+            distMany(vec1, vecs, n, out);
+            return;
         }
-
-        default:
+        dotMany_(vec1, vecs, n, dim_, out);
+        for (unsigned i = 0; i != n; ++i)
         {
-            assert(false);
+            out[i] = 1 - out[i] / (norm1 * norms[i]);
         }
+    }
+    /**
+     * Convert a ranking distance to the distance of the metric.
+     */
+    float finalize(float dist) const
+    {
+        switch (type_)
+        {
+        case L2_DIST:
+            return std::sqrt(dist);
+        case AG_DIST:
+            return std::acos(std::max(-1.0f, std::min(1.0f, 1 - dist)));
+        default:
+            return dist;
         }
     }
 };
@@ -0,0 +1,410 @@
+/**
+ * @file perfcounters.h
+ *
+ * @brief Hardware performance counters of the query phases, read through
+ * Linux perf_event_open.
+ *
+ * startPerf() enables the PerfScope of the hot path: the first scope of a
+ * thread opens one counter group for it, every scope reads the group when it
+ * begins and ends and adds the difference to its phase, a scope inside
+ * another one is not counted separately. Only user space is counted, so the
+ * read() of the counters adds little to the counts, but the wall time grows
+ * by two system calls per scope. Events the kernel or the CPU does not offer
+ * (perf_event_paranoid > 2, no PMU in a virtual machine) are reported as n/a.
+ * While disabled a scope costs one branch.
+ */
+#pragma once
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <ostream>
+#include <cstring>
+#include <cerrno>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+namespace lshbox
+{
+class PerfCounters
+{
+public:
+    enum Event
+    {
+        CYCLES,
+        INSTRUCTIONS,
+        LLC_MISSES,
+        DTLB_MISSES,   // data TLB load misses
+        BRANCH_MISSES,
+        TASK_CLOCK,    // ns on the CPU, a software event that includes the reads
+        NUM_EVENTS
+    };
+
+    enum Phase
+    {
+        ENCODE,   // hash values and bits of the query
+        GENERATE, // per-table probing state and getNextBID()
+        VERIFY,   // bucket lookup and the scanner
+        NUM_PHASES
+    };
+
+    static const char *name(Event event)
+    {
+        static const char *names[NUM_EVENTS] = {
+            "cycles", "instructions", "LLC misses", "dTLB misses", "branch misses", "task clock ns"};
+        return names[event];
+    }
+
+    static const char *name(Phase phase)
+    {
+        static const char *names[NUM_PHASES] = {"encode", "generate", "verify"};
+        return names[phase];
+    }
+
+    // the counters of the calling thread, in one group if possible
+    PerfCounters(): leader_(-1), error_(0)
+    {
+        for (unsigned e = 0; e != NUM_EVENTS; ++e)
+        {
+            slot_[e] = -1;
+            struct perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            config(Event(e), attr);
+            int fd = syscall(SYS_perf_event_open, &attr, 0, -1, leader_, 0);
+            if (fd < 0)
+            {
+                error_ = errno;
+                continue;
+            }
+            if (leader_ < 0)
+            {
+                leader_ = fd;
+            }
+            slot_[e] = fds_.size();
+            fds_.push_back(fd);
+        }
+    }
+
+    ~PerfCounters()
+    {
+        for (int fd : fds_)
+        {
+            close(fd);
+        }
+    }
+
+    bool opened(Event event) const
+    {
+        return slot_[event] >= 0;
+    }
+
+    // errno of the last event that failed to open, 0 if none did
+    int error() const
+    {
+        return error_;
+    }
+
+    /**
+     * Counts since the group was opened, scaled up by the time it was
+     * scheduled if the PMU multiplexed it with other groups.
+     */
+    void read(uint64_t values[NUM_EVENTS]) const
+    {
+        std::memset(values, 0, sizeof(uint64_t) * NUM_EVENTS);
+        if (leader_ < 0)
+        {
+            return;
+        }
+        // nr, time enabled, time running, one value per event
+        uint64_t buffer[3 + NUM_EVENTS];
+        if (::read(leader_, buffer, sizeof(buffer)) < (ssize_t)(3 * sizeof(uint64_t)))
+        {
+            return;
+        }
+        double scale = buffer[2] != 0 && buffer[2] < buffer[1] ? (double)buffer[1] / buffer[2] : 1;
+        for (unsigned e = 0; e != NUM_EVENTS; ++e)
+        {
+            if (slot_[e] >= 0 && (uint64_t)slot_[e] < buffer[0])
+            {
+                values[e] = (uint64_t)(buffer[3 + slot_[e]] * scale);
+            }
+        }
+    }
+
+private:
+    static void config(Event event, struct perf_event_attr &attr)
+    {
+        switch (event)
+        {
+        case CYCLES:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case INSTRUCTIONS:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case LLC_MISSES:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            break;
+        case DTLB_MISSES:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        case BRANCH_MISSES:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+            break;
+        default:
+            attr.type = PERF_TYPE_SOFTWARE;
+            attr.config = PERF_COUNT_SW_TASK_CLOCK;
+            break;
+        }
+    }
+
+    PerfCounters(const PerfCounters &);
+    PerfCounters &operator=(const PerfCounters &);
+
+    int leader_;
+    int error_;
+    int slot_[NUM_EVENTS]; // index in the group, -1 if not opened
+    std::vector<int> fds_;
+};
+
+/**
+ * Counts per phase, summed over scopes and threads.
+ */
+struct PerfTotals
+{
+    uint64_t values[PerfCounters::NUM_PHASES][PerfCounters::NUM_EVENTS];
+    uint64_t scopes[PerfCounters::NUM_PHASES];
+    bool opened[PerfCounters::NUM_EVENTS]; // on some thread
+    int error;
+
+    PerfTotals()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        std::memset(values, 0, sizeof(values));
+        std::memset(scopes, 0, sizeof(scopes));
+        std::memset(opened, 0, sizeof(opened));
+        error = 0;
+    }
+
+    void add(const PerfTotals &other)
+    {
+        for (unsigned p = 0; p != PerfCounters::NUM_PHASES; ++p)
+        {
+            for (unsigned e = 0; e != PerfCounters::NUM_EVENTS; ++e)
+            {
+                values[p][e] += other.values[p][e];
+            }
+            scopes[p] += other.scopes[p];
+        }
+        for (unsigned e = 0; e != PerfCounters::NUM_EVENTS; ++e)
+        {
+            opened[e] = opened[e] || other.opened[e];
+        }
+        if (other.error != 0)
+        {
+            error = other.error;
+        }
+    }
+
+    /**
+     * One "PERF" line per phase, counts divided by per, e.g. the number of
+     * queries, and the instructions per cycle.
+     */
+    void print(std::ostream &os, double per = 1) const
+    {
+        if (error != 0)
+        {
+            os << "PERF    , some events failed to open: " << std::strerror(error)
+                << ", check /proc/sys/kernel/perf_event_paranoid, virtual machines may have no PMU" << std::endl;
+        }
+        os << "PERF    , phase, scopes";
+        for (unsigned e = 0; e != PerfCounters::NUM_EVENTS; ++e)
+        {
+            os << ", " << PerfCounters::name(PerfCounters::Event(e));
+        }
+        os << ", IPC" << std::endl;
+        for (unsigned p = 0; p != PerfCounters::NUM_PHASES; ++p)
+        {
+            os << "PERF    , " << PerfCounters::name(PerfCounters::Phase(p)) << ", " << scopes[p] / per;
+            for (unsigned e = 0; e != PerfCounters::NUM_EVENTS; ++e)
+            {
+                if (opened[e])
+                {
+                    os << ", " << values[p][e] / per;
+                }
+                else
+                {
+                    os << ", n/a";
+                }
+            }
+            const uint64_t cycles = values[p][PerfCounters::CYCLES];
+            if (opened[PerfCounters::CYCLES] && opened[PerfCounters::INSTRUCTIONS] && cycles != 0)
+            {
+                os << ", " << (double)values[p][PerfCounters::INSTRUCTIONS] / cycles;
+            }
+            else
+            {
+                os << ", n/a";
+            }
+            os << std::endl;
+        }
+    }
+};
+
+// counters and totals of one thread, the totals outlive the thread
+struct PerfThread
+{
+    PerfCounters counters;
+    std::shared_ptr<PerfTotals> totals;
+    bool inScope;
+};
+
+struct PerfState
+{
+    std::atomic<bool> enabled;
+    std::mutex mutex; // guards threads
+    std::vector<std::shared_ptr<PerfTotals> > threads;
+    PerfState(): enabled(false) {}
+};
+
+inline PerfState &perfState()
+{
+    static PerfState state;
+    return state;
+}
+
+inline bool perfEnabled()
+{
+    return perfState().enabled.load(std::memory_order_relaxed);
+}
+
+inline PerfThread &threadPerf()
+{
+    static thread_local std::unique_ptr<PerfThread> perf;
+    if (!perf)
+    {
+        perf.reset(new PerfThread());
+        perf->totals = std::make_shared<PerfTotals>();
+        perf->inScope = false;
+        for (unsigned e = 0; e != PerfCounters::NUM_EVENTS; ++e)
+        {
+            perf->totals->opened[e] = perf->counters.opened(PerfCounters::Event(e));
+        }
+        perf->totals->error = perf->counters.error();
+        PerfState &state = perfState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.threads.push_back(perf->totals);
+    }
+    return *perf;
+}
+
+/**
+ * Adds the counts from construction to destruction to phase.
+ */
+class PerfScope
+{
+public:
+    explicit PerfScope(PerfCounters::Phase phase): on_(perfEnabled())
+    {
+        if (on_)
+        {
+            begin(phase);
+        }
+    }
+
+    ~PerfScope()
+    {
+        if (on_)
+        {
+            end();
+        }
+    }
+
+private:
+    void begin(PerfCounters::Phase phase)
+    {
+        PerfThread &perf = threadPerf();
+        if (perf.inScope)
+        {
+            on_ = false;
+            return;
+        }
+        perf.inScope = true;
+        phase_ = phase;
+        perf.counters.read(start_);
+    }
+
+    void end()
+    {
+        PerfThread &perf = threadPerf();
+        uint64_t now[PerfCounters::NUM_EVENTS];
+        perf.counters.read(now);
+        PerfTotals &totals = *perf.totals;
+        for (unsigned e = 0; e != PerfCounters::NUM_EVENTS; ++e)
+        {
+            // scaled counts of a multiplexed group may step back
+            totals.values[phase_][e] += now[e] > start_[e] ? now[e] - start_[e] : 0;
+        }
+        ++totals.scopes[phase_];
+        perf.inScope = false;
+    }
+
+    bool on_;
+    PerfCounters::Phase phase_;
+    uint64_t start_[PerfCounters::NUM_EVENTS];
+};
+
+/**
+ * Enable the scopes and drop the counts of an earlier run.
+ */
+inline void startPerf()
+{
+    PerfState &state = perfState();
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        for (const std::shared_ptr<PerfTotals> &totals : state.threads)
+        {
+            // keep which events the thread could open
+            PerfTotals cleared;
+            std::memcpy(cleared.opened, totals->opened, sizeof(cleared.opened));
+            cleared.error = totals->error;
+            *totals = cleared;
+        }
+    }
+    state.enabled = true;
+}
+
+// call it once the threads of the scopes are done
+inline void stopPerf()
+{
+    perfState().enabled = false;
+}
+
+// the counts of all threads
+inline PerfTotals perfTotals()
+{
+    PerfState &state = perfState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    PerfTotals sum;
+    for (const std::shared_ptr<PerfTotals> &totals : state.threads)
+    {
+        sum.add(*totals);
+    }
+    return sum;
+}
+}
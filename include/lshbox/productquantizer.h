@@ -0,0 +1,452 @@
+/**
+ * @file productquantizer.h
+ *
+ * @brief Product quantization (PQ) and optimized PQ (OPQ) of a base set, used
+ * to score candidates by asymmetric distance computation (ADC).
+ *
+ * The (optionally rotated) space is split into M subspaces, each quantized by
+ * k-means to 16 (4-bit codes) or 256 (8-bit codes) centroids. A query builds
+ * a table of its distance to every centroid once, after which a candidate
+ * costs M table lookups whatever the dimension, and the float base is only
+ * read again by the optional exact re-rank.
+ *
+ * OPQ alternates between training the codebooks and solving the orthogonal
+ * Procrustes problem for the rotation R that minimizes |XR - Y|, Y being the
+ * reconstruction of XR.
+ */
+#pragma once
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <limits>
+#include <cmath>
+#include <algorithm>
+#include <assert.h>
+#include <stdint.h>
+#include <eigen/Eigen/Dense>
+#include "lshbox/matrix.h"
+#include "lshbox/metric.h"
+#include "lshbox/quantizer.h"
+#include "lshbox/simd/distance.h"
+#include "lshbox/simd/adc.h"
+namespace lshbox
+{
+template <typename DATATYPE = float>
+class ProductQuantizer: public Quantizer<DATATYPE> {
+public:
+    typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMatrix;
+
+    ProductQuantizer(): dim_(0), dpad_(0), M_(0), nbits_(8), ksub_(256), dsub_(0), codeSize_(0), size_(0) {}
+
+    /**
+     * Train the codebooks (and the OPQ rotation) on a sample of data, then
+     * encode every vector of data.
+     *
+     * @param M           Number of subspaces
+     * @param nbits       Bits per subspace code, 4 or 8
+     * @param opqIters    Rotation updates of OPQ, 0 for plain PQ
+     * @param numTrain    Number of vectors sampled for training
+     * @param kmeansIters Lloyd iterations per k-means
+     */
+    void train(
+        const Matrix<DATATYPE> &data,
+        unsigned M,
+        unsigned nbits = 8,
+        unsigned opqIters = 0,
+        unsigned numTrain = 65536,
+        unsigned kmeansIters = 25,
+        unsigned seed = 0) {
+
+        assert(nbits == 4 || nbits == 8);
+        dim_ = data.getDim();
+        M_ = M;
+        nbits_ = nbits;
+        ksub_ = 1u << nbits;
+        dsub_ = (dim_ + M - 1) / M;
+        dpad_ = dsub_ * M;
+        codeSize_ = nbits == 8 ? M : (M + 1) / 2;
+
+        std::mt19937 rng(seed);
+        unsigned n = std::min<unsigned>(numTrain, data.getSize());
+        assert(n >= ksub_);
+        std::vector<unsigned> ids(data.getSize());
+        for (unsigned i = 0; i < ids.size(); ++i) {
+            ids[i] = i;
+        }
+        for (unsigned i = 0; i < n; ++i) {
+            std::uniform_int_distribution<unsigned> pick(i, ids.size() - 1);
+            std::swap(ids[i], ids[pick(rng)]);
+        }
+        RowMatrix X = RowMatrix::Zero(n, dpad_);
+        for (unsigned i = 0; i < n; ++i) {
+            for (unsigned d = 0; d < dim_; ++d) {
+                X(i, d) = data[ids[i]][d];
+            }
+        }
+
+        rotation_.resize(0, 0);
+        if (opqIters > 0) {
+            Eigen::MatrixXf R = Eigen::MatrixXf::Identity(dpad_, dpad_);
+            for (unsigned it = 0; it < opqIters; ++it) {
+                RowMatrix XR = X * R;
+                trainCodebooks(XR, kmeansIters, rng);
+                RowMatrix Y(n, dpad_);
+                std::vector<uint8_t> code(M_);
+                for (unsigned i = 0; i < n; ++i) {
+                    assign(XR.row(i).data(), &code[0]);
+                    for (unsigned m = 0; m < M_; ++m) {
+                        const float *c = centroid(m, code[m]);
+                        for (unsigned d = 0; d < dsub_; ++d) {
+                            Y(i, m * dsub_ + d) = c[d];
+                        }
+                    }
+                }
+                Eigen::MatrixXf XtY = X.transpose() * Y;
+                Eigen::JacobiSVD<Eigen::MatrixXf> svd(XtY, Eigen::ComputeFullU | Eigen::ComputeFullV);
+                R = svd.matrixU() * svd.matrixV().transpose();
+            }
+            rotation_ = R;
+            X = X * R;
+        }
+        trainCodebooks(X, kmeansIters, rng);
+        encode(data);
+    }
+
+    /**
+     * Encode every vector of data with the trained codebooks.
+     */
+    void encode(const Matrix<DATATYPE> &data) {
+        size_ = data.getSize();
+        codes_.assign((size_t)size_ * codeSize_, 0);
+        norms_.resize(size_);
+        std::vector<float> x(dpad_);
+        std::vector<uint8_t> code(M_);
+        for (unsigned i = 0; i < size_; ++i) {
+            transform(data[i], &x[0]);
+            assign(&x[0], &code[0]);
+            pack(&code[0], &codes_[(size_t)i * codeSize_]);
+            float sqrNorm = 0;
+            for (unsigned m = 0; m < M_; ++m) {
+                const float *c = centroid(m, code[m]);
+                for (unsigned d = 0; d < dsub_; ++d) {
+                    sqrNorm += c[d] * c[d];
+                }
+            }
+            norms_[i] = std::sqrt(sqrNorm);
+        }
+    }
+
+    /**
+     * Save codebooks, rotation and codes, so the base vectors are not needed
+     * to score candidates.
+     */
+    void save(const std::string &path) const {
+        std::ofstream os(path.c_str(), std::ios::binary);
+        unsigned header[HEADER_SIZE] = {MAGIC, VERSION, dim_, M_, nbits_, size_, (unsigned)rotation_.rows(), 0};
+        os.write((const char *)header, sizeof header);
+        os.write((const char *)rotation_.data(), sizeof(float) * rotation_.size());
+        os.write((const char *)&codebooks_[0], sizeof(float) * codebooks_.size());
+        os.write((const char *)&codes_[0], codes_.size());
+        os.write((const char *)&norms_[0], sizeof(float) * norms_.size());
+        os.close();
+    }
+
+    /**
+     * Load what save() wrote for the vectors of data. The header, the file
+     * size and the dimension and size of data are checked; on a mismatch the
+     * quantizer is left untrained and false is returned.
+     */
+    bool load(const std::string &path, const Matrix<DATATYPE> &data) {
+        dim_ = 0;
+        std::ifstream is(path.c_str(), std::ios::binary);
+        if (!is) {
+            std::cerr << "cannot open file " << path << std::endl;
+            return false;
+        }
+        unsigned header[HEADER_SIZE];
+        if (!is.read((char *)header, sizeof header) || header[0] != MAGIC) {
+            std::cerr << path << " is not a PQ file, or was saved by an older version" << std::endl;
+            return false;
+        }
+        if (header[1] != VERSION) {
+            std::cerr << path << " is PQ file version " << header[1] << ", expected " << VERSION << std::endl;
+            return false;
+        }
+        const unsigned dim = header[2], M = header[3], nbits = header[4], size = header[5], rotRows = header[6];
+        if (dim != data.getDim() || size != (unsigned)data.getSize()) {
+            std::cerr << path << " holds " << size << " codes of dimension " << dim << ", the base has "
+                << data.getSize() << " vectors of dimension " << data.getDim() << std::endl;
+            return false;
+        }
+        if (M == 0 || M > dim || (nbits != 4 && nbits != 8)) {
+            std::cerr << path << " has invalid M " << M << " or bits " << nbits << std::endl;
+            return false;
+        }
+        const unsigned ksub = 1u << nbits;
+        const unsigned dsub = (dim + M - 1) / M;
+        const unsigned dpad = dsub * M;
+        const unsigned codeSize = nbits == 8 ? M : (M + 1) / 2;
+        if (rotRows != 0 && rotRows != dpad) {
+            std::cerr << path << " has a " << rotRows << " x " << rotRows << " rotation, expected " << dpad << std::endl;
+            return false;
+        }
+        const size_t expected = sizeof header
+            + sizeof(float) * ((size_t)rotRows * rotRows + (size_t)M * ksub * dsub + size)
+            + (size_t)size * codeSize;
+        is.seekg(0, std::ios::end);
+        const size_t actual = is.tellg();
+        if (actual != expected) {
+            std::cerr << path << " has " << actual << " bytes, expected " << expected
+                << " for M " << M << ", " << ksub << " centroids and " << size << " codes" << std::endl;
+            return false;
+        }
+        is.seekg(sizeof header);
+
+        M_ = M;
+        nbits_ = nbits;
+        size_ = size;
+        ksub_ = ksub;
+        dsub_ = dsub;
+        dpad_ = dpad;
+        codeSize_ = codeSize;
+        rotation_.resize(rotRows, rotRows);
+        is.read((char *)rotation_.data(), sizeof(float) * rotation_.size());
+        codebooks_.resize((size_t)M_ * ksub_ * dsub_);
+        is.read((char *)&codebooks_[0], sizeof(float) * codebooks_.size());
+        codes_.resize((size_t)size_ * codeSize_);
+        is.read((char *)&codes_[0], codes_.size());
+        norms_.resize(size_);
+        is.read((char *)&norms_[0], sizeof(float) * norms_.size());
+        if (!is) {
+            std::cerr << "cannot read file " << path << std::endl;
+            return false;
+        }
+        dim_ = dim;
+        return true;
+    }
+
+    bool trained() const {
+        return dim_ != 0;
+    }
+
+    unsigned getM() const {
+        return M_;
+    }
+
+    unsigned getBits() const {
+        return nbits_;
+    }
+
+    size_t bytes() const override {
+        return codes_.size() + norms_.size() * sizeof(float);
+    }
+
+    bool supports(unsigned type) const override {
+        return type == L2_DIST || type == AG_DIST || type == IP_DIST;
+    }
+
+    /*
+     * lut[m * ksub + k] is |q_m - c_mk|^2 for L2_DIST and -q_m . c_mk otherwise,
+     * for 4-bit codes it is also quantized to bytes in lut8.
+     */
+    void prepare(const DATATYPE *query, unsigned type, CodeQuery &q) const override {
+        q.buffer.resize(dpad_);
+        transform(query, &q.buffer[0]);
+        q.sqrNorm = 0;
+        for (unsigned d = 0; d < dim_; ++d) {
+            q.sqrNorm += query[d] * query[d];
+        }
+        q.norm = std::sqrt(q.sqrNorm);
+
+        const simd::KernelSet<float> &kernels = simd::KernelSet<float>::get();
+        q.lut.resize(M_ * ksub_);
+        for (unsigned m = 0; m < M_; ++m) {
+            const float *sub = &q.buffer[m * dsub_];
+            for (unsigned k = 0; k < ksub_; ++k) {
+                q.lut[m * ksub_ + k] = type == L2_DIST
+                    ? kernels.l2sqr(sub, centroid(m, k), dsub_)
+                    : -kernels.dot(sub, centroid(m, k), dsub_);
+            }
+        }
+        if (nbits_ == 4) {
+            quantizeLut(q);
+        }
+    }
+
+    void score(CodeQuery &q, unsigned type, const unsigned *keys, unsigned n, float *dists) const override {
+        if (nbits_ == 8) {
+            simd::AdcKernels::Adc8Func adc8 = simd::AdcKernels::get().adc8;
+            for (unsigned i = 0; i < n; ++i) {
+                dists[i] = finish(adc8(&q.lut[0], &codes_[(size_t)keys[i] * codeSize_], M_), keys[i], q, type);
+            }
+            return;
+        }
+        simd::AdcKernels::Adc4BlockFunc adc4Block = simd::AdcKernels::get().adc4Block;
+        // lanes past count keep the codes of the previous block, their sums
+        // are not read
+        std::vector<uint8_t> &block = q.block;
+        block.resize(M_ * simd::ADC_BLOCK);
+        uint16_t sums[simd::ADC_BLOCK];
+        for (unsigned start = 0; start < n; start += simd::ADC_BLOCK) {
+            unsigned count = std::min(simd::ADC_BLOCK, n - start);
+            for (unsigned i = 0; i < count; ++i) {
+                const uint8_t *code = &codes_[(size_t)keys[start + i] * codeSize_];
+                for (unsigned m = 0; m < M_; ++m) {
+                    block[m * simd::ADC_BLOCK + i] = (code[m >> 1] >> ((m & 1) * 4)) & 15;
+                }
+            }
+            adc4Block(&q.lut8[0], &block[0], M_, sums);
+            for (unsigned i = 0; i < count; ++i) {
+                dists[start + i] = finish(q.bias + q.delta * sums[i], keys[start + i], q, type);
+            }
+        }
+    }
+
+private:
+    // "GQPQ" and the layout of save()
+    enum : unsigned { MAGIC = 0x51505147, VERSION = 1, HEADER_SIZE = 8 };
+
+    unsigned dim_;
+    unsigned dpad_;     // dim_ rounded up to a multiple of M_
+    unsigned M_;
+    unsigned nbits_;
+    unsigned ksub_;
+    unsigned dsub_;
+    unsigned codeSize_; // bytes per item
+    unsigned size_;
+    Eigen::MatrixXf rotation_; // empty for plain PQ
+    std::vector<float> codebooks_; // [m][k][dsub_]
+    std::vector<uint8_t> codes_;
+    std::vector<float> norms_; // norms of the reconstructions
+
+    const float *centroid(unsigned m, unsigned k) const {
+        return &codebooks_[((size_t)m * ksub_ + k) * dsub_];
+    }
+
+    // pad to dpad_ and rotate
+    void transform(const DATATYPE *vec, float *out) const {
+        for (unsigned d = 0; d < dpad_; ++d) {
+            out[d] = d < dim_ ? vec[d] : 0;
+        }
+        if (rotation_.size() != 0) {
+            Eigen::Map<Eigen::RowVectorXf> x(out, dpad_);
+            Eigen::RowVectorXf rotated = x * rotation_;
+            x = rotated;
+        }
+    }
+
+    // nearest centroid of every subspace
+    void assign(const float *x, uint8_t *code) const {
+        const simd::KernelSet<float> &kernels = simd::KernelSet<float>::get();
+        for (unsigned m = 0; m < M_; ++m) {
+            float best = std::numeric_limits<float>::max();
+            for (unsigned k = 0; k < ksub_; ++k) {
+                float dist = kernels.l2sqr(x + m * dsub_, centroid(m, k), dsub_);
+                if (dist < best) {
+                    best = dist;
+                    code[m] = k;
+                }
+            }
+        }
+    }
+
+    void pack(const uint8_t *code, uint8_t *packed) const {
+        if (nbits_ == 8) {
+            std::copy(code, code + M_, packed);
+            return;
+        }
+        for (unsigned m = 0; m < M_; ++m) {
+            packed[m >> 1] |= code[m] << ((m & 1) * 4);
+        }
+    }
+
+    float finish(float sum, unsigned key, const CodeQuery &q, unsigned type) const {
+        if (type == AG_DIST) {
+            return 1 + sum / (q.norm * norms_[key]);
+        }
+        return sum;
+    }
+
+    /*
+     * lut8[m * 16 + k] = round((lut[m * 16 + k] - min_m) / delta), with delta
+     * chosen so that every entry fits a byte
+     */
+    void quantizeLut(CodeQuery &q) const {
+        q.lut8.resize(M_ * 16);
+        std::vector<float> mins(M_);
+        float range = 0;
+        q.bias = 0;
+        for (unsigned m = 0; m < M_; ++m) {
+            const float *row = &q.lut[m * 16];
+            float lo = *std::min_element(row, row + 16);
+            float hi = *std::max_element(row, row + 16);
+            mins[m] = lo;
+            q.bias += lo;
+            range = std::max(range, hi - lo);
+        }
+        q.delta = range > 0 ? range / 255 : 1;
+        for (unsigned m = 0; m < M_; ++m) {
+            for (unsigned k = 0; k < 16; ++k) {
+                q.lut8[m * 16 + k] = (uint8_t)std::floor((q.lut[m * 16 + k] - mins[m]) / q.delta + 0.5f);
+            }
+        }
+    }
+
+    void trainCodebooks(const RowMatrix &X, unsigned iters, std::mt19937 &rng) {
+        codebooks_.resize((size_t)M_ * ksub_ * dsub_);
+        for (unsigned m = 0; m < M_; ++m) {
+            RowMatrix sub = X.block(0, m * dsub_, X.rows(), dsub_);
+            RowMatrix C = kmeans(sub, ksub_, iters, rng);
+            std::copy(C.data(), C.data() + C.size(), &codebooks_[(size_t)m * ksub_ * dsub_]);
+        }
+    }
+
+    /*
+     * Lloyd's k-means, distances are computed in blocks of rows as
+     * |x|^2 - 2 x.c + |c|^2 by matrix products
+     */
+    static RowMatrix kmeans(const RowMatrix &X, unsigned k, unsigned iters, std::mt19937 &rng) {
+        const unsigned BLOCK = 4096;
+        unsigned n = X.rows();
+        std::vector<unsigned> ids(n);
+        for (unsigned i = 0; i < n; ++i) {
+            ids[i] = i;
+        }
+        std::shuffle(ids.begin(), ids.end(), rng);
+        RowMatrix C(k, X.cols());
+        for (unsigned c = 0; c < k; ++c) {
+            C.row(c) = X.row(ids[c]);
+        }
+        std::vector<unsigned> assignment(n);
+        for (unsigned it = 0; it < iters; ++it) {
+            Eigen::RowVectorXf cNorms = C.rowwise().squaredNorm().transpose();
+            for (unsigned start = 0; start < n; start += BLOCK) {
+                unsigned rows = std::min(BLOCK, n - start);
+                RowMatrix D = -2 * X.block(start, 0, rows, X.cols()) * C.transpose();
+                D.rowwise() += cNorms;
+                for (unsigned i = 0; i < rows; ++i) {
+                    D.row(i).minCoeff(&assignment[start + i]);
+                }
+            }
+            RowMatrix sums = RowMatrix::Zero(k, X.cols());
+            std::vector<unsigned> counts(k, 0);
+            for (unsigned i = 0; i < n; ++i) {
+                sums.row(assignment[i]) += X.row(i);
+                counts[assignment[i]]++;
+            }
+            std::uniform_int_distribution<unsigned> pick(0, n - 1);
+            for (unsigned c = 0; c < k; ++c) {
+                if (counts[c] == 0) {
+                    // empty cluster, restart it on a random point
+                    C.row(c) = X.row(pick(rng));
+                } else {
+                    C.row(c) = sums.row(c) / (float)counts[c];
+                }
+            }
+        }
+        return C;
+    }
+};
+}
@@ -0,0 +1,54 @@
+/**
+ * @file quantizer.h
+ *
+ * @brief Interface of the compressed copies of a base set that Scanner can
+ * score candidates on before the exact re-rank.
+ */
+#pragma once
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+namespace lshbox
+{
+/**
+ * Per-query state of a Quantizer, owned by the scanner of the query.
+ */
+struct CodeQuery {
+    std::vector<float> lut;      // weights (SQ) or lookup table (PQ)
+    std::vector<uint8_t> lut8;   // lut quantized to bytes (4-bit PQ)
+    std::vector<int16_t> lut16;  // lut quantized to int16 (SQ)
+    std::vector<float> buffer;   // scratch, e.g. the rotated query of OPQ
+    std::vector<uint8_t> block;  // scratch of score(), e.g. a block of 4-bit PQ codes
+    float offset;                // constant term of the dot product
+    float bias;                  // lut8: dist = bias + delta * sum
+    float delta;
+    float scale16;               // lut16: lut ~ scale16 * lut16
+    float sqrNorm;               // |q|^2
+    float norm;                  // |q|
+    CodeQuery(): offset(0), bias(0), delta(1), scale16(1), sqrNorm(0), norm(0) {}
+};
+
+template <typename DATATYPE = float>
+class Quantizer {
+public:
+    virtual ~Quantizer() {}
+
+    /**
+     * Whether the approximate distance of the metric type is available.
+     */
+    virtual bool supports(unsigned type) const = 0;
+
+    virtual void prepare(const DATATYPE *query, unsigned type, CodeQuery &q) const = 0;
+
+    /**
+     * Approximate ranking distances (see Metric::dist) of n items, q may be
+     * used as scratch.
+     */
+    virtual void score(CodeQuery &q, unsigned type, const unsigned *keys, unsigned n, float *dists) const = 0;
+
+    /**
+     * Bytes held by codes and per-item data.
+     */
+    virtual size_t bytes() const = 0;
+};
+}
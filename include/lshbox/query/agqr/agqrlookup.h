@@ -17,9 +17,20 @@ public:
         lshbox::Scanner<ACCESSOR>& scanner,
         LSHTYPE& mylsh,
         Tree* tree) : TreeLookup<ACCESSOR>(domin, scanner, mylsh, tree) {
+        rebuild(domin, mylsh);
+    }
 
-        // useless
-        float l2norm = this->calL2Norm(domin);
+    template<typename LSHTYPE>
+    void reset(const DATATYPE* domin, LSHTYPE& mylsh) {
+        TreeLookup<ACCESSOR>::reset(domin, mylsh);
+        rebuild(domin, mylsh);
+    }
+
+private:
+    // replace the handlers of TreeLookup by ones on angular losses
+    template<typename LSHTYPE>
+    void rebuild(const DATATYPE* domin, LSHTYPE& mylsh) {
+        float l2norm = this->queryNorm();
         float halfPI = 3.1415927 / 2;
         
         this->handlers_.clear();
@@ -33,7 +44,7 @@ public:
                 if(cosValue > 1) cosValue = 1;
                 e = halfPI - acos(cosValue);
             }
-            this->handlers_.emplace_back(TSTable(this->hashBits_[t], hashFloats, tree));
+            this->handlers_.emplace_back(TSTable(this->hashBits_[t], hashFloats, this->tree_, this->arena_));
             this->heap_.push(ScoreIdxPair(this->handlers_[t].getCurScore(), t)); 
         }
     }
@@ -1,6 +1,7 @@
 #include <vector>
 #include <string>
 #include <cassert>
+#include <lshbox/memory.h>
 #pragma once
 // flipping vector
 class FV {
@@ -98,6 +99,14 @@ class FV {
             return numFVS_[layer];
         }
 
+        size_t memoryBytes() const {
+            size_t bytes = lshbox::heapBytes(numFVS_) + lshbox::heapBytes(FVS_);
+            for (int layer = 0; layer < numFVS_.size(); ++layer) {
+                bytes += lshbox::mallocBytes((size_t)numFVS_[layer] * R_);
+            }
+            return bytes;
+        }
+
         std::string fvtoString(const bool* p) const {
             std::string str = "";
             for (int i = 0; i < R_; ++i) {
@@ -1,5 +1,6 @@
 #include <vector>
 #include <unordered_map>
+#include <algorithm>
 #include "gqr/util/gqrhash.h"
 #include <lshbox/query/prober.h>
 using lshbox::gqrhash;
@@ -10,49 +11,51 @@ public:
     HRTable(
             BIDTYPE hashVal, // hash value of query q
             unsigned paramN, // number of bits per binary code
-            const std::unordered_map<BIDTYPE, std::vector<unsigned>, gqrhash<BIDTYPE>>& table
+            const std::unordered_map<BIDTYPE, std::vector<unsigned>, gqrhash<BIDTYPE>>& table,
+            lshbox::Arena& arena
            ){
-        // ranking by linear sorting
-        dstToBks_.resize(paramN + 1); // maximum hamming dist is paramN
-        unsigned hamDist;
-        BIDTYPE xorVal;
+        // ranking by linear sorting, i.e. counting sort of the buckets by
+        // hamming dist into one array on the arena, buckets of dist d are
+        // buckets_[offsets_[d], offsets_[d + 1])
+        maxDist_ = paramN; // maximum hamming dist is paramN
+        offsets_ = arena.alloc<unsigned>(paramN + 2);
+        std::fill(offsets_, offsets_ + paramN + 2, 0);
+        unsigned char* dists = arena.alloc<unsigned char>(table.size());
+        unsigned idx = 0;
         for ( std::unordered_map<BIDTYPE, std::vector<unsigned>, gqrhash<BIDTYPE>>::const_iterator it = table.begin(); it != table.end(); ++it) {
+            // bit count of the xor, i.e. the hamming dist
+            unsigned hamDist = __builtin_popcountll(hashVal ^ it->first);
+            assert(hamDist <= maxDist_);
+            dists[idx++] = hamDist;
+            offsets_[hamDist + 1]++;
+        }
+        for (unsigned d = 0; d <= maxDist_; ++d) {
+            offsets_[d + 1] += offsets_[d];
+        }
 
-            const BIDTYPE& bucketVal = it->first;
-            xorVal = hashVal ^ bucketVal;
-
-            hamDist = 0;
-            // cal Number of 1, algorithm1, faster than 2, three instructions in while loop
-            // key idea: always deduct a one from xorVal
-            while(xorVal != 0){
-                hamDist++;
-                xorVal &= xorVal - 1; 
-                // property of xorVal - 1: digits from last one will be flipped
-                // e.g.   000100 100 - 1 = 000100 011
-                // i.e. can stop earlier compare with check bit by bit
-            }
-
-            // algorithm2, slower than 1, five instructions in while loop
-            // while (xorVal != 0) {
-            //     if (xorVal & 1 == 1)
-            //         hamDist++;
-            //     xorVal >>= 1;
-            // }
-            assert(hamDist < dstToBks_.size());
-            dstToBks_[hamDist].push_back(bucketVal);
+        // same order within a dist as pushing back in table order
+        buckets_ = arena.alloc<BIDTYPE>(table.size());
+        unsigned* next = arena.alloc<unsigned>(paramN + 1);
+        std::copy(offsets_, offsets_ + paramN + 1, next);
+        idx = 0;
+        for ( std::unordered_map<BIDTYPE, std::vector<unsigned>, gqrhash<BIDTYPE>>::const_iterator it = table.begin(); it != table.end(); ++it) {
+            buckets_[next[dists[idx++]]++] = it->first;
         }
-        // setNextRowCol_();
     }
 
-    int getNumBuckets(int hamDist) {
-        return dstToBks_[hamDist].size();
+    int getNumBuckets(int hamDist) const {
+        if (hamDist > maxDist_) return 0;
+        return offsets_[hamDist + 1] - offsets_[hamDist];
     }
 
-    const std::vector<BIDTYPE>& getBuckets(int hamDist) {
-        return dstToBks_[hamDist];
+    // the buckets at hamDist, getNumBuckets(hamDist) of them
+    const BIDTYPE* getBuckets(int hamDist) const {
+        return buckets_ + offsets_[hamDist];
     } 
 private:
-    std::vector<std::vector<BIDTYPE>> dstToBks_;
+    int maxDist_;
+    unsigned* offsets_;
+    BIDTYPE* buckets_;
 
 };
 
@@ -68,21 +71,21 @@ public:
         const DATATYPE* domin,
         lshbox::Scanner<ACCESSOR>& scanner,
         LSHTYPE& mylsh) : Prober<ACCESSOR>(domin, scanner, mylsh) {
+        build(domin, mylsh);
+    }
 
-        allTables_.reserve(mylsh.tables.size());
-        for (int i = 0; i < mylsh.tables.size(); ++i) {
-            BIDTYPE hashValue = mylsh.getHashVal(i, domin);
-            allTables_.emplace_back(HRTable(hashValue, this->R_, mylsh.tables[i]));
-        }
-        table_ = 0;
-        iterator_ = 0;
-        dist_ = 0;
+    // probe a new query with the memory of the last one
+    template<typename LSHTYPE>
+    void reset(const DATATYPE* domin, LSHTYPE& mylsh) {
+        allTables_.clear();
+        Prober<ACCESSOR>::reset(domin, mylsh);
+        build(domin, mylsh);
     }
 
     std::pair<unsigned, BIDTYPE> getNextBID(){
         this->numBucketsProbed_++;
 
-        if (iterator_ < allTables_[table_].getBuckets(dist_).size()) {
+        if (iterator_ < allTables_[table_].getNumBuckets(dist_)) {
             BIDTYPE nextBucketID = allTables_[table_].getBuckets(dist_)[iterator_++];
             return std::make_pair(table_, nextBucketID);
         }
@@ -98,7 +101,7 @@ public:
                 table_ = 0;
             }
 
-            if (allTables_[table_].getBuckets(dist_).size() > 0)
+            if (allTables_[table_].getNumBuckets(dist_) > 0)
                 break;
             else 
                 table_++;
@@ -108,7 +111,26 @@ public:
         return std::make_pair(table_, nextBucketID);
     }
 
+    // the rankings of the HRTables are on the arena
+    size_t memoryBytes() const override {
+        return Prober<ACCESSOR>::memoryBytes() + lshbox::heapBytes(allTables_);
+    }
+
 private:
+    template<typename LSHTYPE>
+    void build(const DATATYPE* domin, LSHTYPE& mylsh) {
+        lshbox::PerfScope scope(lshbox::PerfCounters::GENERATE);
+        allTables_.reserve(mylsh.getNumTables());
+        for (int i = 0; i < mylsh.getNumTables(); ++i) {
+            lshbox::TraceSpan span(lshbox::Trace::SETUP, i);
+            BIDTYPE hashValue = mylsh.getHashVal(i, domin);
+            allTables_.emplace_back(HRTable(hashValue, this->R_, mylsh.getTable(i), this->arena_));
+        }
+        table_ = 0;
+        iterator_ = 0;
+        dist_ = 0;
+    }
+
     std::vector<HRTable> allTables_;
     unsigned table_ = 0;
     unsigned iterator_ = 0; // iterator to allTables[table_].getBuckets(dist_);
@@ -24,6 +24,15 @@ public:
         table_ = 0;
     }
 
+    // probe a new query with the memory of the last one
+    template<typename LSHTYPE>
+    void reset(const DATATYPE* domin, LSHTYPE& mylsh) {
+        Prober<ACCESSOR>::reset(domin, mylsh);
+        layer_ = 0;
+        idxToLayer_ = 0;
+        table_ = 0;
+    }
+
     std::pair<unsigned, BIDTYPE> getNextBID(){
         this->numBucketsProbed_++;
 
@@ -24,8 +24,10 @@ public:
         typedef TreeLookup<typename lshbox::Matrix<DATATYPE>::Accessor> GQRT;
         Tree fvs(mylsh.getCodeLength());
 
+        // the model hashes the original dimension order, see --reorder_dims
+        vector<DATATYPE> row;
         for (int i = 0; i < data.getSize(); ++i) {
-            GQRT prober(data[i], initScanner, mylsh, &fvs);
+            GQRT prober(data.originalRow(i, row), initScanner, mylsh, &fvs);
             for (int dg = 0; dg < degree; ++dg) {
                 const std::pair<unsigned, BIDTYPE>& tableBucket = prober.getNextBID();
                 bucketLists_[i][dg] = tableBucket;
@@ -86,5 +86,11 @@ public:
             hookMinHeap_.push(p.second, hookerP_->getBucketList(key));
         }
     }
+
+    void probeItems(const unsigned* keys, unsigned n) {
+        for (unsigned i = 0; i < n; ++i) {
+            (*this)(keys[i]);
+        }
+    }
 };
 
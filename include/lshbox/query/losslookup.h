@@ -32,7 +32,7 @@ public:
             for (auto& e : hashFloats) {
                 e = fabs(e);
             }
-            handlers_.emplace_back(LLTable(this->hashBits_[t], hashFloats, &mylsh.tables[t], fvs));
+            handlers_.emplace_back(LLTable(this->hashBits_[t], hashFloats, &mylsh.getTable(t), fvs));
             heap_.push(ScoreIdxPair(handlers_[t].getCurScore(), t)); 
         }
     }
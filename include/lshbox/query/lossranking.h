@@ -4,18 +4,29 @@
 #include <vector>
 #include "gqr/util/gqrhash.h"
 #include "lshbox/query/scoreidxpair.h"
+#include "lshbox/arena.h"
 class LRTable {
 public:
     typedef unsigned long long BIDTYPE;
     typedef std::unordered_map<BIDTYPE, std::vector<unsigned>, gqrhash<BIDTYPE>> TableT;
+    typedef std::pair<float, BIDTYPE> PairT;
 
     LRTable(
         BIDTYPE hashVal, 
         const std::vector<float>& queryFloats, 
-        const TableT& table){
-
-        // should get the number of hashbuckets! from mylsh
-        dstToBks_.reserve(table.size()); 
+        const TableT& table,
+        lshbox::Arena& arena){
+
+        // one entry per bucket of the table, on the arena of the prober
+        hashVal_ = hashVal;
+        numBits_ = queryFloats.size();
+        squares_ = arena.alloc<float>(numBits_);
+        for (unsigned idx = 0; idx < numBits_; ++idx) {
+            squares_[idx] = queryFloats[idx] * queryFloats[idx];
+        }
+        size_ = table.size();
+        dstToBks_ = arena.alloc<PairT>(size_);
+        unsigned size = 0;
         BIDTYPE xorVal;
         float dst;
         for ( TableT::const_iterator it = table.begin(); it != table.end(); ++it) {
@@ -31,20 +42,20 @@ public:
                 xorVal >>= 1;
             }
 
-            dstToBks_.emplace_back(std::pair<float, BIDTYPE>(dst, it->first));
+            dstToBks_[size++] = PairT(dst, it->first);
         }
-        assert(dstToBks_.size() == table.size());
+        assert(size == size_);
 
-        std::sort(dstToBks_.begin(), 
-            dstToBks_.end(), 
-            [] (const std::pair<float, BIDTYPE>& a, const std::pair<float, BIDTYPE>& b ) {
+        std::sort(dstToBks_, 
+            dstToBks_ + size_, 
+            [] (const PairT& a, const PairT& b ) {
                 return a.first < b.first;
             });
 
         iterator = 0;
     }
 
-    bool reset() {
+    void reset() {
         iterator = 0;
     }
 
@@ -55,15 +66,34 @@ public:
     BIDTYPE getCurBucket() {
         return dstToBks_[iterator].second;
     }
+
+    // sum of the squared losses of the bits the current bucket flips, i.e. a
+    // lower bound on the squared L2 distance of its items if the projections
+    // are orthonormal, as for PCAH and ITQ
+    float getCurBound() const {
+        BIDTYPE xorVal = hashVal_ ^ dstToBks_[iterator].second;
+        float bound = 0;
+        for (int idx = numBits_ - 1; idx >= 0; --idx) {
+            if (xorVal & 1) {
+                bound += squares_[idx];
+            }
+            xorVal >>= 1;
+        }
+        return bound;
+    }
     
     // move to next, if exist return true and otherwise false
     bool moveForward() {
         iterator++;
-        return iterator < dstToBks_.size();
+        return iterator < size_;
     }
 
 private:
-    std::vector<std::pair<float, BIDTYPE> > dstToBks_;
+    BIDTYPE hashVal_;
+    unsigned numBits_;
+    float* squares_; // squared loss of every bit
+    PairT* dstToBks_;
+    unsigned size_;
     unsigned iterator = 0;
 };
 
@@ -81,41 +111,72 @@ public:
         const DATATYPE* domin,
         lshbox::Scanner<ACCESSOR>& scanner,
         LSHTYPE& mylsh) : Prober<ACCESSOR>(domin, scanner, mylsh) {
+        build(domin, mylsh);
+    }
 
-        allTables_.reserve(mylsh.tables.size());
-        for (int i = 0; i < mylsh.tables.size(); ++i) {
-
-            BIDTYPE hashValue = mylsh.getHashVal(i, domin);
-            std::vector<float> queryFloats = mylsh.getHashFloats(i, domin);
-
-            for (auto& e : queryFloats) {
-                e = fabs(e);
-            }
-
-            allTables_.emplace_back(
-                LRTable(hashValue, queryFloats, mylsh.tables[i]));
-        }
-
-        for (unsigned i = 0; i != allTables_.size(); ++i) {
-            float score = allTables_[i].getCurScore();
-            heap_.push(PairT(score , i));
+    // probe a new query with the memory of the last one
+    template<typename LSHTYPE>
+    void reset(const DATATYPE* domin, LSHTYPE& mylsh) {
+        allTables_.clear();
+        while (!heap_.empty()) {
+            heap_.pop();
         }
+        Prober<ACCESSOR>::reset(domin, mylsh);
+        build(domin, mylsh);
     }
 
     std::pair<unsigned, BIDTYPE> getNextBID(){
         this->numBucketsProbed_++;
         unsigned tb = heap_.top().index_;
+        lshbox::traceInstant(lshbox::Trace::HEAP_POP, tb, heap_.top().score_);
         heap_.pop();
 
         BIDTYPE nextBucket = allTables_[tb].getCurBucket();
         if (allTables_[tb].moveForward()) {
             float score = allTables_[tb].getCurScore();
+            lshbox::traceInstant(lshbox::Trace::HEAP_PUSH, tb, score);
             heap_.push(PairT(score, tb));
         }
         return std::make_pair(tb, nextBucket);
     }
 
+    float nextBucketBound() {
+        if (heap_.empty()) {
+            return 0;
+        }
+        return allTables_[heap_.top().index_].getCurBound();
+    }
+
+    // the rankings of the LRTables are on the arena
+    size_t memoryBytes() const override {
+        return Prober<ACCESSOR>::memoryBytes() + lshbox::heapBytes(allTables_) + lshbox::heapBytes(heap_);
+    }
+
 private:
+    template<typename LSHTYPE>
+    void build(const DATATYPE* domin, LSHTYPE& mylsh) {
+        lshbox::PerfScope scope(lshbox::PerfCounters::GENERATE);
+        allTables_.reserve(mylsh.getNumTables());
+        for (int i = 0; i < mylsh.getNumTables(); ++i) {
+            lshbox::TraceSpan span(lshbox::Trace::SETUP, i);
+
+            BIDTYPE hashValue = mylsh.getHashVal(i, domin);
+            std::vector<float> queryFloats = mylsh.getHashFloats(i, domin);
+
+            for (auto& e : queryFloats) {
+                e = fabs(e);
+            }
+
+            allTables_.emplace_back(
+                LRTable(hashValue, queryFloats, mylsh.getTable(i), this->arena_));
+        }
+
+        for (unsigned i = 0; i != allTables_.size(); ++i) {
+            float score = allTables_[i].getCurScore();
+            heap_.push(PairT(score , i));
+        }
+    }
+
     std::vector<LRTable> allTables_;
 
     std::priority_queue<PairT> heap_;
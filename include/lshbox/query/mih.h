@@ -123,6 +123,12 @@ public:
         }
     }
 
+    // every prober builds the flipping vectors of one substring, the
+    // subtables are shared
+    size_t memoryBytes() const override {
+        return Prober<ACCESSOR>::memoryBytes() + fvs_.memoryBytes();
+    }
+
 private:
     unsigned substringNum_;
     unsigned substringLen_;
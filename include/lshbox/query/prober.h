@@ -13,18 +13,27 @@ public:
         lshbox::Scanner<ACCESSOR>& scanner,
         LSHTYPE& mylsh) : BaseProber<ACCESSOR, BIDTYPE>(domin, scanner, mylsh) {
 
-        hashBits_.resize(mylsh.tables.size());
+        lshbox::PerfScope scope(lshbox::PerfCounters::ENCODE);
+        hashBits_.resize(mylsh.getNumTables());
         for (unsigned tb = 0; tb < hashBits_.size(); ++tb) {
+            lshbox::TraceSpan span(lshbox::Trace::ENCODE, tb);
             hashBits_[tb] = mylsh.getHashBits(tb, domin);
         }
     }
 
-    float calL2Norm(const DATATYPE* domin) {
-        float sum = 0;
-        for (int i = 0; i < hashBits_[0].size(); ++i) {
-            sum += domin[i] * domin[i];
+    template<typename LSHTYPE>
+    void reset(const DATATYPE* domin, LSHTYPE& mylsh) {
+        BaseProber<ACCESSOR, BIDTYPE>::reset(domin, mylsh);
+        lshbox::PerfScope scope(lshbox::PerfCounters::ENCODE);
+        hashBits_.resize(mylsh.getNumTables());
+        for (unsigned tb = 0; tb < hashBits_.size(); ++tb) {
+            lshbox::TraceSpan span(lshbox::Trace::ENCODE, tb);
+            hashBits_[tb] = mylsh.getHashBits(tb, domin);
         }
-        return sqrt(sum);
+    }
+
+    size_t memoryBytes() const override {
+        return BaseProber<ACCESSOR, BIDTYPE>::memoryBytes() + lshbox::heapBytes(hashBits_);
     }
 
 protected:
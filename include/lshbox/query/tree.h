@@ -3,6 +3,8 @@
 #include <cassert>
 #include <queue>
 #include <cmath>
+#include <lshbox/arena.h>
+#include <lshbox/memory.h>
 #pragma once
 // good cache locality, can be cached, computed offline and shared by all queries
 // flipping vector tree
@@ -22,7 +24,8 @@ public:
         numFV -= 1;
 
         lastOne_.reserve(numFV);
-        bits_ = new bool[numFV * R_];  // largest is 2^27 * 27 < 2^27 * 32 = 2^32 - 1
+        // largest is 2^27 * 27 < 2^27 * 32 = 2^32 - 1, shared by all queries so may be on huge pages
+        bits_ = static_cast<bool*>(lshbox::allocPages(sizeof(bool) * numFV * R_, huge_));
 
 
         // build bits_ as well as lastone_
@@ -98,14 +101,19 @@ public:
         return this->R_;
     }
 
+    size_t memoryBytes() const {
+        return sizeof(bool) * count_ * R_ + lshbox::heapBytes(lastOne_);
+    }
+
     ~Tree(){
-        delete bits_;
+        lshbox::freePages(bits_, sizeof(bool) * count_ * R_, huge_);
     }
 private:
     unsigned R_ = 0; // step is R_
 
     // lastOne_ and bits_ should be updated as a whole
     bool* bits_ = NULL; 
+    bool huge_ = false;
     std::vector<unsigned> lastOne_;
     unsigned count_ = 0;
 
@@ -22,24 +22,18 @@ public:
         const DATATYPE* domin,
         lshbox::Scanner<ACCESSOR>& scanner,
         LSHTYPE& mylsh,
-        Tree* tree) : Prober<ACCESSOR>(domin, scanner, mylsh) {
-
-        int numTables = mylsh.getNumTables();
-        handlers_.reserve(numTables);
-        for (unsigned t = 0; t < numTables; ++t) {
-            std::vector<float> hashFloats = mylsh.getHashFloats(t, domin);
-            for (auto& e : hashFloats) {
-                e = fabs(e);
-            }
-            handlers_.emplace_back(TSTable(this->hashBits_[t], hashFloats, tree));
-            heap_.emplace(ScoreIdxPair(handlers_[t].getCurScore(), t)); 
-        }
+        Tree* tree) : Prober<ACCESSOR>(domin, scanner, mylsh), tree_(tree) {
+        build(domin, mylsh);
+    }
 
-        // initialize firstBKs_
-        firstBK_.reserve(numTables);
-        for (unsigned t = 0; t < numTables; ++t) {
-            firstBK_.emplace_back(mylsh.getHashVal(t, domin));
-        }
+    // probe a new query with the memory of the last one
+    template<typename LSHTYPE>
+    void reset(const DATATYPE* domin, LSHTYPE& mylsh) {
+        handlers_.clear();
+        firstBK_.clear();
+        heap_ = std::priority_queue<ScoreIdxPair>();
+        Prober<ACCESSOR>::reset(domin, mylsh);
+        build(domin, mylsh);
     }
 
     std::pair<unsigned, BIDTYPE> getNextBID(){
@@ -52,9 +46,11 @@ public:
         // always return the first bucket of every table
 
         unsigned tb = heap_.top().index_;
+        lshbox::traceInstant(lshbox::Trace::HEAP_POP, tb, heap_.top().score_);
         heap_.pop();
         BIDTYPE newBucket = handlers_[tb].getCurBucket();
         if (handlers_[tb].moveForward()){
+            lshbox::traceInstant(lshbox::Trace::HEAP_PUSH, tb, handlers_[tb].getCurScore());
             heap_.emplace(ScoreIdxPair(handlers_[tb].getCurScore(), tb)); 
         }
 
@@ -62,9 +58,46 @@ public:
         return std::make_pair(tb, newBucket);
     }
 
+    // the first bucket of a table is the bucket of the query
+    float nextBucketBound() {
+        if (this->numBucketsProbed_ < handlers_.size() || heap_.empty()) {
+            return 0;
+        }
+        return handlers_[heap_.top().index_].getCurBound();
+    }
+
+    // the TSTable heaps are on the arena, the tree is shared
+    size_t memoryBytes() const override {
+        return Prober<ACCESSOR>::memoryBytes() + lshbox::heapBytes(handlers_)
+            + lshbox::heapBytes(firstBK_) + lshbox::heapBytes(heap_);
+    }
+
 protected:
+    template<typename LSHTYPE>
+    void build(const DATATYPE* domin, LSHTYPE& mylsh) {
+        lshbox::PerfScope scope(lshbox::PerfCounters::GENERATE);
+        int numTables = mylsh.getNumTables();
+        handlers_.reserve(numTables);
+        for (unsigned t = 0; t < numTables; ++t) {
+            lshbox::TraceSpan span(lshbox::Trace::SETUP, t);
+            std::vector<float> hashFloats = mylsh.getHashFloats(t, domin);
+            for (auto& e : hashFloats) {
+                e = fabs(e);
+            }
+            handlers_.emplace_back(TSTable(this->hashBits_[t], hashFloats, tree_, this->arena_));
+            heap_.emplace(ScoreIdxPair(handlers_[t].getCurScore(), t)); 
+        }
+
+        // initialize firstBKs_
+        firstBK_.reserve(numTables);
+        for (unsigned t = 0; t < numTables; ++t) {
+            firstBK_.emplace_back(mylsh.getHashVal(t, domin));
+        }
+    }
+
+    Tree* tree_;
     std::vector<TSTable> handlers_;
     std::vector<BIDTYPE> firstBK_;
 
     std::priority_queue<ScoreIdxPair> heap_; // <score, r> pairs
-};
+};
\ No newline at end of file
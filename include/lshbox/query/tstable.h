@@ -6,6 +6,7 @@
 #include "gqr/util/gqrhash.h"
 #include <lshbox/query/tree.h>
 #include <lshbox/query/scoreidxpair.h>
+#include <lshbox/arena.h>
 #pragma once
 using lshbox::gqrhash;
 // will ignore the first bucket, i.e. 00000
@@ -13,26 +14,42 @@ class TSTable{
 public:
     typedef unsigned long long BIDTYPE;
     typedef std::unordered_map<BIDTYPE, std::vector<unsigned>, gqrhash<BIDTYPE>> TableT;
+    typedef std::priority_queue<ScoreIdxPair, std::vector<ScoreIdxPair, lshbox::ArenaAllocator<ScoreIdxPair>>> HeapT;
     TSTable(
         const std::vector<bool>& queryBits,    
         const std::vector<float>& queryloss,
-        const Tree* tree) {
+        const Tree* tree,
+        lshbox::Arena& arena) :
+        minHeap_(std::less<ScoreIdxPair>(), HeapT::container_type(lshbox::ArenaAllocator<ScoreIdxPair>(arena))) {
 
-        queryBits_ = queryBits;
         tree_ = tree;
         upperIdx = tree_->getSize() / 2 - 1;
 
         // initialize posLossPairs_
-        posLossPairs_.resize(queryloss.size());
-        for (unsigned int idx = 0; idx < posLossPairs_.size(); ++idx) {
+        numBits_ = queryloss.size();
+        posLossPairs_ = arena.alloc<std::pair<unsigned int, float>>(numBits_);
+        for (unsigned int idx = 0; idx < numBits_; ++idx) {
             posLossPairs_[idx].first = idx;
             posLossPairs_[idx].second = queryloss[idx];
         }
 
-        std::sort(posLossPairs_.begin(), posLossPairs_.end(), 
+        std::sort(posLossPairs_, posLossPairs_ + numBits_, 
             [] (const std::pair<unsigned, float>& a, const std::pair<unsigned, float>& b ) {
                 return a.second < b.second;
         });
+
+        // bucket of the query, and the bucket bit flipped by sorted position i
+        queryBucket_ = 0;
+        for (unsigned i = 0; i < numBits_; ++i) {
+            queryBucket_ <<= 1;
+            if (queryBits[i] == true) {
+                queryBucket_ |= 1;
+            }
+        }
+        flipMasks_ = arena.alloc<BIDTYPE>(numBits_);
+        for (unsigned i = 0; i < numBits_; ++i) {
+            flipMasks_[i] = 1ULL << (numBits_ - 1 - posLossPairs_[i].first);
+        }
         
         minHeap_.emplace(ScoreIdxPair(posLossPairs_[0].second, 0));
     }
@@ -51,6 +68,20 @@ public:
         return minHeap_.top().score_;
     }
 
+    // sum of the squared losses of the bits the current bucket flips, i.e. a
+    // lower bound on the squared L2 distance of its items if the projections
+    // are orthonormal, as for PCAH and ITQ
+    float getCurBound() const {
+        const bool* fv = tree_->getFV(minHeap_.top().index_);
+        float bound = 0;
+        for (unsigned i = 0; i < numBits_; ++i) {
+            if (fv[i]) {
+                bound += posLossPairs_[i].second * posLossPairs_[i].second;
+            }
+        }
+        return bound;
+    }
+
     // equals to next bucket exists
     bool moveForward() {
         return !minHeap_.empty();
@@ -63,17 +94,20 @@ private:
     // example: 
     // if queryBits = 101, queryFloats = 0.1, -0.05, 0.9 
     // posLossPairs_ = (1, 0.05), (0, 0.1), (2, 0.9)
-    std::vector<bool> queryBits_;
-    std::vector<std::pair<unsigned int, float>> posLossPairs_;
+    // arrays of numBits_ entries on the arena of the prober
+    std::pair<unsigned int, float>* posLossPairs_;
+    BIDTYPE* flipMasks_;
+    unsigned numBits_;
+    BIDTYPE queryBucket_;
 
     unsigned upperIdx = -1; // maximum idx that can be shifed and expanded
 
     const Tree* tree_ = NULL;
-    std::priority_queue<ScoreIdxPair> minHeap_; // <score, r> pairs
+    HeapT minHeap_; // <score, r> pairs
 
     float calScore(const bool* fv) {
         float score = 0;
-        for (unsigned idx = 0; idx < posLossPairs_.size(); ++idx) {
+        for (unsigned idx = 0; idx < numBits_; ++idx) {
             if (fv[idx]) {
                 score += posLossPairs_[idx].second;
             }
@@ -81,23 +115,12 @@ private:
         return score;
     }
 
+    // the query bucket with the bits of fv flipped
     BIDTYPE calBucket(const bool* fv) const {
-        std::vector<bool> newHashBits = queryBits_;
-
-        // apply flipping
-        for (unsigned int i = 0; i < newHashBits.size(); ++i) {
+        BIDTYPE bucketID = queryBucket_;
+        for (unsigned int i = 0; i < numBits_; ++i) {
             if (fv[i]) {
-                newHashBits[posLossPairs_[i].first] = 
-                    1 - newHashBits[posLossPairs_[i].first];
-            }
-        }
-
-        // calculate bucketID
-        BIDTYPE bucketID = 0;
-        for (unsigned i = 0; i < newHashBits.size() ; ++i) {
-            bucketID <<= 1;
-            if (newHashBits[i] == true) {
-                bucketID |= 1;
+                bucketID ^= flipMasks_[i];
             }
         }
         return bucketID;
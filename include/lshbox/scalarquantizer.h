@@ -0,0 +1,153 @@
+/**
+ * @file scalarquantizer.h
+ *
+ * @brief uint8 scalar quantization of a base set, used to score candidates
+ * before the exact re-rank of Scanner.
+ *
+ * Each dimension i is mapped to 256 levels between its minimum min_i and
+ * maximum over the base, x_i ~ min_i + scale_i * c_i. For a query q
+ *
+ *     q . x ~ q . min + sum_i (q_i * scale_i) * c_i
+ *
+ * so scoring a candidate is one dot product of per-query weights with the
+ * uint8 codes, and L2 / angular distances follow from the cached norm of the
+ * decoded vector. The weights are quantized to int16 per query so that the
+ * dot product runs in integer SIMD (madd_epi16, or dpwssd with VNNI) with
+ * int32 accumulation.
+ */
+#pragma once
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <stdint.h>
+#include "lshbox/matrix.h"
+#include "lshbox/metric.h"
+#include "lshbox/simd/distance.h"
+#include "lshbox/quantizer.h"
+namespace lshbox
+{
+template <typename DATATYPE = float>
+class ScalarQuantizer: public Quantizer<DATATYPE> {
+public:
+    ScalarQuantizer(): dim_(0) {}
+
+    /**
+     * Learn the per-dimension range and encode every vector of data.
+     */
+    void train(const Matrix<DATATYPE> &data) {
+        dim_ = data.getDim();
+        unsigned size = data.getSize();
+        min_.assign(dim_, std::numeric_limits<float>::max());
+        scale_.assign(dim_, 0);
+        std::vector<float> max(dim_, -std::numeric_limits<float>::max());
+        for (unsigned i = 0; i < size; ++i) {
+            const DATATYPE *vec = data[i];
+            for (unsigned d = 0; d < dim_; ++d) {
+                min_[d] = std::min(min_[d], (float)vec[d]);
+                max[d] = std::max(max[d], (float)vec[d]);
+            }
+        }
+        for (unsigned d = 0; d < dim_; ++d) {
+            scale_[d] = max[d] > min_[d] ? (max[d] - min_[d]) / 255 : 1;
+        }
+
+        codes_.resize((size_t)size * dim_);
+        sqrNorms_.resize(size);
+        norms_.resize(size);
+        for (unsigned i = 0; i < size; ++i) {
+            const DATATYPE *vec = data[i];
+            uint8_t *code = &codes_[(size_t)i * dim_];
+            float sqrNorm = 0;
+            for (unsigned d = 0; d < dim_; ++d) {
+                float level = std::floor((vec[d] - min_[d]) / scale_[d] + 0.5f);
+                code[d] = (uint8_t)std::max(0.0f, std::min(255.0f, level));
+                float decoded = min_[d] + scale_[d] * code[d];
+                sqrNorm += decoded * decoded;
+            }
+            sqrNorms_[i] = sqrNorm;
+            norms_[i] = std::sqrt(sqrNorm);
+        }
+    }
+
+    bool trained() const {
+        return dim_ != 0;
+    }
+
+    unsigned getDim() const {
+        return dim_;
+    }
+
+    size_t bytes() const override {
+        return codes_.size() + (sqrNorms_.size() + norms_.size()) * sizeof(float);
+    }
+
+    // lut holds the weights q_i * scale_i, offset is q . min
+    void prepare(const DATATYPE *query, unsigned, CodeQuery &q) const override {
+        q.lut.resize(dim_);
+        q.offset = 0;
+        q.sqrNorm = 0;
+        float maxAbs = 0;
+        for (unsigned d = 0; d < dim_; ++d) {
+            q.lut[d] = query[d] * scale_[d];
+            q.offset += query[d] * min_[d];
+            q.sqrNorm += query[d] * query[d];
+            maxAbs = std::max(maxAbs, std::fabs(q.lut[d]));
+        }
+        q.norm = std::sqrt(q.sqrNorm);
+
+        // int16 weights, bounded so that dim_ products with codes <= 255
+        // cannot overflow the int32 sum
+        const double limit = std::min(32767.0, std::floor(2147483647.0 / (255.0 * std::max(1u, dim_))));
+        q.scale16 = maxAbs > 0 ? (float)(maxAbs / limit) : 1;
+        q.lut16.resize(dim_);
+        for (unsigned d = 0; d < dim_; ++d) {
+            q.lut16[d] = (int16_t)std::lrint(q.lut[d] / q.scale16);
+        }
+    }
+
+    /**
+     * Approximate q . x of the item key.
+     */
+    float dot(const CodeQuery &q, unsigned key) const {
+        return q.offset + q.scale16 * simd::CodeKernels::get().dotU8(&q.lut16[0], &codes_[(size_t)key * dim_], dim_);
+    }
+
+    /**
+     * Approximate ranking distance of Metric, i.e. squared L2, -dot or 1 - cos.
+     * L1_DIST is not supported.
+     */
+    float dist(const CodeQuery &q, unsigned key, unsigned type) const {
+        float ip = dot(q, key);
+        switch (type) {
+        case L2_DIST:
+            return std::max(0.0f, sqrNorms_[key] - 2 * ip + q.sqrNorm);
+        case AG_DIST:
+            return 1 - ip / (q.norm * norms_[key]);
+        case IP_DIST:
+            return -ip;
+        default:
+            assert(false);
+            return 0;
+        }
+    }
+
+    void score(CodeQuery &q, unsigned type, const unsigned *keys, unsigned n, float *dists) const override {
+        for (unsigned i = 0; i < n; ++i) {
+            dists[i] = dist(q, keys[i], type);
+        }
+    }
+
+    bool supports(unsigned type) const override {
+        return type == L2_DIST || type == AG_DIST || type == IP_DIST;
+    }
+
+private:
+    unsigned dim_;
+    std::vector<float> min_;
+    std::vector<float> scale_;
+    std::vector<uint8_t> codes_;
+    // norms of the decoded vectors
+    std::vector<float> sqrNorms_;
+    std::vector<float> norms_;
+};
+}
@@ -0,0 +1,134 @@
+/**
+ * @file adc.h
+ *
+ * @brief Asymmetric distance computation kernels of ProductQuantizer.
+ *
+ * 8-bit codes index a float table of M x 256 entries, the AVX2 and AVX-512
+ * kernels look up 8 / 16 subspaces at once with gather instructions.
+ *
+ * 4-bit codes are scored in blocks of ADC_BLOCK items: the codes of a block
+ * are transposed so that one register holds subspace m of 32 items, and the
+ * 16-entry byte table of subspace m is looked up with a single byte shuffle.
+ */
+#pragma once
+#include <stdint.h>
+#include "lshbox/simd/distance.h"
+namespace lshbox
+{
+namespace simd
+{
+const unsigned ADC_BLOCK = 32;
+
+/*
+ * Sum of lut[m * 256 + code[m]] over m < M.
+ */
+inline float adc8Scalar(const float *lut, const uint8_t *code, unsigned M)
+{
+    float sum = 0;
+    for (unsigned m = 0; m != M; ++m) {
+        sum += lut[m * 256 + code[m]];
+    }
+    return sum;
+}
+
+/*
+ * sums[i] = sum over m < M of lut8[m * 16 + block[m * ADC_BLOCK + i]], for all
+ * i < ADC_BLOCK, saturating at 65535.
+ */
+inline void adc4BlockScalar(const uint8_t *lut8, const uint8_t *block, unsigned M, uint16_t *sums)
+{
+    for (unsigned i = 0; i != ADC_BLOCK; ++i) {
+        unsigned sum = 0;
+        for (unsigned m = 0; m != M; ++m) {
+            sum += lut8[m * 16 + block[m * ADC_BLOCK + i]];
+        }
+        sums[i] = sum > 65535 ? 65535 : sum;
+    }
+}
+
+#ifdef LSHBOX_SIMD_X86
+__attribute__((target("avx2,fma")))
+inline float adc8Avx2(const float *lut, const uint8_t *code, unsigned M)
+{
+    const __m256i step = _mm256_setr_epi32(0, 256, 512, 768, 1024, 1280, 1536, 1792);
+    __m256 sum = _mm256_setzero_ps();
+    unsigned m = 0;
+    for (; m + 8 <= M; m += 8) {
+        __m128i bytes = _mm_loadl_epi64((const __m128i *)(code + m));
+        __m256i idx = _mm256_add_epi32(_mm256_cvtepu8_epi32(bytes), step);
+        sum = _mm256_add_ps(sum, _mm256_i32gather_ps(lut + m * 256, idx, 4));
+    }
+    float result = hsumAvx2(sum);
+    for (; m < M; ++m) {
+        result += lut[m * 256 + code[m]];
+    }
+    return result;
+}
+
+__attribute__((target("avx512f")))
+inline float adc8Avx512(const float *lut, const uint8_t *code, unsigned M)
+{
+    const __m512i step = _mm512_setr_epi32(
+        0, 256, 512, 768, 1024, 1280, 1536, 1792,
+        2048, 2304, 2560, 2816, 3072, 3328, 3584, 3840);
+    __m512 sum = _mm512_setzero_ps();
+    unsigned m = 0;
+    for (; m + 16 <= M; m += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(code + m));
+        __m512i idx = _mm512_add_epi32(_mm512_cvtepu8_epi32(bytes), step);
+        sum = _mm512_add_ps(sum, _mm512_i32gather_ps(idx, lut + m * 256, 4));
+    }
+    float result = _mm512_reduce_add_ps(sum);
+    for (; m < M; ++m) {
+        result += lut[m * 256 + code[m]];
+    }
+    return result;
+}
+
+__attribute__((target("avx2")))
+inline void adc4BlockAvx2(const uint8_t *lut8, const uint8_t *block, unsigned M, uint16_t *sums)
+{
+    __m256i lo = _mm256_setzero_si256();
+    __m256i hi = _mm256_setzero_si256();
+    for (unsigned m = 0; m != M; ++m) {
+        __m256i table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(lut8 + m * 16)));
+        __m256i codes = _mm256_loadu_si256((const __m256i *)(block + m * ADC_BLOCK));
+        __m256i values = _mm256_shuffle_epi8(table, codes);
+        lo = _mm256_adds_epu16(lo, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(values)));
+        hi = _mm256_adds_epu16(hi, _mm256_cvtepu8_epi16(_mm256_extracti128_si256(values, 1)));
+    }
+    _mm256_storeu_si256((__m256i *)sums, lo);
+    _mm256_storeu_si256((__m256i *)(sums + 16), hi);
+}
+#endif
+
+/**
+ * ADC kernels, resolved once for the active instruction set.
+ */
+struct AdcKernels {
+    typedef float (*Adc8Func)(const float *, const uint8_t *, unsigned);
+    typedef void (*Adc4BlockFunc)(const uint8_t *, const uint8_t *, unsigned, uint16_t *);
+    Adc8Func adc8;
+    Adc4BlockFunc adc4Block;
+
+    static const AdcKernels &get() {
+        static const AdcKernels kernels = []() {
+            AdcKernels k = {&adc8Scalar, &adc4BlockScalar};
+#ifdef LSHBOX_SIMD_X86
+            Isa isa = activeIsa();
+            // every CPU with AVX-512F also has AVX2
+            if (isa >= ISA_AVX2) {
+                k.adc8 = &adc8Avx2;
+                k.adc4Block = &adc4BlockAvx2;
+            }
+            if (isa >= ISA_AVX512) {
+                k.adc8 = &adc8Avx512;
+            }
+#endif
+            return k;
+        }();
+        return kernels;
+    }
+};
+}
+}
@@ -0,0 +1,1153 @@
+/**
+ * @file distance.h
+ *
+ * @brief Distance kernels with runtime CPU dispatch.
+ *
+ * Every kernel has a scalar template version and, for float on x86, SSE, AVX2
+ * and AVX-512 versions. The widest instruction set supported by the CPU is
+ * detected once at startup, and the environment variable GQR_SIMD (scalar,
+ * sse, avx2 or avx512) can lower it, e.g. to compare kernels.
+ *
+ * Kernels return ranking distances: squared L2, negated inner product and
+ * 1 - cos for angular. Metric::finalize converts them for output.
+ */
+#pragma once
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LSHBOX_SIMD_X86 1
+#include <immintrin.h>
+#endif
+namespace lshbox
+{
+namespace simd
+{
+enum Isa {ISA_SCALAR = 0, ISA_SSE = 1, ISA_AVX2 = 2, ISA_AVX512 = 3};
+
+inline const char *isaName(Isa isa)
+{
+    static const char *names[] = {"scalar", "sse", "avx2", "avx512"};
+    return names[isa];
+}
+
+inline Isa detectIsa()
+{
+#ifdef LSHBOX_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return ISA_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return ISA_AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return ISA_SSE;
+    }
+#endif
+    return ISA_SCALAR;
+}
+
+/**
+ * The instruction set used by the kernels, detected once.
+ */
+inline Isa activeIsa()
+{
+    static const Isa isa = []() {
+        Isa detected = detectIsa();
+        const char *env = std::getenv("GQR_SIMD");
+        if (env != NULL) {
+            for (int i = ISA_SCALAR; i <= ISA_AVX512; ++i) {
+                if (strcmp(env, isaName((Isa)i)) == 0 && i < detected) {
+                    return (Isa)i;
+                }
+            }
+        }
+        return detected;
+    }();
+    return isa;
+}
+
+//--------------------- Scalar ------------------
+template <typename T>
+float l1Scalar(const T *a, const T *b, unsigned dim)
+{
+    float sum = 0;
+    for (unsigned i = 0; i != dim; ++i) {
+        sum += float(std::abs(a[i] * 1.0 - b[i]));
+    }
+    return sum;
+}
+
+template <typename T>
+float l2sqrScalar(const T *a, const T *b, unsigned dim)
+{
+    float sum = 0;
+    for (unsigned i = 0; i != dim; ++i) {
+        float diff = a[i] - b[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+template <typename T>
+float dotScalar(const T *a, const T *b, unsigned dim)
+{
+    float sum = 0;
+    for (unsigned i = 0; i != dim; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+template <typename T>
+float cosineScalar(const T *a, const T *b, unsigned dim)
+{
+    float dot = 0;
+    float normA = 0;
+    float normB = 0;
+    for (unsigned i = 0; i != dim; ++i) {
+        dot += a[i] * b[i];
+        normA += a[i] * a[i];
+        normB += b[i] * b[i];
+    }
+    return 1 - dot / std::sqrt(normA * normB);
+}
+
+#ifdef LSHBOX_SIMD_X86
+//--------------------- SSE ------------------
+__attribute__((target("sse2")))
+inline float hsumSse(__m128 v)
+{
+    __m128 shuf = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+    __m128 sums = _mm_add_ps(v, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    sums = _mm_add_ss(sums, shuf);
+    return _mm_cvtss_f32(sums);
+}
+
+__attribute__((target("sse2")))
+inline float l1Sse(const float *a, const float *b, unsigned dim)
+{
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    __m128 sum = _mm_setzero_ps();
+    unsigned i = 0;
+    for (; i + 4 <= dim; i += 4) {
+        __m128 diff = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+        sum = _mm_add_ps(sum, _mm_andnot_ps(signMask, diff));
+    }
+    float result = hsumSse(sum);
+    for (; i < dim; ++i) {
+        result += std::fabs(a[i] - b[i]);
+    }
+    return result;
+}
+
+__attribute__((target("sse2")))
+inline float l2sqrSse(const float *a, const float *b, unsigned dim)
+{
+    __m128 sum = _mm_setzero_ps();
+    unsigned i = 0;
+    for (; i + 4 <= dim; i += 4) {
+        __m128 diff = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+        sum = _mm_add_ps(sum, _mm_mul_ps(diff, diff));
+    }
+    float result = hsumSse(sum);
+    for (; i < dim; ++i) {
+        float diff = a[i] - b[i];
+        result += diff * diff;
+    }
+    return result;
+}
+
+__attribute__((target("sse2")))
+inline float dotSse(const float *a, const float *b, unsigned dim)
+{
+    __m128 sum = _mm_setzero_ps();
+    unsigned i = 0;
+    for (; i + 4 <= dim; i += 4) {
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+    float result = hsumSse(sum);
+    for (; i < dim; ++i) {
+        result += a[i] * b[i];
+    }
+    return result;
+}
+
+__attribute__((target("sse2")))
+inline float cosineSse(const float *a, const float *b, unsigned dim)
+{
+    __m128 dot = _mm_setzero_ps();
+    __m128 normA = _mm_setzero_ps();
+    __m128 normB = _mm_setzero_ps();
+    unsigned i = 0;
+    for (; i + 4 <= dim; i += 4) {
+        __m128 va = _mm_loadu_ps(a + i);
+        __m128 vb = _mm_loadu_ps(b + i);
+        dot = _mm_add_ps(dot, _mm_mul_ps(va, vb));
+        normA = _mm_add_ps(normA, _mm_mul_ps(va, va));
+        normB = _mm_add_ps(normB, _mm_mul_ps(vb, vb));
+    }
+    float d = hsumSse(dot);
+    float na = hsumSse(normA);
+    float nb = hsumSse(normB);
+    for (; i < dim; ++i) {
+        d += a[i] * b[i];
+        na += a[i] * a[i];
+        nb += b[i] * b[i];
+    }
+    return 1 - d / std::sqrt(na * nb);
+}
+
+//--------------------- AVX2 ------------------
+__attribute__((target("avx2,fma")))
+inline float hsumAvx2(__m256 v)
+{
+    __m128 lo = _mm256_castps256_ps128(v);
+    __m128 hi = _mm256_extractf128_ps(v, 1);
+    lo = _mm_add_ps(lo, hi);
+    __m128 shuf = _mm_movehdup_ps(lo);
+    __m128 sums = _mm_add_ps(lo, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    sums = _mm_add_ss(sums, shuf);
+    return _mm_cvtss_f32(sums);
+}
+
+__attribute__((target("avx2,fma")))
+inline float l1Avx2(const float *a, const float *b, unsigned dim)
+{
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+    unsigned i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+        sum0 = _mm256_add_ps(sum0, _mm256_andnot_ps(signMask, d0));
+        sum1 = _mm256_add_ps(sum1, _mm256_andnot_ps(signMask, d1));
+    }
+    for (; i + 8 <= dim; i += 8) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        sum0 = _mm256_add_ps(sum0, _mm256_andnot_ps(signMask, d0));
+    }
+    float result = hsumAvx2(_mm256_add_ps(sum0, sum1));
+    for (; i < dim; ++i) {
+        result += std::fabs(a[i] - b[i]);
+    }
+    return result;
+}
+
+__attribute__((target("avx2,fma")))
+inline float l2sqrAvx2(const float *a, const float *b, unsigned dim)
+{
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+    unsigned i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+        sum0 = _mm256_fmadd_ps(d0, d0, sum0);
+        sum1 = _mm256_fmadd_ps(d1, d1, sum1);
+    }
+    for (; i + 8 <= dim; i += 8) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        sum0 = _mm256_fmadd_ps(d0, d0, sum0);
+    }
+    float result = hsumAvx2(_mm256_add_ps(sum0, sum1));
+    for (; i < dim; ++i) {
+        float diff = a[i] - b[i];
+        result += diff * diff;
+    }
+    return result;
+}
+
+__attribute__((target("avx2,fma")))
+inline float dotAvx2(const float *a, const float *b, unsigned dim)
+{
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+    unsigned i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), sum0);
+        sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), sum1);
+    }
+    for (; i + 8 <= dim; i += 8) {
+        sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), sum0);
+    }
+    float result = hsumAvx2(_mm256_add_ps(sum0, sum1));
+    for (; i < dim; ++i) {
+        result += a[i] * b[i];
+    }
+    return result;
+}
+
+__attribute__((target("avx2,fma")))
+inline float cosineAvx2(const float *a, const float *b, unsigned dim)
+{
+    __m256 dot = _mm256_setzero_ps();
+    __m256 normA = _mm256_setzero_ps();
+    __m256 normB = _mm256_setzero_ps();
+    unsigned i = 0;
+    for (; i + 8 <= dim; i += 8) {
+        __m256 va = _mm256_loadu_ps(a + i);
+        __m256 vb = _mm256_loadu_ps(b + i);
+        dot = _mm256_fmadd_ps(va, vb, dot);
+        normA = _mm256_fmadd_ps(va, va, normA);
+        normB = _mm256_fmadd_ps(vb, vb, normB);
+    }
+    float d = hsumAvx2(dot);
+    float na = hsumAvx2(normA);
+    float nb = hsumAvx2(normB);
+    for (; i < dim; ++i) {
+        d += a[i] * b[i];
+        na += a[i] * a[i];
+        nb += b[i] * b[i];
+    }
+    return 1 - d / std::sqrt(na * nb);
+}
+
+//--------------------- AVX-512 ------------------
+__attribute__((target("avx512f")))
+inline __mmask16 tailMask512(unsigned rest)
+{
+    return (__mmask16)((1u << rest) - 1);
+}
+
+__attribute__((target("avx512f")))
+inline float l1Avx512(const float *a, const float *b, unsigned dim)
+{
+    __m512 sum = _mm512_setzero_ps();
+    unsigned i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        __m512 diff = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        sum = _mm512_add_ps(sum, _mm512_abs_ps(diff));
+    }
+    if (i < dim) {
+        __mmask16 m = tailMask512(dim - i);
+        __m512 diff = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i));
+        sum = _mm512_add_ps(sum, _mm512_abs_ps(diff));
+    }
+    return _mm512_reduce_add_ps(sum);
+}
+
+__attribute__((target("avx512f")))
+inline float l2sqrAvx512(const float *a, const float *b, unsigned dim)
+{
+    __m512 sum0 = _mm512_setzero_ps();
+    __m512 sum1 = _mm512_setzero_ps();
+    unsigned i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+        sum0 = _mm512_fmadd_ps(d0, d0, sum0);
+        sum1 = _mm512_fmadd_ps(d1, d1, sum1);
+    }
+    for (; i + 16 <= dim; i += 16) {
+        __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        sum0 = _mm512_fmadd_ps(d0, d0, sum0);
+    }
+    if (i < dim) {
+        __mmask16 m = tailMask512(dim - i);
+        __m512 d0 = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i));
+        sum1 = _mm512_fmadd_ps(d0, d0, sum1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(sum0, sum1));
+}
+
+__attribute__((target("avx512f")))
+inline float dotAvx512(const float *a, const float *b, unsigned dim)
+{
+    __m512 sum0 = _mm512_setzero_ps();
+    __m512 sum1 = _mm512_setzero_ps();
+    unsigned i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), sum0);
+        sum1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), sum1);
+    }
+    for (; i + 16 <= dim; i += 16) {
+        sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), sum0);
+    }
+    if (i < dim) {
+        __mmask16 m = tailMask512(dim - i);
+        sum1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i), sum1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(sum0, sum1));
+}
+
+__attribute__((target("avx512f")))
+inline float cosineAvx512(const float *a, const float *b, unsigned dim)
+{
+    __m512 dot = _mm512_setzero_ps();
+    __m512 normA = _mm512_setzero_ps();
+    __m512 normB = _mm512_setzero_ps();
+    unsigned i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        __m512 va = _mm512_loadu_ps(a + i);
+        __m512 vb = _mm512_loadu_ps(b + i);
+        dot = _mm512_fmadd_ps(va, vb, dot);
+        normA = _mm512_fmadd_ps(va, va, normA);
+        normB = _mm512_fmadd_ps(vb, vb, normB);
+    }
+    if (i < dim) {
+        __mmask16 m = tailMask512(dim - i);
+        __m512 va = _mm512_maskz_loadu_ps(m, a + i);
+        __m512 vb = _mm512_maskz_loadu_ps(m, b + i);
+        dot = _mm512_fmadd_ps(va, vb, dot);
+        normA = _mm512_fmadd_ps(va, va, normA);
+        normB = _mm512_fmadd_ps(vb, vb, normB);
+    }
+    float d = _mm512_reduce_add_ps(dot);
+    float na = _mm512_reduce_add_ps(normA);
+    float nb = _mm512_reduce_add_ps(normB);
+    return 1 - d / std::sqrt(na * nb);
+}
+#endif
+
+//--------------------- Early abandon ------------------
+/*
+ * Bounded kernels stop once the partial sum exceeds bound, which is checked
+ * every ABANDON_BLOCK dimensions, and report the dimensions read in touched.
+ * The terms are non-negative so a partial sum never exceeds the full one, and
+ * the summation order is the one of the unbounded kernel, so a candidate that
+ * is not abandoned gets exactly the same distance.
+ */
+const unsigned ABANDON_BLOCK = 64;
+
+template <typename T>
+float l1BoundedScalar(const T *a, const T *b, unsigned dim, float bound, unsigned *touched)
+{
+    float sum = 0;
+    unsigned i = 0;
+    while (i + ABANDON_BLOCK <= dim) {
+        for (unsigned end = i + ABANDON_BLOCK; i != end; ++i) {
+            sum += float(std::abs(a[i] * 1.0 - b[i]));
+        }
+        if (sum > bound) {
+            *touched = i;
+            return sum;
+        }
+    }
+    for (; i != dim; ++i) {
+        sum += float(std::abs(a[i] * 1.0 - b[i]));
+    }
+    *touched = dim;
+    return sum;
+}
+
+template <typename T>
+float l2sqrBoundedScalar(const T *a, const T *b, unsigned dim, float bound, unsigned *touched)
+{
+    float sum = 0;
+    unsigned i = 0;
+    while (i + ABANDON_BLOCK <= dim) {
+        for (unsigned end = i + ABANDON_BLOCK; i != end; ++i) {
+            float diff = a[i] - b[i];
+            sum += diff * diff;
+        }
+        if (sum > bound) {
+            *touched = i;
+            return sum;
+        }
+    }
+    for (; i != dim; ++i) {
+        float diff = a[i] - b[i];
+        sum += diff * diff;
+    }
+    *touched = dim;
+    return sum;
+}
+
+#ifdef LSHBOX_SIMD_X86
+__attribute__((target("sse2")))
+inline float l1BoundedSse(const float *a, const float *b, unsigned dim, float bound, unsigned *touched)
+{
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    __m128 sum = _mm_setzero_ps();
+    unsigned i = 0;
+    for (; i + 4 <= dim; i += 4) {
+        __m128 diff = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+        sum = _mm_add_ps(sum, _mm_andnot_ps(signMask, diff));
+        if ((i + 4) % ABANDON_BLOCK == 0 && hsumSse(sum) > bound) {
+            *touched = i + 4;
+            return hsumSse(sum);
+        }
+    }
+    float result = hsumSse(sum);
+    for (; i < dim; ++i) {
+        result += std::fabs(a[i] - b[i]);
+    }
+    *touched = dim;
+    return result;
+}
+
+__attribute__((target("sse2")))
+inline float l2sqrBoundedSse(const float *a, const float *b, unsigned dim, float bound, unsigned *touched)
+{
+    __m128 sum = _mm_setzero_ps();
+    unsigned i = 0;
+    for (; i + 4 <= dim; i += 4) {
+        __m128 diff = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+        sum = _mm_add_ps(sum, _mm_mul_ps(diff, diff));
+        if ((i + 4) % ABANDON_BLOCK == 0 && hsumSse(sum) > bound) {
+            *touched = i + 4;
+            return hsumSse(sum);
+        }
+    }
+    float result = hsumSse(sum);
+    for (; i < dim; ++i) {
+        float diff = a[i] - b[i];
+        result += diff * diff;
+    }
+    *touched = dim;
+    return result;
+}
+
+__attribute__((target("avx2,fma")))
+inline float l1BoundedAvx2(const float *a, const float *b, unsigned dim, float bound, unsigned *touched)
+{
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+    unsigned i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+        sum0 = _mm256_add_ps(sum0, _mm256_andnot_ps(signMask, d0));
+        sum1 = _mm256_add_ps(sum1, _mm256_andnot_ps(signMask, d1));
+        if ((i + 16) % ABANDON_BLOCK == 0) {
+            float partial = hsumAvx2(_mm256_add_ps(sum0, sum1));
+            if (partial > bound) {
+                *touched = i + 16;
+                return partial;
+            }
+        }
+    }
+    for (; i + 8 <= dim; i += 8) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        sum0 = _mm256_add_ps(sum0, _mm256_andnot_ps(signMask, d0));
+    }
+    float result = hsumAvx2(_mm256_add_ps(sum0, sum1));
+    for (; i < dim; ++i) {
+        result += std::fabs(a[i] - b[i]);
+    }
+    *touched = dim;
+    return result;
+}
+
+__attribute__((target("avx2,fma")))
+inline float l2sqrBoundedAvx2(const float *a, const float *b, unsigned dim, float bound, unsigned *touched)
+{
+    __m256 sum0 = _mm256_setzero_ps();
+    __m256 sum1 = _mm256_setzero_ps();
+    unsigned i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+        sum0 = _mm256_fmadd_ps(d0, d0, sum0);
+        sum1 = _mm256_fmadd_ps(d1, d1, sum1);
+        if ((i + 16) % ABANDON_BLOCK == 0) {
+            float partial = hsumAvx2(_mm256_add_ps(sum0, sum1));
+            if (partial > bound) {
+                *touched = i + 16;
+                return partial;
+            }
+        }
+    }
+    for (; i + 8 <= dim; i += 8) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        sum0 = _mm256_fmadd_ps(d0, d0, sum0);
+    }
+    float result = hsumAvx2(_mm256_add_ps(sum0, sum1));
+    for (; i < dim; ++i) {
+        float diff = a[i] - b[i];
+        result += diff * diff;
+    }
+    *touched = dim;
+    return result;
+}
+
+__attribute__((target("avx512f")))
+inline float l1BoundedAvx512(const float *a, const float *b, unsigned dim, float bound, unsigned *touched)
+{
+    __m512 sum = _mm512_setzero_ps();
+    unsigned i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        __m512 diff = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        sum = _mm512_add_ps(sum, _mm512_abs_ps(diff));
+        if ((i + 16) % ABANDON_BLOCK == 0) {
+            float partial = _mm512_reduce_add_ps(sum);
+            if (partial > bound) {
+                *touched = i + 16;
+                return partial;
+            }
+        }
+    }
+    if (i < dim) {
+        __mmask16 m = tailMask512(dim - i);
+        __m512 diff = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i));
+        sum = _mm512_add_ps(sum, _mm512_abs_ps(diff));
+    }
+    *touched = dim;
+    return _mm512_reduce_add_ps(sum);
+}
+
+__attribute__((target("avx512f")))
+inline float l2sqrBoundedAvx512(const float *a, const float *b, unsigned dim, float bound, unsigned *touched)
+{
+    __m512 sum0 = _mm512_setzero_ps();
+    __m512 sum1 = _mm512_setzero_ps();
+    unsigned i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+        sum0 = _mm512_fmadd_ps(d0, d0, sum0);
+        sum1 = _mm512_fmadd_ps(d1, d1, sum1);
+        if ((i + 32) % ABANDON_BLOCK == 0) {
+            float partial = _mm512_reduce_add_ps(_mm512_add_ps(sum0, sum1));
+            if (partial > bound) {
+                *touched = i + 32;
+                return partial;
+            }
+        }
+    }
+    for (; i + 16 <= dim; i += 16) {
+        __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        sum0 = _mm512_fmadd_ps(d0, d0, sum0);
+    }
+    if (i < dim) {
+        __mmask16 m = tailMask512(dim - i);
+        __m512 d0 = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i));
+        sum1 = _mm512_fmadd_ps(d0, d0, sum1);
+    }
+    *touched = dim;
+    return _mm512_reduce_add_ps(_mm512_add_ps(sum0, sum1));
+}
+#endif
+
+//--------------------- One query, many items ------------------
+/*
+ * Many kernels set out[i] to the distance of the query q to items[i], for
+ * i < n. The SIMD ones walk MANY_WAYS items at a time, so each load of the
+ * query feeds all of them and the loads of the items are in flight together.
+ * Every item keeps the accumulators and summation order of the one-to-one
+ * kernel, so the distances are exactly the ones of the one-to-one kernel.
+ * Only l2sqr and dot have them on each instruction set: AG_DIST goes through
+ * dotMany() once the norms are cached, and L1 is abandoned early by default,
+ * so l1 and cosine use manyOf().
+ */
+const unsigned MANY_WAYS = 4;
+
+template <typename T, float (*F)(const T *, const T *, unsigned)>
+void manyOf(const T *q, const T *const *items, unsigned n, unsigned dim, float *out)
+{
+    for (unsigned j = 0; j != n; ++j) {
+        out[j] = F(q, items[j], dim);
+    }
+}
+
+/*
+ * Hint the cache lines of bytes bytes starting at p into the cache.
+ */
+inline void prefetch(const void *p, size_t bytes)
+{
+#ifdef __GNUC__
+    const char *c = (const char *)p;
+    for (size_t off = 0; off < bytes; off += 64) {
+        __builtin_prefetch(c + off);
+    }
+#endif
+}
+
+#ifdef LSHBOX_SIMD_X86
+__attribute__((target("sse2")))
+inline void l2sqrManySse(const float *q, const float *const *items, unsigned n, unsigned dim, float *out)
+{
+    unsigned j = 0;
+    for (; j + MANY_WAYS <= n; j += MANY_WAYS) {
+        const float *const *b = items + j;
+        __m128 sum[MANY_WAYS];
+        for (unsigned r = 0; r != MANY_WAYS; ++r) {
+            sum[r] = _mm_setzero_ps();
+        }
+        unsigned i = 0;
+        for (; i + 4 <= dim; i += 4) {
+            __m128 q0 = _mm_loadu_ps(q + i);
+            for (unsigned r = 0; r != MANY_WAYS; ++r) {
+                __m128 diff = _mm_sub_ps(q0, _mm_loadu_ps(b[r] + i));
+                sum[r] = _mm_add_ps(sum[r], _mm_mul_ps(diff, diff));
+            }
+        }
+        for (unsigned r = 0; r != MANY_WAYS; ++r) {
+            float result = hsumSse(sum[r]);
+            for (unsigned k = i; k < dim; ++k) {
+                float diff = q[k] - b[r][k];
+                result += diff * diff;
+            }
+            out[j + r] = result;
+        }
+    }
+    for (; j < n; ++j) {
+        out[j] = l2sqrSse(q, items[j], dim);
+    }
+}
+
+__attribute__((target("sse2")))
+inline void dotManySse(const float *q, const float *const *items, unsigned n, unsigned dim, float *out)
+{
+    unsigned j = 0;
+    for (; j + MANY_WAYS <= n; j += MANY_WAYS) {
+        const float *const *b = items + j;
+        __m128 sum[MANY_WAYS];
+        for (unsigned r = 0; r != MANY_WAYS; ++r) {
+            sum[r] = _mm_setzero_ps();
+        }
+        unsigned i = 0;
+        for (; i + 4 <= dim; i += 4) {
+            __m128 q0 = _mm_loadu_ps(q + i);
+            for (unsigned r = 0; r != MANY_WAYS; ++r) {
+                sum[r] = _mm_add_ps(sum[r], _mm_mul_ps(q0, _mm_loadu_ps(b[r] + i)));
+            }
+        }
+        for (unsigned r = 0; r != MANY_WAYS; ++r) {
+            float result = hsumSse(sum[r]);
+            for (unsigned k = i; k < dim; ++k) {
+                result += q[k] * b[r][k];
+            }
+            out[j + r] = result;
+        }
+    }
+    for (; j < n; ++j) {
+        out[j] = dotSse(q, items[j], dim);
+    }
+}
+
+__attribute__((target("avx2,fma")))
+inline void l2sqrManyAvx2(const float *q, const float *const *items, unsigned n, unsigned dim, float *out)
+{
+    unsigned j = 0;
+    for (; j + MANY_WAYS <= n; j += MANY_WAYS) {
+        const float *const *b = items + j;
+        __m256 sum0[MANY_WAYS];
+        __m256 sum1[MANY_WAYS];
+        for (unsigned r = 0; r != MANY_WAYS; ++r) {
+            sum0[r] = _mm256_setzero_ps();
+            sum1[r] = _mm256_setzero_ps();
+        }
+        unsigned i = 0;
+        for (; i + 16 <= dim; i += 16) {
+            __m256 q0 = _mm256_loadu_ps(q + i);
+            __m256 q1 = _mm256_loadu_ps(q + i + 8);
+            for (unsigned r = 0; r != MANY_WAYS; ++r) {
+                __m256 d0 = _mm256_sub_ps(q0, _mm256_loadu_ps(b[r] + i));
+                __m256 d1 = _mm256_sub_ps(q1, _mm256_loadu_ps(b[r] + i + 8));
+                sum0[r] = _mm256_fmadd_ps(d0, d0, sum0[r]);
+                sum1[r] = _mm256_fmadd_ps(d1, d1, sum1[r]);
+            }
+        }
+        for (; i + 8 <= dim; i += 8) {
+            __m256 q0 = _mm256_loadu_ps(q + i);
+            for (unsigned r = 0; r != MANY_WAYS; ++r) {
+                __m256 d0 = _mm256_sub_ps(q0, _mm256_loadu_ps(b[r] + i));
+                sum0[r] = _mm256_fmadd_ps(d0, d0, sum0[r]);
+            }
+        }
+        for (unsigned r = 0; r != MANY_WAYS; ++r) {
+            float result = hsumAvx2(_mm256_add_ps(sum0[r], sum1[r]));
+            for (unsigned k = i; k < dim; ++k) {
+                float diff = q[k] - b[r][k];
+                result += diff * diff;
+            }
+            out[j + r] = result;
+        }
+    }
+    for (; j < n; ++j) {
+        out[j] = l2sqrAvx2(q, items[j], dim);
+    }
+}
+
+__attribute__((target("avx2,fma")))
+inline void dotManyAvx2(const float *q, const float *const *items, unsigned n, unsigned dim, float *out)
+{
+    unsigned j = 0;
+    for (; j + MANY_WAYS <= n; j += MANY_WAYS) {
+        const float *const *b = items + j;
+        __m256 sum0[MANY_WAYS];
+        __m256 sum1[MANY_WAYS];
+        for (unsigned r = 0; r != MANY_WAYS; ++r) {
+            sum0[r] = _mm256_setzero_ps();
+            sum1[r] = _mm256_setzero_ps();
+        }
+        unsigned i = 0;
+        for (; i + 16 <= dim; i += 16) {
+            __m256 q0 = _mm256_loadu_ps(q + i);
+            __m256 q1 = _mm256_loadu_ps(q + i + 8);
+            for (unsigned r = 0; r != MANY_WAYS; ++r) {
+                sum0[r] = _mm256_fmadd_ps(q0, _mm256_loadu_ps(b[r] + i), sum0[r]);
+                sum1[r] = _mm256_fmadd_ps(q1, _mm256_loadu_ps(b[r] + i + 8), sum1[r]);
+            }
+        }
+        for (; i + 8 <= dim; i += 8) {
+            __m256 q0 = _mm256_loadu_ps(q + i);
+            for (unsigned r = 0; r != MANY_WAYS; ++r) {
+                sum0[r] = _mm256_fmadd_ps(q0, _mm256_loadu_ps(b[r] + i), sum0[r]);
+            }
+        }
+        for (unsigned r = 0; r != MANY_WAYS; ++r) {
+            float result = hsumAvx2(_mm256_add_ps(sum0[r], sum1[r]));
+            for (unsigned k = i; k < dim; ++k) {
+                result += q[k] * b[r][k];
+            }
+            out[j + r] = result;
+        }
+    }
+    for (; j < n; ++j) {
+        out[j] = dotAvx2(q, items[j], dim);
+    }
+}
+
+__attribute__((target("avx512f")))
+inline void l2sqrManyAvx512(const float *q, const float *const *items, unsigned n, unsigned dim, float *out)
+{
+    unsigned j = 0;
+    for (; j + MANY_WAYS <= n; j += MANY_WAYS) {
+        const float *const *b = items + j;
+        __m512 sum0[MANY_WAYS];
+        __m512 sum1[MANY_WAYS];
+        for (unsigned r = 0; r != MANY_WAYS; ++r) {
+            sum0[r] = _mm512_setzero_ps();
+            sum1[r] = _mm512_setzero_ps();
+        }
+        unsigned i = 0;
+        for (; i + 32 <= dim; i += 32) {
+            __m512 q0 = _mm512_loadu_ps(q + i);
+            __m512 q1 = _mm512_loadu_ps(q + i + 16);
+            for (unsigned r = 0; r != MANY_WAYS; ++r) {
+                __m512 d0 = _mm512_sub_ps(q0, _mm512_loadu_ps(b[r] + i));
+                __m512 d1 = _mm512_sub_ps(q1, _mm512_loadu_ps(b[r] + i + 16));
+                sum0[r] = _mm512_fmadd_ps(d0, d0, sum0[r]);
+                sum1[r] = _mm512_fmadd_ps(d1, d1, sum1[r]);
+            }
+        }
+        for (; i + 16 <= dim; i += 16) {
+            __m512 q0 = _mm512_loadu_ps(q + i);
+            for (unsigned r = 0; r != MANY_WAYS; ++r) {
+                __m512 d0 = _mm512_sub_ps(q0, _mm512_loadu_ps(b[r] + i));
+                sum0[r] = _mm512_fmadd_ps(d0, d0, sum0[r]);
+            }
+        }
+        if (i < dim) {
+            __mmask16 m = tailMask512(dim - i);
+            __m512 q0 = _mm512_maskz_loadu_ps(m, q + i);
+            for (unsigned r = 0; r != MANY_WAYS; ++r) {
+                __m512 d0 = _mm512_sub_ps(q0, _mm512_maskz_loadu_ps(m, b[r] + i));
+                sum1[r] = _mm512_fmadd_ps(d0, d0, sum1[r]);
+            }
+        }
+        for (unsigned r = 0; r != MANY_WAYS; ++r) {
+            out[j + r] = _mm512_reduce_add_ps(_mm512_add_ps(sum0[r], sum1[r]));
+        }
+    }
+    for (; j < n; ++j) {
+        out[j] = l2sqrAvx512(q, items[j], dim);
+    }
+}
+
+__attribute__((target("avx512f")))
+inline void dotManyAvx512(const float *q, const float *const *items, unsigned n, unsigned dim, float *out)
+{
+    unsigned j = 0;
+    for (; j + MANY_WAYS <= n; j += MANY_WAYS) {
+        const float *const *b = items + j;
+        __m512 sum0[MANY_WAYS];
+        __m512 sum1[MANY_WAYS];
+        for (unsigned r = 0; r != MANY_WAYS; ++r) {
+            sum0[r] = _mm512_setzero_ps();
+            sum1[r] = _mm512_setzero_ps();
+        }
+        unsigned i = 0;
+        for (; i + 32 <= dim; i += 32) {
+            __m512 q0 = _mm512_loadu_ps(q + i);
+            __m512 q1 = _mm512_loadu_ps(q + i + 16);
+            for (unsigned r = 0; r != MANY_WAYS; ++r) {
+                sum0[r] = _mm512_fmadd_ps(q0, _mm512_loadu_ps(b[r] + i), sum0[r]);
+                sum1[r] = _mm512_fmadd_ps(q1, _mm512_loadu_ps(b[r] + i + 16), sum1[r]);
+            }
+        }
+        for (; i + 16 <= dim; i += 16) {
+            __m512 q0 = _mm512_loadu_ps(q + i);
+            for (unsigned r = 0; r != MANY_WAYS; ++r) {
+                sum0[r] = _mm512_fmadd_ps(q0, _mm512_loadu_ps(b[r] + i), sum0[r]);
+            }
+        }
+        if (i < dim) {
+            __mmask16 m = tailMask512(dim - i);
+            __m512 q0 = _mm512_maskz_loadu_ps(m, q + i);
+            for (unsigned r = 0; r != MANY_WAYS; ++r) {
+                sum1[r] = _mm512_fmadd_ps(q0, _mm512_maskz_loadu_ps(m, b[r] + i), sum1[r]);
+            }
+        }
+        for (unsigned r = 0; r != MANY_WAYS; ++r) {
+            out[j + r] = _mm512_reduce_add_ps(_mm512_add_ps(sum0[r], sum1[r]));
+        }
+    }
+    for (; j < n; ++j) {
+        out[j] = dotAvx512(q, items[j], dim);
+    }
+}
+#endif
+
+template <typename T, float (*F)(const T *, const T *, unsigned)>
+float negated(const T *a, const T *b, unsigned dim)
+{
+    return -F(a, b, dim);
+}
+
+/**
+ * The kernels of one data type, resolved once for the active instruction set.
+ */
+template <typename T>
+struct KernelSet {
+    typedef float (*Func)(const T *, const T *, unsigned);
+    typedef float (*BoundedFunc)(const T *, const T *, unsigned, float, unsigned *);
+    typedef void (*ManyFunc)(const T *, const T *const *, unsigned, unsigned, float *);
+    Func l1;
+    Func l2sqr;
+    Func dot;
+    Func negDot;
+    Func cosine;
+    BoundedFunc l1Bounded;
+    BoundedFunc l2sqrBounded;
+    ManyFunc l1Many;
+    ManyFunc l2sqrMany;
+    ManyFunc dotMany;
+    ManyFunc cosineMany;
+
+    static const KernelSet &get() {
+        static const KernelSet kernels = {
+            &l1Scalar<T>,
+            &l2sqrScalar<T>,
+            &dotScalar<T>,
+            &negated<T, &dotScalar<T> >,
+            &cosineScalar<T>,
+            &l1BoundedScalar<T>,
+            &l2sqrBoundedScalar<T>,
+            &manyOf<T, &l1Scalar<T> >,
+            &manyOf<T, &l2sqrScalar<T> >,
+            &manyOf<T, &dotScalar<T> >,
+            &manyOf<T, &cosineScalar<T> >
+        };
+        return kernels;
+    }
+};
+
+template <>
+inline const KernelSet<float> &KernelSet<float>::get()
+{
+    static const KernelSet<float> kernels = []() {
+        KernelSet<float> k = {
+            &l1Scalar<float>,
+            &l2sqrScalar<float>,
+            &dotScalar<float>,
+            &negated<float, &dotScalar<float> >,
+            &cosineScalar<float>,
+            &l1BoundedScalar<float>,
+            &l2sqrBoundedScalar<float>,
+            &manyOf<float, &l1Scalar<float> >,
+            &manyOf<float, &l2sqrScalar<float> >,
+            &manyOf<float, &dotScalar<float> >,
+            &manyOf<float, &cosineScalar<float> >
+        };
+#ifdef LSHBOX_SIMD_X86
+        switch (activeIsa()) {
+        case ISA_AVX512:
+            k.l1 = &l1Avx512;
+            k.l2sqr = &l2sqrAvx512;
+            k.dot = &dotAvx512;
+            k.negDot = &negated<float, &dotAvx512>;
+            k.cosine = &cosineAvx512;
+            k.l1Bounded = &l1BoundedAvx512;
+            k.l2sqrBounded = &l2sqrBoundedAvx512;
+            k.l1Many = &manyOf<float, &l1Avx512>;
+            k.l2sqrMany = &l2sqrManyAvx512;
+            k.dotMany = &dotManyAvx512;
+            k.cosineMany = &manyOf<float, &cosineAvx512>;
+            break;
+        case ISA_AVX2:
+            k.l1 = &l1Avx2;
+            k.l2sqr = &l2sqrAvx2;
+            k.dot = &dotAvx2;
+            k.negDot = &negated<float, &dotAvx2>;
+            k.cosine = &cosineAvx2;
+            k.l1Bounded = &l1BoundedAvx2;
+            k.l2sqrBounded = &l2sqrBoundedAvx2;
+            k.l1Many = &manyOf<float, &l1Avx2>;
+            k.l2sqrMany = &l2sqrManyAvx2;
+            k.dotMany = &dotManyAvx2;
+            k.cosineMany = &manyOf<float, &cosineAvx2>;
+            break;
+        case ISA_SSE:
+            k.l1 = &l1Sse;
+            k.l2sqr = &l2sqrSse;
+            k.dot = &dotSse;
+            k.negDot = &negated<float, &dotSse>;
+            k.cosine = &cosineSse;
+            k.l1Bounded = &l1BoundedSse;
+            k.l2sqrBounded = &l2sqrBoundedSse;
+            k.l1Many = &manyOf<float, &l1Sse>;
+            k.l2sqrMany = &l2sqrManySse;
+            k.dotMany = &dotManySse;
+            k.cosineMany = &manyOf<float, &cosineSse>;
+            break;
+        default:
+            break;
+        }
+#endif
+        return k;
+    }();
+    return kernels;
+}
+//--------------------- Quantized codes ------------------
+/*
+ * Integer dot product of int16 weights with uint8 codes, the kernel of
+ * ScalarQuantizer. A candidate reads one byte per dimension; the codes are
+ * widened to int16 and multiplied pairwise into int32 lanes (madd_epi16, or
+ * dpwssd with AVX-512 VNNI). The caller bounds the weights so that the int32
+ * sum cannot overflow, see ScalarQuantizer::prepare().
+ */
+inline int32_t dotU8Scalar(const int16_t *w, const uint8_t *c, unsigned dim)
+{
+    int32_t sum = 0;
+    for (unsigned i = 0; i != dim; ++i) {
+        sum += w[i] * c[i];
+    }
+    return sum;
+}
+
+#ifdef LSHBOX_SIMD_X86
+__attribute__((target("sse2")))
+inline int32_t hsumEpi32Sse(__m128i v)
+{
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(v);
+}
+
+__attribute__((target("sse2")))
+inline int32_t dotU8Sse(const int16_t *w, const uint8_t *c, unsigned dim)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sum0 = _mm_setzero_si128();
+    __m128i sum1 = _mm_setzero_si128();
+    unsigned i = 0;
+    for (; i + 16 <= dim; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(c + i));
+        __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+        __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+        sum0 = _mm_add_epi32(sum0, _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(w + i)), lo));
+        sum1 = _mm_add_epi32(sum1, _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(w + i + 8)), hi));
+    }
+    int32_t result = hsumEpi32Sse(_mm_add_epi32(sum0, sum1));
+    for (; i < dim; ++i) {
+        result += w[i] * c[i];
+    }
+    return result;
+}
+
+__attribute__((target("avx2")))
+inline int32_t dotU8Avx2(const int16_t *w, const uint8_t *c, unsigned dim)
+{
+    __m256i sum0 = _mm256_setzero_si256();
+    __m256i sum1 = _mm256_setzero_si256();
+    unsigned i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        __m256i c0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(c + i)));
+        __m256i c1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(c + i + 16)));
+        sum0 = _mm256_add_epi32(sum0, _mm256_madd_epi16(_mm256_loadu_si256((const __m256i *)(w + i)), c0));
+        sum1 = _mm256_add_epi32(sum1, _mm256_madd_epi16(_mm256_loadu_si256((const __m256i *)(w + i + 16)), c1));
+    }
+    for (; i + 16 <= dim; i += 16) {
+        __m256i c0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(c + i)));
+        sum0 = _mm256_add_epi32(sum0, _mm256_madd_epi16(_mm256_loadu_si256((const __m256i *)(w + i)), c0));
+    }
+    __m256i sum = _mm256_add_epi32(sum0, sum1);
+    int32_t result = hsumEpi32Sse(_mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1)));
+    for (; i < dim; ++i) {
+        result += w[i] * c[i];
+    }
+    return result;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+inline int32_t dotU8Avx512(const int16_t *w, const uint8_t *c, unsigned dim)
+{
+    __m512i sum = _mm512_setzero_si512();
+    unsigned i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        __m512i codes = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *)(c + i)));
+        sum = _mm512_add_epi32(sum, _mm512_madd_epi16(_mm512_loadu_si512(w + i), codes));
+    }
+    int32_t result = _mm512_reduce_add_epi32(sum);
+    for (; i < dim; ++i) {
+        result += w[i] * c[i];
+    }
+    return result;
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vnni")))
+inline int32_t dotU8Vnni(const int16_t *w, const uint8_t *c, unsigned dim)
+{
+    __m512i sum = _mm512_setzero_si512();
+    unsigned i = 0;
+    for (; i + 32 <= dim; i += 32) {
+        __m512i codes = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *)(c + i)));
+        sum = _mm512_dpwssd_epi32(sum, _mm512_loadu_si512(w + i), codes);
+    }
+    int32_t result = _mm512_reduce_add_epi32(sum);
+    for (; i < dim; ++i) {
+        result += w[i] * c[i];
+    }
+    return result;
+}
+#endif
+
+/**
+ * Kernels on quantized codes, resolved once for the active instruction set.
+ */
+struct CodeKernels {
+    typedef int32_t (*DotU8Func)(const int16_t *, const uint8_t *, unsigned);
+    DotU8Func dotU8;
+
+    static const CodeKernels &get() {
+        static const CodeKernels kernels = []() {
+            CodeKernels k = {&dotU8Scalar};
+#ifdef LSHBOX_SIMD_X86
+            switch (activeIsa()) {
+            case ISA_AVX512:
+                // the 16-bit integer instructions need AVX-512BW
+                if (__builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vnni")) {
+                    k.dotU8 = &dotU8Vnni;
+                } else if (__builtin_cpu_supports("avx512bw")) {
+                    k.dotU8 = &dotU8Avx512;
+                } else {
+                    k.dotU8 = &dotU8Avx2;
+                }
+                break;
+            case ISA_AVX2:
+                k.dotU8 = &dotU8Avx2;
+                break;
+            case ISA_SSE:
+                k.dotU8 = &dotU8Sse;
+                break;
+            default:
+                break;
+            }
+#endif
+            return k;
+        }();
+        return kernels;
+    }
+};
+}
+}
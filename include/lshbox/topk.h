@@ -33,201 +33,188 @@
 #include <algorithm>
 #include <utility>
 #include <unordered_set>
+#include <limits>
 #include "lshbox/metric.h"
+#include "lshbox/quantizer.h"
+#include "lshbox/visited.h"
+#include "lshbox/counters.h"
+#include "lshbox/trace.h"
+#include "lshbox/memory.h"
 using std::unordered_set;
 using std::pair;
 using std::vector;
 namespace lshbox
 {
 /**
- * Max Heap.
+ * Top-K container.
  *
- * This is a max heap for TopK.
+ * Holds at most K (distance, key) pairs in a buffer reserved once by reset(),
+ * so push() never allocates. The distance of the current k-th item is cached
+ * and candidates worse than it are rejected by a single comparison.
+ *
+ * For K <= SMALL_K the buffer is kept sorted by insertion, otherwise it is a
+ * binary max heap that genTopk() sorts in place.
  */
-template <typename Comparable>
-class MaxHeap
+class Topk
 {
 public:
-    explicit MaxHeap(int capacity = 100): array(capacity + 1), currentSize(0) {}
-    explicit MaxHeap(const std::vector<Comparable> &items): array(items.size() + 10), currentSize(items.size())
-    {
-        for (int i = 0; i < items.size(); ++i)
-        {
-            array[i + 1] = items[i];
-        }
-        buildHeap();
-    }
-    /**
-     * check if the heap is empty.
-     */
-    bool isEmpty() const
+    static const unsigned SMALL_K = 64;
+private:
+    typedef std::pair<float, unsigned> PairT;
+    unsigned K;
+    // distance of the k-th item, +inf until K items are held
+    float bound_;
+    // heap mode only: tops is sorted ascending instead of being a max heap
+    bool sorted_;
+    std::vector<PairT> tops;
+    // unordered_set<unsigned> ivecs;
+
+    bool small() const
     {
-        return currentSize == 0;
+        return K <= SMALL_K;
     }
-    /**
-     * get the max value.
-     */
-    const Comparable & findMax() const
+    void insertSorted(const PairT &item)
     {
-        if (isEmpty())
+        tops.push_back(item);
+        unsigned hole = tops.size() - 1;
+        for (; hole > 0 && item < tops[hole - 1]; --hole)
         {
-            std::cout << "UnderflowException() ..." << std::endl;
+            tops[hole] = tops[hole - 1];
         }
-        return array[1];
+        tops[hole] = item;
     }
-    /**
-     * inser a value.
-     * @param x the insert value.
-     */
-    void insert(const Comparable & x)
+    void insertHeap(const PairT &item)
     {
-        if (currentSize == array.size() - 1)
+        if (sorted_)
         {
-            array.resize(array.size() * 2);
+            // descending order is a valid max heap
+            std::reverse(tops.begin(), tops.end());
+            sorted_ = false;
         }
-        int hole = ++currentSize;
-        for (; hole > 1 && x > array[hole / 2]; hole /= 2)
+        if (tops.size() == K)
         {
-            array[hole] = array[hole / 2];
+            std::pop_heap(tops.begin(), tops.end());
+            tops.back() = item;
         }
-        array[hole] = x;
-    }
-    /**
-     * delete the max value.
-     */
-    void deleteMax()
-    {
-        if (isEmpty())
+        else
         {
-            std::cout << "UnderflowException() ..." << std::endl;
+            tops.push_back(item);
         }
-        array[1] = array[currentSize--];
-        percolateDown(1);
+        std::push_heap(tops.begin(), tops.end());
     }
-    /**
-     * delete the max value.
-     * @param minItem the max value.
-     */
-    void deleteMax(Comparable &maxItem)
+    const PairT &worst() const
     {
-        if (isEmpty())
-        {
-            std::cout << "UnderflowException() ..." << std::endl;
-        }
-        maxItem = array[1];
-        array[1] = array[currentSize--];
-        percolateDown(1);
+        return small() || sorted_ ? tops.back() : tops.front();
     }
-    /**
-     * make the heap empty.
-     */
-    void makeEmpty()
+    bool pushSlow(unsigned key, float dist)
     {
-        currentSize = 0;
+        PairT item(dist, key);
+        if (tops.size() == K)
+        {
+            if (K == 0 || !(item < worst()))
+            {
+                return false;
+            }
+            if (small())
+            {
+                tops.pop_back();
+            }
+        }
+        if (small())
+        {
+            insertSorted(item);
+        }
+        else
+        {
+            insertHeap(item);
+        }
+        if (tops.size() == K)
+        {
+            bound_ = worst().first;
+        }
+        return true;
     }
+public:
+    Topk(): K(0), bound_(std::numeric_limits<float>::infinity()), sorted_(true) {}
     /**
-     * the size of max heap.
+     * reset K value.
+     * @param _K the K value in TopK.
      */
-    int size()
+    void reset(int _K)
     {
-        return currentSize;
+        K = _K;
+        tops.clear();
+        tops.reserve(K);
+        bound_ = std::numeric_limits<float>::infinity();
+        sorted_ = true;
     }
-
-private:
-    int currentSize;
-    std::vector<Comparable> array;
     /**
-     * build heap.
+     * push a value into the TopK.
+     * @param key  the key.
+     * @param dist the distance.
+     * @return whether the value entered the TopK.
      */
-    void buildHeap()
+    bool push(unsigned key, float dist)
     {
-        for (int i = currentSize / 2; i > 0; --i)
+        if (dist > bound_)
         {
-            percolateDown(i);
+            return false;
         }
+        return pushSlow(key, dist);
     }
     /**
-     * percolate down the binary heap.
-     * @param hole the index.
+     * push n values into the TopK, same as n calls of push().
+     * @param keys  the keys.
+     * @param dists the distances.
+     * @return the number of values that entered the TopK.
      */
-    void percolateDown(int hole)
+    unsigned push(const unsigned *keys, const float *dists, unsigned n)
     {
-        int child;
-        Comparable tmp = array[hole];
-        for (; hole * 2 <= currentSize; hole = child)
+        unsigned entered = 0;
+        for (unsigned i = 0; i != n; ++i)
         {
-            child = hole * 2;
-            if (child != currentSize && array[child + 1] > array[child])
-            {
-                child++;
-            }
-            if (array[child] > tmp)
-            {
-                array[hole] = array[child];
-            }
-            else
+            if (!(dists[i] > bound_))
             {
-                break;
+                entered += pushSlow(keys[i], dists[i]);
             }
         }
-        array[hole] = tmp;
+        return entered;
     }
-};
-
-/**
- * Top-K heap.
- *
- * At this point topk should contain the nearest k query keys and distances.
- */
-class Topk
-{
-private:
-    unsigned K;
-    MaxHeap<std::pair<float, unsigned> > heap;
-    std::vector<std::pair<float, unsigned> > tops;
-    // unordered_set<unsigned> ivecs;
-public:
-    Topk(): K(0) {}
     /**
-     * reset K value.
-     * @param _K the K value in TopK.
+     * The distance a candidate has to beat, +inf until K items are held.
      */
-    void reset(int _K)
+    float threshold() const
     {
-        K = _K;
-        tops.resize(0);
+        return bound_;
     }
     /**
-     * push a value into the maxHeap.
-     * @param key  the key.
-     * @param dist the distance.
+     * Number of items currently held.
      */
-    void push(unsigned key, float dist)
+    unsigned size() const
     {
-        std::pair<float, unsigned> item(dist, key);
-        if (heap.size() < K)
-        {
-            heap.insert(item);
-        }
-        else if (item < heap.findMax())
-        {
-            heap.deleteMax();
-            heap.insert(item);
-        }
+        return tops.size();
+    }
+    unsigned getK() const
+    {
+        return K;
+    }
+    /**
+     * Bytes of the buffer of held items.
+     */
+    size_t memoryBytes() const
+    {
+        return heapBytes(tops);
     }
     /**
-     * generate TopK.
+     * generate TopK, sorted by distance in place.
      */
     const vector<pair<float, unsigned>>& genTopk()
     {
-        auto curHeap = this->heap;
-        this->tops.resize(curHeap.size());
-
-        for (unsigned i = 0; i < this->tops.size(); ++i)
+        if (!small() && !sorted_)
         {
-            curHeap.deleteMax(this->tops[i]);
+            std::sort_heap(tops.begin(), tops.end());
+            sorted_ = true;
         }
-        std::reverse(this->tops.begin(), this->tops.end());
 
         // this->ivecs.clear();
         // for (const auto& p : this->tops) {
@@ -237,6 +224,8 @@ public:
     }
     /**
      * Get the std::vector<std::pair<float, unsigned> > instance which contains the nearest keys and distances.
+     *
+     * The order is only guaranteed after genTopk() and before the next push().
      */
     const std::vector<std::pair<float, unsigned> > &getTopk() const
     {
@@ -296,8 +285,29 @@ public:
  * Top-K scanner.
  *
  * Scans keys for top-K query, this is the object passed into the LSH query interface.
+ * Candidates are ranked by METRIC::dist, genTopk() reports METRIC::finalize of it.
+ * For AG_DIST with norms cached in the accessor, the query norm is computed once
+ * in reset() and each candidate costs a single dot product.
+ *
+ * For L1 and L2 a candidate is abandoned once its partial distance exceeds the
+ * current k-th distance, see Metric::distBounded(). This never changes the
+ * result. If the base has permuted dimensions the query is permuted as well.
+ *
+ * With a Quantizer set, operator() only scores candidates on their codes, in
+ * batches of SCORE_BATCH, into a pool of the best R' ones, which genTopk()
+ * re-ranks exactly.
+ *
+ * scan() verifies the candidates of a whole bucket: the unvisited keys are
+ * gathered first, then measured in blocks of VERIFY_BLOCK while the rows of
+ * the next block are prefetched, so the memory latency of the random rows
+ * overlaps with the arithmetic. A block is one Metric::distMany() call when
+ * nothing can be abandoned (AG_DIST, IP_DIST, or setEarlyAbandon(false)),
+ * and otherwise its keys are measured one by one, see verifyBlock().
+ *
+ * Scanners that split the tables of one query share an AtomicVisited filter
+ * instead of the visited sets of their accessors, see setSharedFilter().
  */
-template <typename ACCESSOR>
+template <typename ACCESSOR, typename METRIC = Metric<typename ACCESSOR::DATATYPE> >
 class Scanner
 {
 public:
@@ -313,18 +323,39 @@ public:
      */
     Scanner(
         const ACCESSOR &accessor,
-        const Metric<DATATYPE> &metric,
+        const METRIC &metric,
         unsigned K
-    ): accessor_(accessor), metric_(metric), K_(K), cnt_(0) {}
+    ): accessor_(accessor), metric_(metric),
+        useNorms_(metric.type() == AG_DIST && accessor.hasNorms()),
+        abandon_(metric.canAbandon()),
+        queryNorm_(0), quantizer_(NULL), rerankExact_(true), poolSize_(0), shared_(NULL),
+        stopBound_(false), patience_(0), K_(K), cnt_(0), dimsTouched_(0) {}
     /**
       * Reset the query, this function should be invoked before each query.
+      *
+      * @param query    The query vector.
+      * @param expected The expected number of candidates, 0 if unknown.
       */
-    void reset(Value query)
+    void reset(Value query, unsigned expected = 0)
     {
-        query_ = query;
-        accessor_.reset();
+        const std::vector<unsigned> &order = accessor_.dimOrder();
+        query_.resize(metric_.dim());
+        for (unsigned i = 0; i != query_.size(); ++i)
+        {
+            query_[i] = order.empty() ? query[i] : query[order[i]];
+        }
+        queryNorm_ = metric_.norm(&query_[0]);
+        if (quantizer_ != NULL)
+        {
+            quantizer_->prepare(&query_[0], metric_.type(), codeQuery_);
+            pool_.reset(poolSize_);
+            pending_.clear();
+        }
+        accessor_.reset(expected);
         topk_.reset(K_);
         cnt_ = 0;
+        dimsTouched_ = 0;
+        counters_.clear();
     }
     /**
      * Number of points scanned for the current query.
@@ -352,6 +383,157 @@ public:
         return K_;
     }
 
+    /**
+     * Number of dimensions read while verifying the points of the current query.
+     */
+    unsigned long long dimsTouched() const
+    {
+        return dimsTouched_;
+    }
+
+    /**
+     * Hot-path events of the current query, all zero unless built with
+     * GQR_ENABLE_COUNTERS. The probers count their buckets here as well.
+     */
+    Counters &counters()
+    {
+        return counters_;
+    }
+
+    /**
+     * Bytes of the per-query state: visited set, TopK, candidate buffers and
+     * quantized query. The base vectors and the quantizer are not included.
+     */
+    size_t memoryBytes() const
+    {
+        return accessor_.memoryBytes() + topk_.memoryBytes() + pool_.memoryBytes() + reranked_.memoryBytes()
+            + heapBytes(pending_) + heapBytes(batch_) + heapBytes(results_) + heapBytes(query_)
+            + heapBytes(codeQuery_.lut) + heapBytes(codeQuery_.lut8) + heapBytes(codeQuery_.buffer);
+    }
+
+    /**
+     * Score candidates on the codes of quantizer and re-rank the best
+     * poolSize of them exactly, or with poolSize 0 report the approximate
+     * distances of the best K without touching the base vectors.
+     *
+     * The quantizer must be trained on the base of the accessor and outlive
+     * the scanner, NULL turns the two-stage verification off. It is ignored if
+     * it does not support the metric.
+     */
+    void setQuantizer(const Quantizer<DATATYPE> *quantizer, unsigned poolSize)
+    {
+        quantizer_ = quantizer != NULL && quantizer->supports(metric_.type()) ? quantizer : NULL;
+        rerankExact_ = poolSize != 0;
+        poolSize_ = std::max(poolSize, K_);
+        pending_.reserve(SCORE_BATCH);
+    }
+
+    /**
+     * Mark candidates in filter instead of the visited set of the accessor,
+     * so that the scanners sharing it never verify an item twice. The filter
+     * is reset by its owner and must outlive the scanner, NULL turns it off.
+     */
+    void setSharedFilter(AtomicVisited *filter)
+    {
+        shared_ = filter;
+    }
+
+    /**
+     * Enable or disable early abandoning, it is on by default for L1 and L2.
+     */
+    void setEarlyAbandon(bool abandon)
+    {
+        abandon_ = abandon && metric_.canAbandon();
+    }
+
+    /**
+     * Let the probers stop a query before its budget of items, both rules
+     * are off by default.
+     *
+     * @param bound    Stop once the lower bound on the distance of the items
+     *                 in the next bucket exceeds the K-th distance, see
+     *                 BaseProber::nextBucketBound().
+     * @param patience Stop after this many probed buckets in a row that did
+     *                 not improve the TopK, 0 for no limit.
+     */
+    void setStopRule(bool bound, unsigned patience)
+    {
+        stopBound_ = bound;
+        patience_ = patience;
+    }
+
+    bool stopOnBound() const
+    {
+        return stopBound_;
+    }
+
+    unsigned patience() const
+    {
+        return patience_;
+    }
+
+    /**
+     * The TopK the candidates are ranked into while probing, with a quantizer
+     * the pool of approximate distances.
+     */
+    const Topk &candidates() const
+    {
+        return quantizer_ == NULL ? topk_ : pool_;
+    }
+
+    /**
+     * The TopK found so far in no particular order, with ranking distances
+     * (see Metric::finalize), with a quantizer the approximate distances of
+     * the candidate pool. A view of the live TopK rather than a copy, so it
+     * can be read at any moment, e.g. when a query runs out of time, and is
+     * valid until the next scan.
+     */
+    const std::vector<std::pair<float, unsigned> > &partialTopk() const
+    {
+        return candidates().getTopk();
+    }
+
+    /**
+     * Convert a ranking distance of partialTopk() to the distance of the metric.
+     */
+    float finalize(float dist) const
+    {
+        return metric_.finalize(dist);
+    }
+
+    /**
+     * The squared L2 distance a candidate has to beat, +inf until K items are
+     * held or if the TopK is not ranked by exact squared L2 distances.
+     */
+    float l2Threshold() const
+    {
+        return metric_.type() == L2_DIST && quantizer_ == NULL ? topk_.threshold() : std::numeric_limits<float>::infinity();
+    }
+
+    /**
+     * L2 norm of the current query.
+     */
+    float queryNorm() const
+    {
+        return queryNorm_;
+    }
+
+    /**
+     * Sorted TopK results, with the distances of the metric (e.g. L2 instead of
+     * squared L2). The buffer is owned by the scanner and reused across calls.
+     */
+    const std::vector<std::pair<float, unsigned> > &genTopk()
+    {
+        const std::vector<std::pair<float, unsigned> > &tops = quantizer_ == NULL ? topk_.genTopk() : rerank();
+        results_.resize(tops.size());
+        for (unsigned i = 0; i != tops.size(); ++i)
+        {
+            results_[i].first = metric_.finalize(tops[i].first);
+            results_[i].second = tops[i].second;
+        }
+        return results_;
+    }
+
 
     /**
      * Update the current query by scanning key, this is normally invoked by the LSH
@@ -359,35 +541,119 @@ public:
      */
     void operator () (unsigned key)
     {
-        if (accessor_.mark(key))
+        counters_.count(Counters::ITEMS_SEEN);
+        if (mark(key))
         {
             ++cnt_;
 
-            topk_.push(key, metric_.dist(query_, accessor_(key)));
+            if (quantizer_ != NULL)
+            {
+                pending_.push_back(key);
+                if (pending_.size() == SCORE_BATCH)
+                {
+                    flushPending();
+                }
+                return;
+            }
+            counters_.count(Counters::TOPK_UPDATES, topk_.push(key, verifyDist(key)));
 
             // float dist = metric_.dist(query_, accessor_(key));
             // this->opqResult.emplace_back(std::make_pair(dist, key));
+            return;
+        }
+        counters_.count(Counters::DUPLICATES);
+    }
+
+    /**
+     * Update the current query by scanning n keys, with the same result as
+     * calling operator() on each of them in order.
+     */
+    void scan(const unsigned *keys, unsigned n)
+    {
+        TraceSpan span(Trace::VERIFY, n);
+        batch_.clear();
+        for (unsigned i = 0; i != n; ++i)
+        {
+            if (mark(keys[i]))
+            {
+                batch_.push_back(keys[i]);
+            }
+        }
+        cnt_ += batch_.size();
+        span.setArg(1, batch_.size());
+        counters_.count(Counters::ITEMS_SEEN, n);
+        counters_.count(Counters::DUPLICATES, n - batch_.size());
+
+        if (quantizer_ != NULL)
+        {
+            for (unsigned i = 0; i != batch_.size(); ++i)
+            {
+                pending_.push_back(batch_[i]);
+                if (pending_.size() == SCORE_BATCH)
+                {
+                    flushPending();
+                }
+            }
+            return;
+        }
+        const unsigned size = batch_.size();
+        const unsigned block = VERIFY_BLOCK;
+        prefetchRows(0, std::min(size, block));
+        for (unsigned begin = 0; begin < size; begin += block)
+        {
+            unsigned end = std::min(size, begin + block);
+            prefetchRows(end, std::min(size, end + block));
+            verifyBlock(&batch_[begin], end - begin);
+        }
+    }
+
+    /**
+     * Hint the rows of the first keys into the cache ahead of scan(), the
+     * rest are prefetched by scan() itself.
+     */
+    void prefetch(const unsigned *keys, unsigned n) const
+    {
+        if (quantizer_ != NULL)
+        {
+            return;
+        }
+        n = std::min(n, 2 * VERIFY_BLOCK);
+        for (unsigned i = 0; i != n; ++i)
+        {
+            simd::prefetch(accessor_(keys[i]), sizeof(DATATYPE) * metric_.dim());
         }
     }
 
     /*
-     * same function with operator(), but with return values (nonvisited, distance); distance has meaning only when visited is false*/
+     * same function with operator(), but with return values (nonvisited, distance); distance has meaning only when visited is false.
+     * The distance is the ranking distance of the metric, see Metric::dist.*/
     pair<bool, float> evaluate (unsigned key)
     {
-        bool nonVisited = accessor_.mark(key);
+        bool nonVisited = mark(key);
         float dist = -1;
+        counters_.count(Counters::ITEMS_SEEN);
         if (nonVisited)
         {
             ++cnt_;
-            dist = metric_.dist(query_, accessor_(key));
+            dist = calDist(key);
+            dimsTouched_ += metric_.dim();
+            counters_.count(Counters::DISTANCES);
 
-            topk_.push(key, dist);
+            counters_.count(Counters::TOPK_UPDATES, topk_.push(key, dist));
+        }
+        else
+        {
+            counters_.count(Counters::DUPLICATES);
         }
         return std::make_pair(nonVisited, dist);
     }
 
     float calDist(unsigned key) const {
-        return metric_.dist(query_, accessor_(key));
+        if (useNorms_)
+        {
+            return metric_.dist(&query_[0], queryNorm_, accessor_(key), accessor_.norm(key));
+        }
+        return metric_.dist(&query_[0], accessor_(key));
     }
 
     // const vector<pair<float, unsigned>>& getOpqResult() {
@@ -405,12 +671,150 @@ public:
     //     this->opqResult.reserve(size);
     // }
 private:
+    bool mark(unsigned key)
+    {
+        return shared_ != NULL ? shared_->mark(key) : accessor_.mark(key);
+    }
+
+    /*
+     * distance of a candidate that only matters if it enters the TopK, it may
+     * be a partial sum above the current threshold*/
+    float verifyDist(unsigned key)
+    {
+        counters_.count(Counters::DISTANCES);
+        if (!abandon_)
+        {
+            dimsTouched_ += metric_.dim();
+            return calDist(key);
+        }
+        unsigned touched;
+        float dist = metric_.distBounded(&query_[0], accessor_(key), topk_.threshold(), &touched);
+        dimsTouched_ += touched;
+        return dist;
+    }
+
+    void prefetchRows(unsigned begin, unsigned end) const
+    {
+        for (unsigned i = begin; i < end; ++i)
+        {
+            simd::prefetch(accessor_(batch_[i]), sizeof(DATATYPE) * metric_.dim());
+        }
+    }
+
+    /*
+     * verify n <= VERIFY_BLOCK unvisited keys. With early abandoning the keys
+     * are measured one by one, each against the threshold left by the pushes
+     * before it. Batching does not pay there: with the rows prefetched a block
+     * ahead, a bounded variant of the many kernels (MANY_WAYS rows per block
+     * of ABANDON_BLOCK dimensions, dropping a row once it exceeds the bound)
+     * was 0-10% slower than this loop for dimensions 128 to 960, and distMany()
+     * without abandoning 8-20% slower, on SSE, AVX2 and AVX-512 alike.*/
+    void verifyBlock(const unsigned *keys, unsigned n)
+    {
+        if (abandon_)
+        {
+            for (unsigned i = 0; i != n; ++i)
+            {
+                counters_.count(Counters::TOPK_UPDATES, topk_.push(keys[i], verifyDist(keys[i])));
+            }
+            return;
+        }
+        const DATATYPE *rows[VERIFY_BLOCK] = {};
+        float dists[VERIFY_BLOCK];
+        for (unsigned i = 0; i != n; ++i)
+        {
+            rows[i] = accessor_(keys[i]);
+        }
+        if (useNorms_)
+        {
+            float norms[VERIFY_BLOCK];
+            for (unsigned i = 0; i != n; ++i)
+            {
+                norms[i] = accessor_.norm(keys[i]);
+            }
+            metric_.distMany(&query_[0], queryNorm_, rows, norms, n, dists);
+        }
+        else
+        {
+            metric_.distMany(&query_[0], rows, n, dists);
+        }
+        dimsTouched_ += (unsigned long long)n * metric_.dim();
+        counters_.count(Counters::DISTANCES, n);
+        counters_.count(Counters::TOPK_UPDATES, topk_.push(keys, dists, n));
+    }
+
+    void flushPending()
+    {
+        TraceSpan span(Trace::SCORE, pending_.size());
+        float dists[SCORE_BATCH];
+        quantizer_->score(codeQuery_, metric_.type(), &pending_[0], pending_.size(), dists);
+        counters_.count(Counters::CODES_SCORED, pending_.size());
+        for (unsigned i = 0; i != pending_.size(); ++i)
+        {
+            counters_.count(Counters::TOPK_UPDATES, pool_.push(pending_[i], dists[i]));
+        }
+        pending_.clear();
+    }
+
+    /*
+     * merge the exact TopK (filled by evaluate()) with the pool, at exact
+     * distances unless the re-rank is off*/
+    const std::vector<std::pair<float, unsigned> > &rerank()
+    {
+        if (!pending_.empty())
+        {
+            flushPending();
+        }
+        TraceSpan span(Trace::RERANK);
+        reranked_.reset(K_);
+        const std::vector<std::pair<float, unsigned> > &exact = topk_.getTopk();
+        for (unsigned i = 0; i != exact.size(); ++i)
+        {
+            reranked_.push(exact[i].second, exact[i].first);
+        }
+        const std::vector<std::pair<float, unsigned> > &pool = pool_.getTopk();
+        span.setArg(0, pool.size());
+        for (unsigned i = 0; i != pool.size(); ++i)
+        {
+            reranked_.push(pool[i].second, rerankExact_ ? calDist(pool[i].second) : pool[i].first);
+        }
+        if (rerankExact_)
+        {
+            dimsTouched_ += (unsigned long long)pool.size() * metric_.dim();
+            counters_.count(Counters::DISTANCES, pool.size());
+        }
+        return reranked_.genTopk();
+    }
+
     ACCESSOR accessor_;
-    Metric<DATATYPE> metric_;
+    METRIC metric_;
+    bool useNorms_;
+    bool abandon_;
+    float queryNorm_;
+    static const unsigned SCORE_BATCH = 32;
+    static const unsigned VERIFY_BLOCK = 16;
+    const Quantizer<DATATYPE> *quantizer_;
+    CodeQuery codeQuery_;
+    std::vector<unsigned> pending_;
+    // unvisited keys of the current scan()
+    std::vector<unsigned> batch_;
+    bool rerankExact_;
+    unsigned poolSize_;
+    // best poolSize_ candidates by their approximate distance
+    Topk pool_;
+    Topk reranked_;
+    AtomicVisited *shared_;
+    bool stopBound_;
+    unsigned patience_;
     Topk topk_;
-    Value query_;
+    std::vector<std::pair<float, unsigned> > results_;
+    // copy of the query in the dimension order of the base
+    std::vector<DATATYPE> query_;
     unsigned K_;
     unsigned cnt_;
+    unsigned long long dimsTouched_;
+    // events of the current query
+    Counters counters_;
 
     // vector<pair<float, unsigned>> opqResult;
 };
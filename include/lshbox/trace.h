@@ -0,0 +1,327 @@
+/**
+ * @file trace.h
+ *
+ * @brief Spans of sampled queries, written as Chrome trace JSON for
+ * chrome://tracing or Perfetto.
+ *
+ * startTrace(every) samples every every-th prober that is constructed or
+ * reset. A prober makes its query the current trace of the calling thread
+ * when it is constructed or reset and whenever it probes, so the spans of the
+ * hasher, the prober and the scanner go to that query, one track per query.
+ * Every thread writes to its own ring buffer without locks, the oldest events
+ * are overwritten once it is full. Outside a sampled query a span costs one
+ * branch on a thread-local id.
+ */
+#pragma once
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <fstream>
+#include <ostream>
+#include <set>
+#include <stdint.h>
+namespace lshbox
+{
+class Trace
+{
+public:
+    enum Kind
+    {
+        QUERY,     // KItemByProber, items asked and verified
+        HASH,      // buckets of the query in all tables
+        ENCODE,    // hash bits of the query in one table
+        SETUP,     // per-table probing state, e.g. TSTable, HRTable, LRTable
+        HEAP_POP,  // next table taken from the heap of GQR / QR, with its score
+        HEAP_PUSH, // table put back on the heap with its next score
+        PROBE,     // lookup and verification of one bucket
+        VERIFY,    // scanner: candidates of a bucket, unvisited ones
+        SCORE,     // scanner: a batch of candidates scored on codes
+        RERANK,    // scanner: exact re-ranking of the pool
+        NUM_KINDS
+    };
+
+    static const char *name(Kind kind)
+    {
+        static const char *names[NUM_KINDS] = {
+            "query", "hash", "encode", "setup", "heap pop", "heap push",
+            "probe", "verify", "score", "rerank"};
+        return names[kind];
+    }
+
+    // names of the two arguments of kind, NULL if unused
+    static const char *argName(Kind kind, unsigned i)
+    {
+        static const char *names[NUM_KINDS][2] = {
+            {"items asked", "items verified"}, {"tables", NULL}, {"table", NULL}, {"table", NULL},
+            {"table", "score"}, {"table", "score"}, {"table", "items"}, {"candidates", "unvisited"},
+            {"candidates", NULL}, {"pool", NULL}};
+        return names[kind][i];
+    }
+};
+
+struct TraceEvent
+{
+    uint64_t start;    // ns since startTrace()
+    uint64_t duration; // ns, 0 for instants
+    double args[2];
+    int query;
+    unsigned char kind;
+    bool instant;
+};
+
+/**
+ * Events of one thread, only that thread writes, they are read after it
+ * stopped tracing.
+ */
+class TraceRing
+{
+public:
+    TraceRing(size_t capacity, unsigned thread): events_(capacity), next_(0), thread_(thread) {}
+
+    void push(const TraceEvent &event)
+    {
+        events_[next_ % events_.size()] = event;
+        ++next_;
+    }
+
+    // oldest first
+    template <typename FUNC>
+    void forEach(FUNC f) const
+    {
+        uint64_t first = next_ > events_.size() ? next_ - events_.size() : 0;
+        for (uint64_t i = first; i != next_; ++i)
+        {
+            f(events_[i % events_.size()]);
+        }
+    }
+
+    uint64_t dropped() const
+    {
+        return next_ > events_.size() ? next_ - events_.size() : 0;
+    }
+
+    unsigned thread() const
+    {
+        return thread_;
+    }
+
+private:
+    std::vector<TraceEvent> events_;
+    uint64_t next_;
+    unsigned thread_;
+};
+
+struct TraceState
+{
+    std::atomic<bool> enabled;
+    std::atomic<unsigned> next; // probers seen since startTrace()
+    unsigned every;
+    size_t capacity;
+    std::chrono::steady_clock::time_point origin;
+    std::mutex mutex; // guards rings
+    std::vector<std::shared_ptr<TraceRing> > rings;
+    TraceState(): enabled(false), next(0), every(1), capacity(1 << 16) {}
+};
+
+inline TraceState &traceState()
+{
+    static TraceState state;
+    return state;
+}
+
+inline bool traceEnabled()
+{
+    return traceState().enabled.load(std::memory_order_relaxed);
+}
+
+// the sampled query the calling thread works on, -1 if none
+inline int &currentTrace()
+{
+    static thread_local int query = -1;
+    return query;
+}
+
+inline bool tracing()
+{
+    return currentTrace() >= 0;
+}
+
+/**
+ * Called by a prober for a new query: returns its trace id, -1 if it is not
+ * sampled, and makes it the current trace of the thread.
+ */
+inline int beginTraceQuery()
+{
+    if (!traceEnabled())
+    {
+        return -1;
+    }
+    TraceState &state = traceState();
+    unsigned n = state.next++;
+    int query = n % state.every == 0 ? (int)n : -1;
+    currentTrace() = query;
+    return query;
+}
+
+inline TraceRing &threadTraceRing()
+{
+    static thread_local std::shared_ptr<TraceRing> ring;
+    if (!ring)
+    {
+        TraceState &state = traceState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        ring = std::make_shared<TraceRing>(state.capacity, state.rings.size());
+        state.rings.push_back(ring);
+    }
+    return *ring;
+}
+
+inline uint64_t traceNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - traceState().origin).count();
+}
+
+inline void traceInstant(Trace::Kind kind, double arg0 = 0, double arg1 = 0)
+{
+    if (!tracing())
+    {
+        return;
+    }
+    TraceEvent event = {traceNow(), 0, {arg0, arg1}, currentTrace(), (unsigned char)kind, true};
+    threadTraceRing().push(event);
+}
+
+/**
+ * Records the time from construction to destruction if the thread was in a
+ * sampled query when constructed.
+ */
+class TraceSpan
+{
+public:
+    explicit TraceSpan(Trace::Kind kind, double arg0 = 0, double arg1 = 0): on_(tracing())
+    {
+        if (on_)
+        {
+            event_.kind = kind;
+            event_.instant = false;
+            event_.args[0] = arg0;
+            event_.args[1] = arg1;
+            event_.query = currentTrace();
+            event_.start = traceNow();
+        }
+    }
+
+    void setArg(unsigned i, double value)
+    {
+        if (on_)
+        {
+            event_.args[i] = value;
+        }
+    }
+
+    ~TraceSpan()
+    {
+        if (on_)
+        {
+            event_.duration = traceNow() - event_.start;
+            threadTraceRing().push(event_);
+        }
+    }
+
+private:
+    bool on_;
+    TraceEvent event_;
+};
+
+/**
+ * Start sampling every every-th prober, each thread keeps the last capacity
+ * events. Drops the events of an earlier trace.
+ */
+inline void startTrace(unsigned every, size_t capacity = 1 << 16)
+{
+    TraceState &state = traceState();
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.rings.clear();
+    }
+    state.every = every == 0 ? 1 : every;
+    state.capacity = capacity == 0 ? 1 : capacity;
+    state.next = 0;
+    state.origin = std::chrono::steady_clock::now();
+    state.enabled = true;
+}
+
+/**
+ * Stop sampling, call it once the probing threads are done.
+ */
+inline void stopTrace()
+{
+    traceState().enabled = false;
+    currentTrace() = -1;
+}
+
+/**
+ * Write the events of all threads as Chrome trace JSON, one track per
+ * sampled query. Returns the number of events written.
+ */
+inline size_t writeChromeTrace(std::ostream &os)
+{
+    TraceState &state = traceState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    size_t count = 0;
+    std::set<int> queries;
+    os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    for (const std::shared_ptr<TraceRing> &ring : state.rings)
+    {
+        unsigned thread = ring->thread();
+        ring->forEach([&](const TraceEvent &event)
+        {
+            Trace::Kind kind = Trace::Kind(event.kind);
+            os << (count++ ? ",\n" : "\n") << "{\"name\":\"" << Trace::name(kind) << "\",\"cat\":\"gqr\",\"pid\":0,\"tid\":" << event.query
+                << ",\"ts\":" << event.start / 1000.0;
+            if (event.instant)
+            {
+                os << ",\"ph\":\"i\",\"s\":\"t\"";
+            }
+            else
+            {
+                os << ",\"ph\":\"X\",\"dur\":" << event.duration / 1000.0;
+            }
+            os << ",\"args\":{\"thread\":" << thread;
+            for (unsigned i = 0; i != 2; ++i)
+            {
+                if (Trace::argName(kind, i) != NULL)
+                {
+                    os << ",\"" << Trace::argName(kind, i) << "\":" << event.args[i];
+                }
+            }
+            os << "}}";
+            queries.insert(event.query);
+        });
+    }
+    for (int query : queries)
+    {
+        os << (count++ ? ",\n" : "\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << query
+            << ",\"args\":{\"name\":\"query " << query << "\"}}";
+    }
+    os << "\n]}" << std::endl;
+    return count - queries.size();
+}
+
+// events overwritten because a ring was full
+inline uint64_t traceDropped()
+{
+    TraceState &state = traceState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    uint64_t dropped = 0;
+    for (const std::shared_ptr<TraceRing> &ring : state.rings)
+    {
+        dropped += ring->dropped();
+    }
+    return dropped;
+}
+}
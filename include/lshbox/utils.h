@@ -64,6 +64,36 @@ unordered_map<string, string> parseParams(int argc, const char** argv) {
     return params;
 }
 
+/*
+ * add the key=value lines of a config file to params, a leading "--" is
+ * optional, blank lines and lines starting with '#' are skipped. Keys that
+ * params already has are kept, so the command line overrides the file.
+ * */
+void loadParams(const string& path, unordered_map<string, string>& params) {
+    std::ifstream fin(path.c_str());
+    if (!fin) {
+        std::cerr << "cannot open config file " << path << std::endl;
+        assert(false);
+    }
+    string line;
+    while (std::getline(fin, line)) {
+        line.erase(0, line.find_first_not_of(" \t"));
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        if (line.compare(0, 2, "--") == 0) {
+            line.erase(0, 2);
+        }
+        size_t sepIdx = line.find('=');
+        if (sepIdx == string::npos || sepIdx == 0) {
+            std::cerr << "config error in " << path << ", line should be [key]=[value]: " << line << std::endl;
+            assert(false);
+        }
+        params.insert(std::make_pair(line.substr(0, sepIdx), line.substr(sepIdx + 1)));
+    }
+}
+
 /*
  * padding meaningless euclidean distance
  * */
@@ -0,0 +1,432 @@
+/**
+ * @file visited.h
+ *
+ * @brief Visited sets used to de-duplicate candidates across hash tables.
+ *
+ * A query may see the same item in several tables (or several buckets of a
+ * graph), so every candidate is marked before it is verified. The sets below
+ * make the per-query cost proportional to the number of candidates instead of
+ * the size of the base set:
+ *
+ * - HashVisited: a small open-addressing hash set for low probe budgets.
+ * - EpochVisited: a stamp array whose reset only bumps the epoch.
+ * - BitVisited: a plain bitmap, used when the epoch array of the thread is
+ *   already taken by another live query.
+ * - VisitedSet: picks one of the above from the expected candidate count.
+ * - AtomicVisited: a bitmap shared by the threads that probe one query, whose
+ *   reset only clears the words marked by the previous query.
+ */
+#pragma once
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <memory>
+#include <stdint.h>
+#include "lshbox/memory.h"
+namespace lshbox
+{
+/**
+ * Epoch-stamped visited set.
+ *
+ * An item is visited iff its stamp equals the current epoch, so reset() is
+ * O(1). The whole array is only cleared when the epoch wraps around.
+ */
+template <typename STAMP = uint16_t>
+class EpochVisited {
+public:
+    explicit EpochVisited(unsigned size = 0): stamps_(size, 0), epoch_(1) {}
+
+    /**
+     * Make room for keys in [0, size), never shrinks.
+     */
+    void resize(unsigned size) {
+        if (size > stamps_.size()) {
+            stamps_.resize(size, 0);
+        }
+    }
+
+    void reset() {
+        if (++epoch_ == 0) {
+            std::fill(stamps_.begin(), stamps_.end(), 0);
+            epoch_ = 1;
+        }
+    }
+
+    bool mark(unsigned key) {
+        if (stamps_[key] == epoch_) {
+            return false;
+        }
+        stamps_[key] = epoch_;
+        return true;
+    }
+
+    bool visited(unsigned key) const {
+        return stamps_[key] == epoch_;
+    }
+
+    unsigned size() const {
+        return stamps_.size();
+    }
+
+    size_t memoryBytes() const {
+        return heapBytes(stamps_);
+    }
+
+private:
+    std::vector<STAMP> stamps_;
+    STAMP epoch_;
+};
+
+/**
+ * Open-addressing (linear probing) hash set of unsigned keys.
+ *
+ * reset() costs O(capacity), i.e. the work done by the previous query.
+ */
+class HashVisited {
+public:
+    explicit HashVisited(unsigned expected = 0): size_(0), shift_(32) {
+        reset(expected);
+    }
+
+    /**
+     * Clear the set and make sure it can hold expected keys without growing.
+     */
+    void reset(unsigned expected = 0) {
+        unsigned capacity = MIN_CAPACITY;
+        while (capacity < 2 * expected) {
+            capacity <<= 1;
+        }
+        if (capacity > keys_.size()) {
+            rehash(capacity, false);
+        } else if (size_ != 0) {
+            std::fill(keys_.begin(), keys_.end(), EMPTY);
+        }
+        size_ = 0;
+    }
+
+    bool mark(unsigned key) {
+        unsigned mask = keys_.size() - 1;
+        unsigned slot = hash(key);
+        while (keys_[slot] != EMPTY) {
+            if (keys_[slot] == key) {
+                return false;
+            }
+            slot = (slot + 1) & mask;
+        }
+        keys_[slot] = key;
+        if (++size_ * 2 > keys_.size()) {
+            rehash(keys_.size() * 2, true);
+        }
+        return true;
+    }
+
+    unsigned size() const {
+        return size_;
+    }
+
+    size_t memoryBytes() const {
+        return heapBytes(keys_);
+    }
+
+    /**
+     * Apply f to every key in the set.
+     */
+    template <typename FUNC>
+    void forEach(FUNC f) const {
+        for (unsigned i = 0; i < keys_.size(); ++i) {
+            if (keys_[i] != EMPTY) {
+                f(keys_[i]);
+            }
+        }
+    }
+
+private:
+    // enumerators, std::fill and assign take them by reference
+    enum : unsigned { EMPTY = 0xFFFFFFFFu, MIN_CAPACITY = 64 };
+
+    std::vector<unsigned> keys_;
+    unsigned size_;
+    unsigned shift_;
+
+    // fibonacci hashing, the high bits of the product are well mixed
+    unsigned hash(unsigned key) const {
+        return (unsigned)(key * 2654435769u) >> shift_;
+    }
+
+    void rehash(unsigned capacity, bool keep) {
+        std::vector<unsigned> old;
+        if (keep) {
+            old.swap(keys_);
+        }
+        keys_.assign(capacity, EMPTY);
+        shift_ = 32;
+        for (unsigned c = capacity; c > 1; c >>= 1) {
+            --shift_;
+        }
+        unsigned mask = capacity - 1;
+        for (unsigned i = 0; i < old.size(); ++i) {
+            if (old[i] != EMPTY) {
+                unsigned slot = hash(old[i]);
+                while (keys_[slot] != EMPTY) {
+                    slot = (slot + 1) & mask;
+                }
+                keys_[slot] = old[i];
+            }
+        }
+    }
+};
+
+/**
+ * Bitmap visited set, reset() is O(size) but only if a key was marked.
+ */
+class BitVisited {
+public:
+    explicit BitVisited(unsigned size = 0): dirty_(false) {
+        resize(size);
+    }
+
+    void resize(unsigned size) {
+        words_.resize((size + 63) / 64, 0);
+    }
+
+    void reset() {
+        if (dirty_) {
+            std::fill(words_.begin(), words_.end(), 0);
+            dirty_ = false;
+        }
+    }
+
+    bool mark(unsigned key) {
+        uint64_t &word = words_[key >> 6];
+        uint64_t bit = (uint64_t)1 << (key & 63);
+        if (word & bit) {
+            return false;
+        }
+        word |= bit;
+        dirty_ = true;
+        return true;
+    }
+
+    bool visited(unsigned key) const {
+        return (words_[key >> 6] >> (key & 63)) & 1;
+    }
+
+    size_t memoryBytes() const {
+        return heapBytes(words_);
+    }
+
+private:
+    std::vector<uint64_t> words_;
+    bool dirty_;
+};
+
+/**
+ * Bitmap visited set that several threads may mark concurrently, each key is
+ * reported unvisited to exactly one of them.
+ *
+ * The thread that sets the first bit of a word records it, so reset() only
+ * clears the words marked since the previous reset.
+ */
+class AtomicVisited {
+public:
+    explicit AtomicVisited(unsigned size = 0):
+        numWords_((size + 63) / 64),
+        words_(new std::atomic<uint64_t>[numWords_]),
+        touched_(new unsigned[numWords_]),
+        numTouched_(0) {
+        for (unsigned i = 0; i < numWords_; ++i) {
+            words_[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // not thread safe, call before the threads start marking
+    void reset() {
+        unsigned numTouched = numTouched_.load(std::memory_order_relaxed);
+        for (unsigned i = 0; i < numTouched; ++i) {
+            words_[touched_[i]].store(0, std::memory_order_relaxed);
+        }
+        numTouched_.store(0, std::memory_order_relaxed);
+    }
+
+    bool mark(unsigned key) {
+        uint64_t bit = (uint64_t)1 << (key & 63);
+        uint64_t old = words_[key >> 6].fetch_or(bit, std::memory_order_relaxed);
+        if (old == 0) {
+            touched_[numTouched_.fetch_add(1, std::memory_order_relaxed)] = key >> 6;
+        }
+        return !(old & bit);
+    }
+
+private:
+    unsigned numWords_;
+    std::unique_ptr<std::atomic<uint64_t>[]> words_;
+    // the words set since the last reset, each once
+    std::unique_ptr<unsigned[]> touched_;
+    std::atomic<unsigned> numTouched_;
+};
+
+/**
+ * The epoch array shared by all visited sets of a thread. Only the owner may
+ * mark into it, so a query that is interleaved with others keeps its marks.
+ */
+struct EpochLease {
+    EpochVisited<> table;
+    std::atomic<const void *> owner;
+    EpochLease(): owner(NULL) {}
+};
+
+inline EpochLease &threadEpochLease()
+{
+    static thread_local EpochLease lease;
+    return lease;
+}
+
+/**
+ * Visited set of Matrix::Accessor.
+ *
+ * Starts as a HashVisited sized by the expected candidate count. Once the
+ * number of candidates passes numKeys / PROMOTE_RATIO it moves to the epoch
+ * array of the current thread, or to a private bitmap if that array is held
+ * by another live query.
+ */
+class VisitedSet {
+public:
+    // enumerators, std::max takes them by reference
+    enum : unsigned { PROMOTE_RATIO = 128, MIN_PROMOTE = 256 };
+
+    explicit VisitedSet(unsigned numKeys = 0):
+        numKeys_(numKeys),
+        threshold_(std::max<unsigned>(MIN_PROMOTE, numKeys / PROMOTE_RATIO)),
+        mode_(HASH),
+        lease_(NULL) {}
+
+    // marks are copied, the lease is not
+    VisitedSet(const VisitedSet &other):
+        numKeys_(other.numKeys_),
+        threshold_(other.threshold_),
+        mode_(HASH),
+        lease_(NULL) {
+        copyMarks(other);
+    }
+
+    VisitedSet &operator = (const VisitedSet &other) {
+        if (this != &other) {
+            release();
+            numKeys_ = other.numKeys_;
+            threshold_ = other.threshold_;
+            mode_ = HASH;
+            hash_.reset();
+            copyMarks(other);
+        }
+        return *this;
+    }
+
+    ~VisitedSet() {
+        release();
+    }
+
+    /**
+     * Clear the set, this function should be invoked before each query.
+     *
+     * @param expected The expected number of candidates, 0 if unknown.
+     */
+    void reset(unsigned expected = 0) {
+        if (mode_ == BITS) {
+            bits_.reset();
+        }
+        if (expected > threshold_) {
+            mode_ = HASH;
+            hash_.reset();
+            promote();
+            return;
+        }
+        release();
+        mode_ = HASH;
+        hash_.reset(expected);
+    }
+
+    /**
+     * Mark key as visited, return false if it was visited already.
+     */
+    bool mark(unsigned key) {
+        switch (mode_) {
+        case EPOCH:
+            return lease_->table.mark(key);
+        case BITS:
+            return bits_.mark(key);
+        default:
+            if (!hash_.mark(key)) {
+                return false;
+            }
+            if (hash_.size() > threshold_) {
+                promote();
+            }
+            return true;
+        }
+    }
+
+    /**
+     * Bytes of the private hash set and bitmap, the epoch array is shared by
+     * the visited sets of a thread and not included.
+     */
+    size_t memoryBytes() const {
+        return hash_.memoryBytes() + bits_.memoryBytes();
+    }
+
+private:
+    enum Mode {HASH, EPOCH, BITS};
+
+    unsigned numKeys_;
+    unsigned threshold_;
+    Mode mode_;
+    HashVisited hash_;
+    BitVisited bits_;
+    EpochLease *lease_;
+
+    // move the marks of hash_ to the thread epoch array or the bitmap
+    void promote() {
+        if (lease_ == NULL) {
+            EpochLease &lease = threadEpochLease();
+            const void *expected = NULL;
+            if (lease.owner.compare_exchange_strong(expected, this)) {
+                lease_ = &lease;
+            }
+        }
+        if (lease_ != NULL) {
+            lease_->table.resize(numKeys_);
+            lease_->table.reset();
+            EpochVisited<> &table = lease_->table;
+            hash_.forEach([&table](unsigned key) { table.mark(key); });
+            mode_ = EPOCH;
+        } else {
+            bits_.resize(numKeys_);
+            bits_.reset();
+            BitVisited &bits = bits_;
+            hash_.forEach([&bits](unsigned key) { bits.mark(key); });
+            mode_ = BITS;
+        }
+    }
+
+    void release() {
+        if (lease_ != NULL) {
+            lease_->owner.store(NULL);
+            lease_ = NULL;
+        }
+    }
+
+    void copyMarks(const VisitedSet &other) {
+        if (other.mode_ == HASH) {
+            hash_ = other.hash_;
+            return;
+        }
+        bits_.resize(numKeys_);
+        bits_.reset();
+        for (unsigned key = 0; key < numKeys_; ++key) {
+            if (other.mode_ == EPOCH ? other.lease_->table.visited(key) : other.bits_.visited(key)) {
+                bits_.mark(key);
+            }
+        }
+        mode_ = BITS;
+    }
+};
+}
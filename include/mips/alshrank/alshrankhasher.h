@@ -16,5 +16,17 @@ public:
             prober(itemId);
         }
     }
+
+    // probers of this hasher return items instead of buckets, one per step
+    template<typename PROBER>
+    bool probeStep(ProbeState& state, PROBER &prober, int numItems) {
+        if (!(prober.getNumItemsProbed() < numItems && prober.nextBucketExisted())) {
+            state.stage = ProbeState::DONE;
+            return false;
+        }
+        const auto& p = prober.getNextBID();
+        prober(p.second.front());
+        return true;
+    }
 };
 }
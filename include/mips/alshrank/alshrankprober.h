@@ -83,8 +83,9 @@ public:
         LSHTYPE& mylsh) : MTableProber<ACCESSOR, BIDTYPE>(query, scanner, mylsh) {
 
         this->LTable_.reserve(mylsh.tables.size());
+        vector<vector<float>> allHashFloats = mylsh.getAllHashFloats(query);
         for (int tb = 0; tb < mylsh.tables.size(); ++tb) {
-            vector<float> hashFloats = mylsh.getHashFloats(tb, query);
+            const vector<float>& hashFloats = allHashFloats[tb];
             vector<int> hashInts (hashFloats.size());
             for (int idx = 0; idx < hashFloats.size(); ++idx) {
                 hashInts[idx] = floor(hashFloats[idx]);
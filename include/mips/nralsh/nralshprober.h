@@ -38,7 +38,8 @@ public:
         const auto& scalers = mylsh.getScalers();
 
         for (int tb = 0; tb < mylsh.tables.size(); ++tb) {
-            BIDTYPE hashInts = mylsh.getBuckets(tb, query);
+            // computed once for all tables by BaseProber
+            const BIDTYPE& hashInts = this->buckets_[tb];
 
             auto distor = [&hashInts, &scalers] (const BIDTYPE& bucket) {
                 assert(bucket.size() - hashInts.size() == 1);
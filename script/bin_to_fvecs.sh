@@ -14,5 +14,6 @@ dataset="cifar60k"
 dimension=512
 bin_file="../data/${dataset}/${dataset}.bin"
 fvecs_file="./fvecs/${dataset}.fvecs"
+num_threads=`nproc`
 
-gdb --args ../build/bin/bin_to_fvecs $bin_file $fvecs_file $dimension
+gdb --args ../build/bin/bin_to_fvecs $bin_file $fvecs_file $dimension $num_threads
@@ -18,6 +18,7 @@ query_fvecs_file="./fvecs/${dataset}_query.fvecs"
 
 base_doublebin_file="../data/${dataset}/${dataset}_base.bin"
 base_fvecs_file="./fvecs/${dataset}_base.fvecs"
+num_threads=`nproc`
 
-../build/bin/doublebin_to_fvecs $query_doublebin_file $query_fvecs_file $dimension
-../build/bin/doublebin_to_fvecs $base_doublebin_file $base_fvecs_file $dimension
+../build/bin/doublebin_to_fvecs $query_doublebin_file $query_fvecs_file $dimension $num_threads
+../build/bin/doublebin_to_fvecs $base_doublebin_file $base_fvecs_file $dimension $num_threads
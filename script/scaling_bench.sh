@@ -0,0 +1,55 @@
+#!/bin/bash
+mkdir ../build 
+cd ../build 
+# cmake ../ -DCMAKE_BUILD_TYPE=Debug
+cmake ../ -DCMAKE_BUILD_TYPE=Release
+make scaling_bench 2>&1 | tee ../script/log.txt
+cd ../script
+log=`grep error log.txt`
+if [ "$log" != "" ]; then
+    exit
+fi
+
+### sweeps, the first value of every list is the base configuration,
+### the other values vary one parameter at a time
+num_items="10000,40000,160000,640000"
+dims="64,128,256"
+codelens="16,12,20"
+tables="1,2,4"
+threads="1,2,4,8"
+
+### query methods and target recall of top-k
+methods="GQR,HR,QR,HL,MIH"
+recall=0.9
+topk=20
+num_queries=200
+
+## models computed in C++: random projections or PCA
+model="random"
+# model="pca"
+
+## synthetic Gaussian clusters by default, or sample a real dataset
+base_file=""
+query_file=""
+# dataset="audio"
+# base_file="../data/${dataset}/${dataset}_base.fvecs"
+# query_file="../data/${dataset}/${dataset}_query.fvecs"
+
+data_args=""
+if [ "$base_file" != "" ]; then
+    data_args="--base_file=$base_file --query_file=$query_file"
+fi
+
+../build/bin/scaling_bench \
+    --num_items=$num_items \
+    --dims=$dims \
+    --codelens=$codelens \
+    --tables=$tables \
+    --threads=$threads \
+    --methods=$methods \
+    --recall=$recall \
+    --k=$topk \
+    --num_queries=$num_queries \
+    --model=$model \
+    --output=scaling_bench.csv \
+    $data_args
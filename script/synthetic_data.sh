@@ -0,0 +1,31 @@
+cd ../build 
+# cmake ../ -DCMAKE_BUILD_TYPE=Debug
+cmake ../ -DCMAKE_BUILD_TYPE=Release
+make synthetic_data 2>&1 | tee ../script/log.txt
+cd ../script
+log=`grep error log.txt`
+if [ "$log" != "" ]; then
+    exit
+fi
+
+# writes ${dataset}_base.fvecs, ${dataset}_query.fvecs and
+# ${dataset}_groundtruth.lshbox / .ivecs as search.sh expects them
+dataset="synthetic1m"
+mkdir -p ../data/${dataset}
+
+num_items=1000000
+num_queries=1000
+dimension=128
+intrinsic_dim=32
+clusters=1000
+anisotropy=10
+# > 0 skews the norms of the base for the MIPS paths, e.g. norm_skew=1 with metric="product"
+norm_skew=0
+metric="euclidean"
+topk=20
+seed=1
+num_threads=`nproc`
+
+../build/bin/synthetic_data --output=../data/${dataset}/${dataset} --num_items=$num_items --num_queries=$num_queries \
+    --dim=$dimension --intrinsic_dim=$intrinsic_dim --clusters=$clusters --anisotropy=$anisotropy --norm_skew=$norm_skew \
+    --metric=$metric --topk=$topk --seed=$seed --threads=$num_threads